@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdalign.h>
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+#define ARENA_BLOCK_ALIGNMENT 64  // A cache line
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+    alignas(ARENA_BLOCK_ALIGNMENT) unsigned char data[];
+};
+
+static _Thread_local GraphArena* current_arena = NULL;
+
+static ArenaBlock* create_block(size_t capacity) {
+    ArenaBlock* block = aligned_alloc(ARENA_BLOCK_ALIGNMENT, sizeof(ArenaBlock) + capacity);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+static void init_chain(ArenaChain* chain, size_t block_size) {
+    chain->first = create_block(block_size);
+    chain->current = chain->first;
+}
+
+GraphArena* create_graph_arena(size_t block_size) {
+    GraphArena* arena = malloc(sizeof(GraphArena));
+    // Whole cache lines, so sizeof(ArenaBlock) + capacity suits aligned_alloc()
+    block_size = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    arena->block_size = (block_size + ARENA_BLOCK_ALIGNMENT - 1) & ~(size_t)(ARENA_BLOCK_ALIGNMENT - 1);
+    init_chain(&arena->nodes, arena->block_size);
+    init_chain(&arena->data, arena->block_size);
+    return arena;
+}
+
+static void* chain_alloc(ArenaChain* chain, size_t size, size_t alignment, size_t block_size) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+
+    ArenaBlock* block = chain->current;
+    while (block->used + size > block->capacity) {
+        // After a reset the chain already holds blocks; reuse them first
+        if (block->next && block->next->capacity >= size) {
+            block = block->next;
+            block->used = 0;
+            continue;
+        }
+        size_t capacity = size > block_size ? (size + ARENA_BLOCK_ALIGNMENT - 1) & ~(size_t)(ARENA_BLOCK_ALIGNMENT - 1)
+                                            : block_size;
+        ArenaBlock* fresh = create_block(capacity);
+        if (!fresh) {
+            return NULL;
+        }
+        fresh->next = block->next;
+        block->next = fresh;
+        block = fresh;
+    }
+    chain->current = block;
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void* arena_alloc(GraphArena* arena, size_t size) {
+    return chain_alloc(&arena->nodes, size, ARENA_NODE_ALIGNMENT, arena->block_size);
+}
+
+void* arena_alloc_data(GraphArena* arena, size_t size) {
+    return chain_alloc(&arena->data, size, ARENA_ALIGNMENT, arena->block_size);
+}
+
+static void reset_chain(ArenaChain* chain) {
+    chain->first->used = 0;
+    chain->current = chain->first;
+}
+
+void reset_graph_arena(GraphArena* arena) {
+    reset_chain(&arena->nodes);
+    reset_chain(&arena->data);
+}
+
+static void free_chain(ArenaChain* chain) {
+    ArenaBlock* block = chain->first;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void free_graph_arena(GraphArena* arena) {
+    if (current_arena == arena) {
+        current_arena = NULL;
+    }
+    free_chain(&arena->nodes);
+    free_chain(&arena->data);
+    free(arena);
+}
+
+GraphArena* bind_graph_arena(GraphArena* arena) {
+    GraphArena* previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+GraphArena* bound_graph_arena() {
+    return current_arena;
+}
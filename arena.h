@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_NODE_ALIGNMENT 32  // Half a cache line, the size of a node
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+} ArenaChain;
+
+// Bump allocator that owns every node, input array and value of a graph.
+// Nodes and input arrays are packed into cache-line aligned blocks of
+// their own, so traversals, which only touch nodes, are not diluted by
+// values and grads; those come from a second chain of blocks. Memory is
+// only returned as a whole, by reset_graph_arena() (keeps the blocks for
+// the next graph) or free_graph_arena() (gives them back to the system).
+typedef struct {
+    ArenaChain nodes;
+    ArenaChain data;
+    size_t block_size;
+} GraphArena;
+
+GraphArena* create_graph_arena(size_t block_size);
+// Nodes and input arrays, in multiples of ARENA_NODE_ALIGNMENT bytes
+void* arena_alloc(GraphArena* arena, size_t size);
+// Values and grads
+void* arena_alloc_data(GraphArena* arena, size_t size);
+void reset_graph_arena(GraphArena* arena);
+void free_graph_arena(GraphArena* arena);
+
+// Route node allocation of the calling thread to arena (NULL for malloc).
+// Returns the previously bound arena so bindings can be nested.
+GraphArena* bind_graph_arena(GraphArena* arena);
+GraphArena* bound_graph_arena();
+
+#endif
@@ -0,0 +1,193 @@
+#include "batch_pipeline.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Polls of a counter before a waiting side blocks; covers the short gaps
+// between batches without a system call
+#define PIPELINE_SPINS 2048
+
+struct BatchPipeline {
+    const Dataset* dataset;
+    int batch_size;
+    int depth;
+    int epochs;
+    int batches_per_epoch;
+    double* mean;
+    double* scale;
+    int* order;  // Owned by the producer
+    uint64_t rng;
+
+    PackedBatch* slots;
+    // Batches published by the producer and released by the consumer; slot
+    // k % depth belongs to the producer while k - released < depth
+    _Atomic unsigned long published;
+    _Atomic unsigned long released;
+    _Atomic int shutdown;
+    unsigned long consumed;  // Owned by the consumer
+    // A side that has spun out sleeps on its condition; every publish,
+    // release and shutdown broadcasts under the lock
+    pthread_mutex_t lock;
+    pthread_cond_t published_changed;
+    pthread_cond_t released_changed;
+    pthread_t thread;
+};
+
+// Waits until counter reaches target, or shutdown is requested; returns
+// whether the counter got there
+static int wait_for(BatchPipeline* pipeline, _Atomic unsigned long* counter, unsigned long target,
+                    pthread_cond_t* changed) {
+    for (int spin = 0; spin < PIPELINE_SPINS; spin++) {
+        if (atomic_load_explicit(counter, memory_order_acquire) >= target) return 1;
+        if (atomic_load_explicit(&pipeline->shutdown, memory_order_relaxed)) return 0;
+    }
+    pthread_mutex_lock(&pipeline->lock);
+    while (atomic_load_explicit(counter, memory_order_acquire) < target &&
+           !atomic_load_explicit(&pipeline->shutdown, memory_order_relaxed)) {
+        pthread_cond_wait(changed, &pipeline->lock);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return atomic_load_explicit(counter, memory_order_acquire) >= target;
+}
+
+// Stores the new count, then wakes the other side if it sleeps. Taking the
+// lock orders the store before a sleeper's last check.
+static void advance(BatchPipeline* pipeline, _Atomic unsigned long* counter, unsigned long value,
+                    pthread_cond_t* changed) {
+    atomic_store_explicit(counter, value, memory_order_release);
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_broadcast(changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static uint64_t next_random(uint64_t* state) {
+    // xorshift64*, private to the producer so rand() stays untouched
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static void shuffle_order(BatchPipeline* pipeline) {
+    int n = pipeline->dataset->num_samples;
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(next_random(&pipeline->rng) % (uint64_t)(i + 1));
+        int temp = pipeline->order[i];
+        pipeline->order[i] = pipeline->order[j];
+        pipeline->order[j] = temp;
+    }
+}
+
+static void pack_batch(BatchPipeline* pipeline, PackedBatch* batch, int epoch, int first) {
+    const Dataset* dataset = pipeline->dataset;
+    const int* order = pipeline->order + first;
+    int count = dataset->num_samples - first < pipeline->batch_size ? dataset->num_samples - first
+                                                                     : pipeline->batch_size;
+    batch->epoch = epoch;
+    batch->count = count;
+    for (int j = 0; j < dataset->num_features; j++) {
+        const double* x = dataset_feature(dataset, j);
+        double* packed = batch->features + (size_t)j * batch->stride;
+        double mean = pipeline->mean[j], scale = pipeline->scale[j];
+        for (int i = 0; i < count; i++) {
+            packed[i] = (x[order[i]] - mean) * scale;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        batch->labels[i] = dataset->labels[order[i]];
+    }
+}
+
+static void* producer_main(void* arg) {
+    BatchPipeline* pipeline = arg;
+    unsigned long k = 0;
+    for (int epoch = 0; epoch < pipeline->epochs; epoch++) {
+        shuffle_order(pipeline);
+        for (int b = 0; b < pipeline->batches_per_epoch; b++, k++) {
+            // Slot k % depth is free once batch k - depth has been released
+            unsigned long depth = pipeline->depth;
+            unsigned long needed = k + 1 > depth ? k + 1 - depth : 0;
+            if (!wait_for(pipeline, &pipeline->released, needed, &pipeline->released_changed)) return NULL;
+            pack_batch(pipeline, &pipeline->slots[k % pipeline->depth], epoch, b * pipeline->batch_size);
+            advance(pipeline, &pipeline->published, k + 1, &pipeline->published_changed);
+        }
+    }
+    return NULL;
+}
+
+BatchPipeline* create_batch_pipeline(const Dataset* dataset, int batch_size, int depth, int epochs,
+                                     const double* mean, const double* scale, unsigned int seed) {
+    if (batch_size < 1 || depth < 1 || dataset->num_samples < 1) {
+        fprintf(stderr, "Error: A batch pipeline needs samples, a batch size and at least one slot.\n");
+        return NULL;
+    }
+
+    BatchPipeline* pipeline = malloc(sizeof(BatchPipeline));
+    int num_features = dataset->num_features;
+    pipeline->dataset = dataset;
+    pipeline->batch_size = batch_size;
+    pipeline->depth = depth;
+    pipeline->epochs = epochs;
+    pipeline->batches_per_epoch = (dataset->num_samples + batch_size - 1) / batch_size;
+    pipeline->mean = malloc(num_features * sizeof(double));
+    pipeline->scale = malloc(num_features * sizeof(double));
+    memcpy(pipeline->mean, mean, num_features * sizeof(double));
+    memcpy(pipeline->scale, scale, num_features * sizeof(double));
+    pipeline->order = malloc(dataset->num_samples * sizeof(int));
+    for (int i = 0; i < dataset->num_samples; i++) {
+        pipeline->order[i] = i;
+    }
+    pipeline->rng = ((uint64_t)seed << 1) | 1;  // xorshift needs a nonzero state
+
+    pipeline->slots = malloc(depth * sizeof(PackedBatch));
+    size_t packed_size = (size_t)(num_features > 0 ? num_features : 1) * batch_size * sizeof(double);
+    for (int s = 0; s < depth; s++) {
+        pipeline->slots[s].stride = batch_size;
+        pipeline->slots[s].features = malloc(packed_size);
+        pipeline->slots[s].labels = malloc(batch_size * sizeof(double));
+    }
+    atomic_init(&pipeline->published, 0);
+    atomic_init(&pipeline->released, 0);
+    atomic_init(&pipeline->shutdown, 0);
+    pipeline->consumed = 0;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->published_changed, NULL);
+    pthread_cond_init(&pipeline->released_changed, NULL);
+    pthread_create(&pipeline->thread, NULL, producer_main, pipeline);
+    return pipeline;
+}
+
+const PackedBatch* next_batch(BatchPipeline* pipeline) {
+    unsigned long k = pipeline->consumed;
+    if (k == (unsigned long)pipeline->epochs * pipeline->batches_per_epoch) {
+        return NULL;
+    }
+    wait_for(pipeline, &pipeline->published, k + 1, &pipeline->published_changed);
+    return &pipeline->slots[k % pipeline->depth];
+}
+
+void release_batch(BatchPipeline* pipeline) {
+    advance(pipeline, &pipeline->released, ++pipeline->consumed, &pipeline->released_changed);
+}
+
+void free_batch_pipeline(BatchPipeline* pipeline) {
+    atomic_store_explicit(&pipeline->shutdown, 1, memory_order_relaxed);
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_broadcast(&pipeline->released_changed);
+    pthread_mutex_unlock(&pipeline->lock);
+    pthread_join(pipeline->thread, NULL);
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->published_changed);
+    pthread_cond_destroy(&pipeline->released_changed);
+    for (int s = 0; s < pipeline->depth; s++) {
+        free(pipeline->slots[s].features);
+        free(pipeline->slots[s].labels);
+    }
+    free(pipeline->slots);
+    free(pipeline->order);
+    free(pipeline->mean);
+    free(pipeline->scale);
+    free(pipeline);
+}
@@ -0,0 +1,36 @@
+#ifndef BATCH_PIPELINE_H
+#define BATCH_PIPELINE_H
+
+#include "dataset.h"
+
+// Minibatches prepared on a background thread. For every epoch the
+// producer shuffles the sample indices, then gathers each batch from the
+// dataset, standardizes it with (x - mean) * scale and packs it into one
+// of depth preallocated slots. Slots pass between the producer and the
+// training thread through a single-producer, single-consumer ring of
+// atomic counters, so preparing the next batches overlaps with training
+// on the current one. A side that finds the ring full or empty polls it
+// briefly, then sleeps on a condition variable until the other side
+// publishes or releases a batch.
+typedef struct {
+    int epoch;
+    int count;  // Samples in this batch; the last one of an epoch may be short
+    int stride;  // batch_size
+    double* features;  // Feature j of sample i at features[j * stride + i]
+    double* labels;  // Class indices, as the tape stores them
+} PackedBatch;
+
+typedef struct BatchPipeline BatchPipeline;
+
+// depth is the number of slots: 2 for double, 3 for triple buffering.
+// mean and scale hold one value per feature and are copied. The producer
+// stops after epochs epochs.
+BatchPipeline* create_batch_pipeline(const Dataset* dataset, int batch_size, int depth, int epochs,
+                                     const double* mean, const double* scale, unsigned int seed);
+// Waits for the next batch, or returns NULL once every epoch is consumed.
+// The batch stays valid until release_batch().
+const PackedBatch* next_batch(BatchPipeline* pipeline);
+void release_batch(BatchPipeline* pipeline);
+void free_batch_pipeline(BatchPipeline* pipeline);
+
+#endif
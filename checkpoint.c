@@ -0,0 +1,331 @@
+#include "checkpoint.h"
+#include <string.h>
+
+// Local slots of a segment: the stored slots of earlier segments it reads
+// come first as variables, then its own slots in tape order
+typedef struct {
+    Tape tape;  // values and grads point into the shared workspace
+    int num_loaded;
+    int* stored;  // Store index of every local slot, or -1
+} Segment;
+
+struct CheckpointedTape {
+    int lanes;
+    int num_segments;
+    Segment* segments;
+    int num_stored;
+    DifferentiableOperation** stored_nodes;
+    double* stored_values;
+    double* stored_grads;
+    int max_locals;
+    double* workspace_values;
+    double* workspace_grads;
+    double* scratch;
+    int workspace_segment;  // Segment whose values are in the workspace, or -1
+};
+
+// Slot i stays stored if it is a variable, a root, or read by a later segment
+static int is_stored(const Tape* structure, const int* last_use, const unsigned char* is_root, int i, int length) {
+    return structure->opcodes[i] == OP_VARIABLE || is_root[i] || (last_use[i] >= 0 && last_use[i] / length != i / length);
+}
+
+static size_t footprint(const Tape* structure, const int* last_use, const unsigned char* is_root, int length,
+                        int lanes, int* seen) {
+    int n = structure->num_nodes;
+    int num_stored = 0, max_locals = 0;
+    for (int i = 0; i < n; i++) {
+        num_stored += is_stored(structure, last_use, is_root, i, length);
+        seen[i] = -1;
+    }
+    for (int first = 0; first < n; first += length) {
+        int last = first + length < n ? first + length : n;
+        int locals = last - first;
+        for (int e = structure->input_start[first]; e < structure->input_start[last]; e++) {
+            int input = structure->input_indices[e];
+            if (input < first && seen[input] != first) {
+                seen[input] = first;
+                locals++;
+            }
+        }
+        if (locals > max_locals) max_locals = locals;
+    }
+    return (size_t)(num_stored + max_locals) * lanes * 2 * sizeof(double);
+}
+
+static void build_segment(CheckpointedTape* tape, Segment* segment, const Tape* structure, const int* store_index,
+                          int first, int last, int* local_of) {
+    // Loaded slots first
+    int num_loaded = 0, num_edges = structure->input_start[last] - structure->input_start[first];
+    for (int e = structure->input_start[first]; e < structure->input_start[last]; e++) {
+        int input = structure->input_indices[e];
+        if (input < first && local_of[input] < 0) {
+            local_of[input] = num_loaded++;
+        }
+    }
+    int n = num_loaded + last - first;
+
+    Tape* local = &segment->tape;
+    local->num_nodes = n;
+    local->lanes = tape->lanes;
+    local->opcodes = malloc(n);
+    local->input_start = malloc((n + 1) * sizeof(int));
+    local->input_indices = malloc((num_edges > 0 ? num_edges : 1) * sizeof(int));
+    local->values = NULL;  // Set once the workspace is sized
+    local->grads = NULL;
+    local->scratch = tape->scratch;
+    local->nodes = malloc(n * sizeof(DifferentiableOperation*));
+    local->num_tangents = 0;
+    local->tangents = NULL;
+    local->grad_tangents = NULL;
+    segment->num_loaded = num_loaded;
+    segment->stored = malloc(n * sizeof(int));
+
+    for (int e = structure->input_start[first]; e < structure->input_start[last]; e++) {
+        int input = structure->input_indices[e];
+        if (input < first && local_of[input] >= 0) {
+            int l = local_of[input];
+            local->opcodes[l] = OP_VARIABLE;
+            local->input_start[l] = 0;
+            local->nodes[l] = structure->nodes[input];
+            segment->stored[l] = store_index[input];
+        }
+    }
+    int edge = 0;
+    for (int i = first; i < last; i++) {
+        int l = num_loaded + i - first;
+        local->opcodes[l] = structure->opcodes[i];
+        local->input_start[l] = edge;
+        local->nodes[l] = structure->nodes[i];
+        segment->stored[l] = store_index[i];
+        for (int e = structure->input_start[i]; e < structure->input_start[i + 1]; e++) {
+            int input = structure->input_indices[e];
+            local->input_indices[edge++] = input < first ? local_of[input] : num_loaded + input - first;
+        }
+    }
+    local->input_start[n] = edge;
+
+    for (int e = structure->input_start[first]; e < structure->input_start[last]; e++) {
+        local_of[structure->input_indices[e]] = -1;
+    }
+}
+
+CheckpointedTape* compile_checkpointed_tape(DifferentiableOperation** roots, int num_roots, int lanes,
+                                            size_t budget_bytes) {
+    Tape* structure = compile_tape(roots, num_roots);
+    if (!structure) {
+        return NULL;
+    }
+    int n = structure->num_nodes;
+
+    int* last_use = malloc(n * sizeof(int));
+    unsigned char* is_root = calloc(n, 1);
+    int* scratch_ints = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) last_use[i] = -1;
+    for (int i = 0; i < n; i++) {
+        for (int e = structure->input_start[i]; e < structure->input_start[i + 1]; e++) {
+            last_use[structure->input_indices[e]] = i;
+        }
+    }
+    for (int r = 0; r < num_roots; r++) {
+        is_root[tape_index_of(structure, roots[r])] = 1;
+    }
+
+    // Longest segments that fit, halving from one segment for the whole tape.
+    // Segments hold at least one slot, even on an empty tape.
+    int length = 1;
+    if (budget_bytes == 0) {
+        while (length * length < n) length++;
+    } else {
+        int longest = n > 1 ? n : 1;
+        int best = longest;
+        size_t best_bytes = (size_t)-1;
+        for (int candidate = longest;; candidate = (candidate + 1) / 2) {
+            size_t bytes = footprint(structure, last_use, is_root, candidate, lanes, scratch_ints);
+            if (bytes <= budget_bytes) {
+                best = candidate;
+                best_bytes = bytes;
+                break;
+            }
+            if (bytes < best_bytes) {
+                best = candidate;
+                best_bytes = bytes;
+            }
+            if (candidate == 1) break;
+        }
+        if (best_bytes > budget_bytes) {
+            fprintf(stderr, "Warning: Checkpointed tape needs %zu bytes, over the budget of %zu.\n", best_bytes,
+                    budget_bytes);
+        }
+        length = best;
+    }
+
+    CheckpointedTape* tape = malloc(sizeof(CheckpointedTape));
+    tape->lanes = lanes;
+    tape->num_segments = (n + length - 1) / length;
+    tape->workspace_segment = -1;
+
+    int* store_index = malloc(n * sizeof(int));
+    tape->num_stored = 0;
+    for (int i = 0; i < n; i++) {
+        store_index[i] = is_stored(structure, last_use, is_root, i, length) ? tape->num_stored++ : -1;
+    }
+    tape->stored_nodes = malloc(tape->num_stored * sizeof(DifferentiableOperation*));
+    for (int i = 0; i < n; i++) {
+        if (store_index[i] >= 0) tape->stored_nodes[store_index[i]] = structure->nodes[i];
+    }
+    tape->stored_values = calloc((size_t)tape->num_stored * lanes, sizeof(double));
+    tape->stored_grads = calloc((size_t)tape->num_stored * lanes, sizeof(double));
+
+    // Segments are built first, the workspace is sized for the largest one
+    tape->max_locals = 0;
+    for (int i = 0; i < n; i++) scratch_ints[i] = -1;
+    tape->scratch = malloc(3 * lanes * sizeof(double));
+    tape->segments = malloc(tape->num_segments * sizeof(Segment));
+    for (int s = 0; s < tape->num_segments; s++) {
+        int first = s * length;
+        int last = first + length < n ? first + length : n;
+        build_segment(tape, &tape->segments[s], structure, store_index, first, last, scratch_ints);
+        if (tape->segments[s].tape.num_nodes > tape->max_locals) {
+            tape->max_locals = tape->segments[s].tape.num_nodes;
+        }
+    }
+    tape->workspace_values = malloc((size_t)tape->max_locals * lanes * sizeof(double));
+    tape->workspace_grads = calloc((size_t)tape->max_locals * lanes, sizeof(double));
+    for (int s = 0; s < tape->num_segments; s++) {
+        tape->segments[s].tape.values = tape->workspace_values;
+        tape->segments[s].tape.grads = tape->workspace_grads;
+    }
+
+    free(store_index);
+    free(last_use);
+    free(is_root);
+    free(scratch_ints);
+    free_tape(structure);
+
+    checkpoint_load_variables(tape);
+    return tape;
+}
+
+static int find_stored(const CheckpointedTape* tape, const DifferentiableOperation* op) {
+    for (int i = 0; i < tape->num_stored; i++) {
+        if (tape->stored_nodes[i] == op) return i;
+    }
+    return -1;
+}
+
+double* checkpoint_values(CheckpointedTape* tape, const DifferentiableOperation* op) {
+    int i = find_stored(tape, op);
+    return i < 0 ? NULL : tape->stored_values + (size_t)i * tape->lanes;
+}
+
+double* checkpoint_grads(CheckpointedTape* tape, const DifferentiableOperation* op) {
+    int i = find_stored(tape, op);
+    return i < 0 ? NULL : tape->stored_grads + (size_t)i * tape->lanes;
+}
+
+void checkpoint_load_variables(CheckpointedTape* tape) {
+    int lanes = tape->lanes;
+    for (int i = 0; i < tape->num_stored; i++) {
+        if (tape->stored_nodes[i]->num_inputs == 0) {
+            double* v = tape->stored_values + (size_t)i * lanes;
+            for (int l = 0; l < lanes; l++) {
+                v[l] = *operation_value(tape->stored_nodes[i]);
+            }
+        }
+    }
+    tape->workspace_segment = -1;
+}
+
+// Runs segment s forward from the stored values, saving the slots later
+// segments need when save is set
+static void compute_segment(CheckpointedTape* tape, int s, int save) {
+    Segment* segment = &tape->segments[s];
+    Tape* local = &segment->tape;
+    int lanes = tape->lanes;
+
+    for (int l = 0; l < local->num_nodes; l++) {
+        if (segment->stored[l] >= 0 && (l < segment->num_loaded || local->opcodes[l] == OP_VARIABLE)) {
+            memcpy(local->values + (size_t)l * lanes, tape->stored_values + (size_t)segment->stored[l] * lanes,
+                   lanes * sizeof(double));
+        }
+    }
+    tape_forward(local);
+    if (save) {
+        for (int l = segment->num_loaded; l < local->num_nodes; l++) {
+            if (segment->stored[l] >= 0 && local->opcodes[l] != OP_VARIABLE) {
+                memcpy(tape->stored_values + (size_t)segment->stored[l] * lanes, local->values + (size_t)l * lanes,
+                       lanes * sizeof(double));
+            }
+        }
+    }
+    tape->workspace_segment = s;
+}
+
+void checkpoint_forward(CheckpointedTape* tape) {
+    for (int s = 0; s < tape->num_segments; s++) {
+        compute_segment(tape, s, 1);
+    }
+}
+
+// Operation grads in the store are consumed as they are handed to their
+// segment; variable grads accumulate in the store
+void checkpoint_backward(CheckpointedTape* tape) {
+    int lanes = tape->lanes;
+    for (int s = tape->num_segments - 1; s >= 0; s--) {
+        Segment* segment = &tape->segments[s];
+        Tape* local = &segment->tape;
+        if (tape->workspace_segment != s) {
+            compute_segment(tape, s, 0);
+        }
+
+        memset(local->grads, 0, (size_t)local->num_nodes * lanes * sizeof(double));
+        for (int l = segment->num_loaded; l < local->num_nodes; l++) {
+            if (segment->stored[l] >= 0 && local->opcodes[l] != OP_VARIABLE) {
+                double* stored = tape->stored_grads + (size_t)segment->stored[l] * lanes;
+                memcpy(local->grads + (size_t)l * lanes, stored, lanes * sizeof(double));
+                memset(stored, 0, lanes * sizeof(double));
+            }
+        }
+        tape_backward(local);
+        for (int l = 0; l < local->num_nodes; l++) {
+            if (segment->stored[l] >= 0 && local->opcodes[l] == OP_VARIABLE) {
+                double* stored = tape->stored_grads + (size_t)segment->stored[l] * lanes;
+                const double* g = local->grads + (size_t)l * lanes;
+                for (int k = 0; k < lanes; k++) {
+                    stored[k] += g[k];
+                }
+            }
+        }
+    }
+}
+
+void checkpoint_zero_grads(CheckpointedTape* tape) {
+    memset(tape->stored_grads, 0, (size_t)tape->num_stored * tape->lanes * sizeof(double));
+}
+
+int checkpoint_segments(const CheckpointedTape* tape) {
+    return tape->num_segments;
+}
+
+size_t checkpoint_memory(const CheckpointedTape* tape) {
+    return (size_t)(tape->num_stored + tape->max_locals) * tape->lanes * 2 * sizeof(double);
+}
+
+void free_checkpointed_tape(CheckpointedTape* tape) {
+    for (int s = 0; s < tape->num_segments; s++) {
+        Tape* local = &tape->segments[s].tape;
+        free(local->opcodes);
+        free(local->input_start);
+        free(local->input_indices);
+        free(local->nodes);
+        free(tape->segments[s].stored);
+    }
+    free(tape->segments);
+    free(tape->stored_nodes);
+    free(tape->stored_values);
+    free(tape->stored_grads);
+    free(tape->workspace_values);
+    free(tape->workspace_grads);
+    free(tape->scratch);
+    free(tape);
+}
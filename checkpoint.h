@@ -0,0 +1,39 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "tape.h"
+
+// A tape that keeps only checkpoints alive between its sweeps. The
+// topological order is cut into segments of consecutive slots. The values
+// that stay stored are variables, roots, and the slots a later segment
+// reads. Everything else lives in a workspace sized for one segment.
+// Backward walks the segments from last to first and recomputes each one
+// from its stored inputs before propagating through it, which costs about
+// one extra forward sweep.
+//
+// The segment length is the longest one for which the stored slots plus
+// the workspace fit in budget_bytes (values and grads, all lanes). A budget
+// of 0 picks segments of about sqrt(num_nodes) slots. If nothing fits,
+// the segmentation with the smallest footprint is used and a warning is
+// printed.
+typedef struct CheckpointedTape CheckpointedTape;
+
+CheckpointedTape* compile_checkpointed_tape(DifferentiableOperation** roots, int num_roots, int lanes,
+                                            size_t budget_bytes);
+
+// Lanes of a stored slot (variables and roots always are); NULL otherwise.
+// Inputs are written through checkpoint_values, seeds through checkpoint_grads.
+double* checkpoint_values(CheckpointedTape* tape, const DifferentiableOperation* op);
+double* checkpoint_grads(CheckpointedTape* tape, const DifferentiableOperation* op);
+
+// Same semantics as their tape_* counterparts
+void checkpoint_load_variables(CheckpointedTape* tape);
+void checkpoint_forward(CheckpointedTape* tape);
+void checkpoint_backward(CheckpointedTape* tape);
+void checkpoint_zero_grads(CheckpointedTape* tape);
+
+int checkpoint_segments(const CheckpointedTape* tape);
+size_t checkpoint_memory(const CheckpointedTape* tape);  // Bytes of values and grads
+void free_checkpointed_tape(CheckpointedTape* tape);
+
+#endif
@@ -0,0 +1,315 @@
+#include "codegen.h"
+#include "tape.h"
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// name becomes part of C function names and of the symbols looked up
+static int is_identifier(const char* name) {
+    if (!(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        return 0;
+    }
+    for (const char* c = name + 1; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return 0;
+    }
+    return 1;
+}
+
+static int check_name(const char* name) {
+    if (!is_identifier(name)) {
+        fprintf(stderr, "Error: \"%s\" is not a valid C identifier.\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+// Hex floats are exact, -0.0 included; non-finite values use math.h
+static void emit_constant(FILE* out, double value) {
+    if (isnan(value)) {
+        fprintf(out, "NAN");
+    } else if (isinf(value)) {
+        fprintf(out, "%sINFINITY", value < 0 ? "-" : "");
+    } else {
+        fprintf(out, "%a /* %.17g */", value, value);
+    }
+}
+
+static int is_input(const Tape* tape, int i) {
+    return tape->opcodes[i] == OP_VARIABLE && !tape->nodes[i]->constant;
+}
+
+// Comma-separated list of the values read by slot i
+static void emit_args(FILE* out, const Tape* tape, int i, int first, int last, const char* separator) {
+    const int* args = tape->input_indices + tape->input_start[i];
+    for (int j = first; j < last; j++) {
+        fprintf(out, "%sv%d", j > first ? separator : "", args[j]);
+    }
+}
+
+static int has_opcode(const Tape* tape, int opcode) {
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->opcodes[i] == opcode) return 1;
+    }
+    return 0;
+}
+
+// Generated code checks labels the way checked_label() does
+static void emit_label_check(FILE* out) {
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+    fprintf(out, "static int class_label(double label, int num_classes) {\n");
+    fprintf(out, "    if (!(label >= 0.0 && label < num_classes)) {\n");
+    fprintf(out, "        fprintf(stderr, \"Error: Label %%g is not a class index in [0, %%d).\\n\", label, "
+                 "num_classes);\n");
+    fprintf(out, "        abort();\n    }\n    return (int)label;\n}\n\n");
+}
+
+static void emit_forward(FILE* out, const Tape* tape, const int* input_of) {
+    for (int i = 0; i < tape->num_nodes; i++) {
+        const int* args = tape->input_indices + tape->input_start[i];
+        int num_args = tape->input_start[i + 1] - tape->input_start[i];
+        switch (tape->opcodes[i]) {
+        case OP_VARIABLE:
+            if (input_of[i] >= 0) {
+                fprintf(out, "    double v%d = inputs[%d];\n", i, input_of[i]);
+            } else {
+                fprintf(out, "    double v%d = ", i);
+                emit_constant(out, *operation_value(tape->nodes[i]));
+                fprintf(out, ";\n");
+            }
+            break;
+        case OP_ADD:
+            fprintf(out, "    double v%d = v%d + v%d;\n", i, args[0], args[1]);
+            break;
+        case OP_MUL:
+            fprintf(out, "    double v%d = v%d * v%d;\n", i, args[0], args[1]);
+            break;
+        case OP_EXP:
+            fprintf(out, "    double v%d = exp(v%d);\n", i, args[0]);
+            break;
+        case OP_SUM:
+            fprintf(out, "    double v%d = ", i);
+            emit_args(out, tape, i, 0, num_args, " + ");
+            fprintf(out, ";\n");
+            break;
+        case OP_SOFTMAX:
+            fprintf(out, "    double v%d = v%d / (", i, args[0]);
+            emit_args(out, tape, i, 0, num_args, " + ");
+            fprintf(out, ");\n");
+            break;
+        case OP_SOFTMAX_CROSS_ENTROPY:
+            fprintf(out, "    double v%d;\n    {\n        const double z[] = { ", i);
+            emit_args(out, tape, i, 0, num_args - 1, ", ");
+            fprintf(out, " };\n        int label = class_label(v%d, %d);\n", args[num_args - 1],
+                    num_args - 1);
+            fprintf(out, "        double max = z[0], sum = 0.0;\n");
+            fprintf(out, "        for (int j = 1; j < %d; j++) max = z[j] > max ? z[j] : max;\n", num_args - 1);
+            fprintf(out, "        for (int j = 0; j < %d; j++) sum += exp(z[j] - max);\n", num_args - 1);
+            fprintf(out, "        v%d = max + log(sum) - z[label];\n    }\n", i);
+            break;
+        }
+    }
+}
+
+static void emit_backward(FILE* out, const Tape* tape) {
+    for (int i = 0; i < tape->num_nodes; i++) {
+        fprintf(out, "    double g%d = %s;\n", i, i == tape->num_nodes - 1 ? "1.0" : "0.0");
+    }
+    for (int i = tape->num_nodes - 1; i >= 0; i--) {
+        const int* args = tape->input_indices + tape->input_start[i];
+        int num_args = tape->input_start[i + 1] - tape->input_start[i];
+        switch (tape->opcodes[i]) {
+        case OP_VARIABLE:
+            break;
+        case OP_ADD:
+            fprintf(out, "    g%d += g%d;\n    g%d += g%d;\n", args[0], i, args[1], i);
+            break;
+        case OP_MUL:
+            fprintf(out, "    g%d += g%d * v%d;\n    g%d += g%d * v%d;\n", args[0], i, args[1], args[1], i, args[0]);
+            break;
+        case OP_EXP:
+            fprintf(out, "    g%d += g%d * v%d;\n", args[0], i, i);
+            break;
+        case OP_SUM:
+            for (int j = 0; j < num_args; j++) {
+                fprintf(out, "    g%d += g%d;\n", args[j], i);
+            }
+            break;
+        case OP_SOFTMAX:
+            fprintf(out, "    {\n        double sum = ");
+            emit_args(out, tape, i, 0, num_args, " + ");
+            fprintf(out, ";\n        g%d += g%d / sum;\n", args[0], i);
+            for (int j = 0; j < num_args; j++) {
+                fprintf(out, "        g%d -= g%d * v%d / sum;\n", args[j], i, i);
+            }
+            fprintf(out, "    }\n");
+            break;
+        case OP_SOFTMAX_CROSS_ENTROPY:
+            fprintf(out, "    {\n        const double z[] = { ");
+            emit_args(out, tape, i, 0, num_args - 1, ", ");
+            fprintf(out, " };\n        double dz[%d];\n        int label = class_label(v%d, %d);\n", num_args - 1,
+                    args[num_args - 1], num_args - 1);
+            fprintf(out, "        double lse = v%d + z[label];\n", i);
+            fprintf(out, "        for (int j = 0; j < %d; j++) dz[j] = g%d * exp(z[j] - lse);\n", num_args - 1, i);
+            fprintf(out, "        dz[label] -= g%d;\n", i);
+            for (int j = 0; j < num_args - 1; j++) {
+                fprintf(out, "        g%d += dz[%d];\n", args[j], j);
+            }
+            fprintf(out, "    }\n");
+            break;
+        }
+    }
+}
+
+GeneratedGraph* generate_c_code(DifferentiableOperation* root, const char* name, const char* path) {
+    if (!check_name(name)) {
+        return NULL;
+    }
+    Tape* tape = compile_tape(&root, 1);
+    if (!tape) {
+        return NULL;
+    }
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", path);
+        free_tape(tape);
+        return NULL;
+    }
+
+    GeneratedGraph* graph = malloc(sizeof(GeneratedGraph));
+    graph->num_inputs = 0;
+    graph->inputs = malloc(tape->num_nodes * sizeof(DifferentiableOperation*));
+    graph->handle = NULL;
+    graph->forward = NULL;
+    graph->gradient = NULL;
+    int* input_of = malloc(tape->num_nodes * sizeof(int));
+    for (int i = 0; i < tape->num_nodes; i++) {
+        input_of[i] = is_input(tape, i) ? graph->num_inputs : -1;
+        if (input_of[i] >= 0) graph->inputs[graph->num_inputs++] = tape->nodes[i];
+    }
+
+    // The root is the last slot of a single-root tape
+    int root_slot = tape->num_nodes - 1;
+    fprintf(out, "// Generated by generate_c_code() from a graph of %d nodes and %d inputs\n", tape->num_nodes,
+            graph->num_inputs);
+    fprintf(out, "#include <math.h>\n");
+    if (has_opcode(tape, OP_SOFTMAX_CROSS_ENTROPY)) {
+        emit_label_check(out);
+    } else {
+        fprintf(out, "\n");
+    }
+    fprintf(out, "double %s_forward(const double* inputs) {\n", name);
+    emit_forward(out, tape, input_of);
+    fprintf(out, "    return v%d;\n}\n\n", root_slot);
+    fprintf(out, "double %s_gradient(const double* inputs, double* grads) {\n", name);
+    emit_forward(out, tape, input_of);
+    emit_backward(out, tape);
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (input_of[i] >= 0) fprintf(out, "    grads[%d] = g%d;\n", input_of[i], i);
+    }
+    fprintf(out, "    return v%d;\n}\n", root_slot);
+
+    fclose(out);
+    free(input_of);
+    free_tape(tape);
+    return graph;
+}
+
+// Runs the compiler without a shell, so no path needs quoting. $CC may
+// carry arguments of its own, separated by whitespace.
+static int compile_library(const char* path, const char* library) {
+    const char* cc = getenv("CC");
+    char* words = strdup(cc ? cc : "");
+    // At most one word per two characters, the default, the flags and NULL
+    char** argv = malloc((strlen(words) / 2 + 10) * sizeof(char*));
+    int argc = 0;
+    for (char* word = strtok(words, " \t\n"); word; word = strtok(NULL, " \t\n")) {
+        argv[argc++] = word;
+    }
+    if (argc == 0) {
+        argv[argc++] = "gcc";
+    }
+    const char* flags[] = { "-O2", "-shared", "-fPIC", "-o", library, path, "-lm" };
+    for (size_t k = 0; k < sizeof(flags) / sizeof(flags[0]); k++) {
+        argv[argc++] = (char*)flags[k];
+    }
+    argv[argc] = NULL;
+
+    int ok = 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Could not run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Error: Could not start the compiler: %s\n", strerror(errno));
+    } else {
+        int status = 0;
+        pid_t waited;
+        while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+        }
+        if (waited < 0) {
+            fprintf(stderr, "Error: Could not wait for the compiler: %s\n", strerror(errno));
+        } else {
+            ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+    }
+    free(argv);
+    free(words);
+    return ok;
+}
+
+int load_generated_code(GeneratedGraph* graph, const char* name, const char* path) {
+    if (!check_name(name)) {
+        return 0;
+    }
+    char* library = malloc(strlen(path) + 4);
+    sprintf(library, "%s.so", path);
+
+    int ok = compile_library(path, library);
+    if (!ok) {
+        fprintf(stderr, "Error: Compiling %s failed.\n", path);
+    } else {
+        // An absolute or ./ path keeps dlopen from searching the library path
+        char* resolved = malloc(strlen(library) + 3);
+        sprintf(resolved, "%s%s", strchr(library, '/') ? "" : "./", library);
+        graph->handle = dlopen(resolved, RTLD_NOW | RTLD_LOCAL);
+        free(resolved);
+        if (!graph->handle) {
+            fprintf(stderr, "Error: %s\n", dlerror());
+            ok = 0;
+        }
+    }
+    if (ok) {
+        char* symbol = malloc(strlen(name) + 16);
+        sprintf(symbol, "%s_forward", name);
+        *(void**)&graph->forward = dlsym(graph->handle, symbol);
+        sprintf(symbol, "%s_gradient", name);
+        *(void**)&graph->gradient = dlsym(graph->handle, symbol);
+        free(symbol);
+        if (!graph->forward || !graph->gradient) {
+            fprintf(stderr, "Error: %s does not define the functions of %s.\n", library, name);
+            ok = 0;
+        }
+    }
+
+    free(library);
+    return ok;
+}
+
+void gather_generated_inputs(const GeneratedGraph* graph, double* inputs) {
+    for (int k = 0; k < graph->num_inputs; k++) {
+        inputs[k] = *operation_value(graph->inputs[k]);
+    }
+}
+
+void free_generated_graph(GeneratedGraph* graph) {
+    if (graph->handle) {
+        dlclose(graph->handle);
+    }
+    free(graph->inputs);
+    free(graph);
+}
@@ -0,0 +1,39 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "differentiable_operation.h"
+
+// Ahead-of-time code generation. generate_c_code() writes a standalone C
+// file with two straight-line functions for the graph rooted at root:
+//
+//   double NAME_forward(const double* inputs);
+//   double NAME_gradient(const double* inputs, double* grads);
+//
+// Both return the root's value; the gradient function also writes d root /
+// d input into grads. inputs[k] and grads[k] belong to graph->inputs[k],
+// the non-constant variables of the graph in tape order. Constants are
+// baked into the source as exact hex literals, or INFINITY and NAN.
+//
+// load_generated_code() compiles that file into a shared library with the
+// system compiler ($CC, or gcc) and loads it, filling in forward and
+// gradient. The compiler runs without a shell: $CC is split at whitespace
+// and path is passed as one argument. name must be a C identifier; both
+// functions reject anything else.
+typedef double (*GeneratedForward)(const double* inputs);
+typedef double (*GeneratedGradient)(const double* inputs, double* grads);
+
+typedef struct {
+    int num_inputs;
+    DifferentiableOperation** inputs;
+    void* handle;  // dlopen handle once loaded
+    GeneratedForward forward;
+    GeneratedGradient gradient;
+} GeneratedGraph;
+
+GeneratedGraph* generate_c_code(DifferentiableOperation* root, const char* name, const char* path);
+int load_generated_code(GeneratedGraph* graph, const char* name, const char* path);
+// Copies the current values of graph->inputs into inputs
+void gather_generated_inputs(const GeneratedGraph* graph, double* inputs);
+void free_generated_graph(GeneratedGraph* graph);
+
+#endif
@@ -0,0 +1,285 @@
+#include "dataset.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t x, uint64_t alignment) {
+    return (x + alignment - 1) / alignment * alignment;
+}
+
+static int write_padding(FILE* out, uint64_t offset) {
+    static const char zeros[DATASET_ALIGNMENT] = { 0 };
+    long position = ftell(out);
+    return position >= 0 && fwrite(zeros, 1, offset - (uint64_t)position, out) == offset - (uint64_t)position;
+}
+
+int write_dataset(const char* path, const double* features, const int* labels, int num_samples, int num_features,
+                  int num_classes) {
+    for (int i = 0; i < num_samples; i++) {
+        if (labels[i] < 0 || labels[i] >= num_classes) {
+            fprintf(stderr, "Error: Label %d of sample %d is not a class index in [0, %d).\n", labels[i], i,
+                    num_classes);
+            return 0;
+        }
+    }
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", path);
+        return 0;
+    }
+
+    // A stride of whole alignment units keeps every column, and the labels
+    // after the last one, aligned
+    DatasetHeader header = { 0 };
+    header.magic = DATASET_MAGIC;
+    header.version = DATASET_VERSION;
+    header.num_samples = num_samples;
+    header.num_features = num_features;
+    header.num_classes = num_classes;
+    header.column_stride = align_up(num_samples, DATASET_ALIGNMENT / sizeof(double));
+    header.features_offset = align_up(sizeof(DatasetHeader), DATASET_ALIGNMENT);
+    header.labels_offset = header.features_offset + header.column_stride * num_features * sizeof(double);
+    header.flags = DATASET_LABELS_CHECKED;
+
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 && write_padding(out, header.features_offset);
+    double* column = calloc(header.column_stride, sizeof(double));
+    for (int j = 0; ok && j < num_features; j++) {
+        for (int i = 0; i < num_samples; i++) {
+            column[i] = features[(size_t)i * num_features + j];
+        }
+        ok = fwrite(column, sizeof(double), header.column_stride, out) == header.column_stride;
+    }
+    int32_t* label_column = malloc((num_samples > 0 ? num_samples : 1) * sizeof(int32_t));
+    for (int i = 0; i < num_samples; i++) {
+        label_column[i] = labels[i];
+    }
+    ok = ok && fwrite(label_column, sizeof(int32_t), num_samples, out) == (size_t)num_samples;
+    free(column);
+    free(label_column);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Writing %s failed.\n", path);
+    }
+    return ok;
+}
+
+// Index of name among the classes seen so far, adding it if new
+static int class_index(char*** names, int* num_names, const char* name) {
+    for (int k = 0; k < *num_names; k++) {
+        if (strcmp((*names)[k], name) == 0) return k;
+    }
+    *names = realloc(*names, (*num_names + 1) * sizeof(char*));
+    (*names)[*num_names] = strdup(name);
+    return (*num_names)++;
+}
+
+int convert_csv_dataset(const char* csv_path, const char* path) {
+    FILE* in = fopen(csv_path, "r");
+    if (!in) {
+        fprintf(stderr, "Error: Could not open %s.\n", csv_path);
+        return 0;
+    }
+
+    int num_samples = 0, capacity = 0, num_features = -1, num_classes = 0, num_names = 0;
+    double* features = NULL;
+    int* labels = NULL;
+    char** names = NULL;
+    char line[4096];
+    int ok = 1;
+    for (int line_number = 1; ok && fgets(line, sizeof(line), in); line_number++) {
+        // A full buffer without a newline is only the start of a line,
+        // unless the file or the line ends right after it
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            int next = getc(in);
+            if (next != EOF && next != '\n' && next != '\r') {
+                fprintf(stderr, "Error: %s:%d is longer than %d characters.\n", csv_path, line_number,
+                        (int)sizeof(line) - 1);
+                ok = 0;
+                break;
+            }
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        char* label = strrchr(line, ',');
+        if (line[strspn(line, " \t")] == '\0') continue;
+        if (!label) {
+            fprintf(stderr, "Error: %s:%d has no label.\n", csv_path, line_number);
+            ok = 0;
+            break;
+        }
+        *label++ = '\0';
+
+        int count = 1;
+        for (const char* c = line; *c; c++) count += *c == ',';
+        if (num_features < 0) num_features = count;
+        if (count != num_features) {
+            fprintf(stderr, "Error: %s:%d has %d features, expected %d.\n", csv_path, line_number, count,
+                    num_features);
+            ok = 0;
+            break;
+        }
+        if (num_samples == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            features = realloc(features, (size_t)capacity * num_features * sizeof(double));
+            labels = realloc(labels, capacity * sizeof(int));
+        }
+
+        char* field = line;
+        for (int j = 0; j < num_features; j++) {
+            char* end;
+            features[(size_t)num_samples * num_features + j] = strtod(field, &end);
+            if (end == field || (*end != ',' && *end != '\0')) {
+                fprintf(stderr, "Error: %s:%d has a non-numeric feature.\n", csv_path, line_number);
+                ok = 0;
+                break;
+            }
+            field = end + 1;
+        }
+        char* end;
+        long value = strtol(label, &end, 10);
+        if (end != label && *end == '\0' && value >= 0 && value < INT_MAX) {
+            labels[num_samples] = (int)value;
+        } else {
+            labels[num_samples] = class_index(&names, &num_names, label);
+        }
+        if (labels[num_samples] >= num_classes) num_classes = labels[num_samples] + 1;
+        num_samples++;
+    }
+    fclose(in);
+
+    if (ok && num_samples == 0) {
+        fprintf(stderr, "Error: %s holds no samples.\n", csv_path);
+        ok = 0;
+    }
+    if (ok) {
+        ok = write_dataset(path, features, labels, num_samples, num_features, num_classes);
+    }
+    for (int k = 0; k < num_names; k++) {
+        free(names[k]);
+    }
+    free(names);
+    free(features);
+    free(labels);
+    return ok;
+}
+
+// Whether rows * cols elements of element_size bytes at offset lie inside
+// the file, checked without any product or sum that could overflow
+static int fits_in_file(uint64_t offset, uint64_t rows, uint64_t cols, uint64_t element_size, uint64_t file_size) {
+    if (offset > file_size) return 0;
+    uint64_t capacity = (file_size - offset) / element_size;
+    return cols == 0 || rows <= capacity / cols;
+}
+
+Dataset* open_dataset(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open %s.\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader)) {
+        fprintf(stderr, "Error: %s is not a dataset.\n", path);
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map %s.\n", path);
+        return NULL;
+    }
+
+    const DatasetHeader* header = map;
+    if (header->magic != DATASET_MAGIC || header->version != DATASET_VERSION) {
+        fprintf(stderr, "Error: %s is not a version %d dataset.\n", path, DATASET_VERSION);
+    } else if (header->num_samples > INT_MAX || header->num_features > INT_MAX || header->num_classes > INT_MAX ||
+               header->column_stride < header->num_samples || header->features_offset % sizeof(double) != 0 ||
+               header->labels_offset % sizeof(int32_t) != 0 ||
+               !fits_in_file(header->features_offset, header->column_stride, header->num_features, sizeof(double),
+                             size) ||
+               !fits_in_file(header->labels_offset, header->num_samples, 1, sizeof(int32_t), size)) {
+        fprintf(stderr, "Error: %s is truncated or corrupt.\n", path);
+    } else if (!(header->flags & DATASET_LABELS_CHECKED)) {
+        fprintf(stderr, "Error: %s was written without checking its labels.\n", path);
+    } else {
+        Dataset* dataset = malloc(sizeof(Dataset));
+        dataset->num_samples = (int)header->num_samples;
+        dataset->num_features = (int)header->num_features;
+        dataset->num_classes = (int)header->num_classes;
+        dataset->column_stride = header->column_stride;
+        dataset->features = (const double*)((const char*)map + header->features_offset);
+        dataset->labels = (const int32_t*)((const char*)map + header->labels_offset);
+        dataset->map = map;
+        dataset->map_size = size;
+        // Shuffled batches gather samples from all over each column, so
+        // readahead around a fault would mostly fetch pages that are not
+        // needed yet; dataset_prefetch() asks for ranges explicitly
+        madvise(map, size, MADV_RANDOM);
+        return dataset;
+    }
+    munmap(map, size);
+    return NULL;
+}
+
+const double* dataset_feature(const Dataset* dataset, int feature) {
+    return dataset->features + (size_t)feature * dataset->column_stride;
+}
+
+DatasetBatch dataset_batch(const Dataset* dataset, int first, int count) {
+    if (count > dataset->num_samples - first) count = dataset->num_samples - first;
+    DatasetBatch batch;
+    batch.first = first;
+    batch.count = count > 0 ? count : 0;
+    batch.column_stride = dataset->column_stride;
+    batch.features = dataset->features + first;
+    batch.labels = dataset->labels + first;
+    return batch;
+}
+
+// Applies advice to the pages under each column of a batch and under its
+// labels. With whole_pages_only, pages shared with neighbouring samples
+// are left out.
+static void advise_batch(const Dataset* dataset, int first, int count, int advice, int whole_pages_only) {
+    DatasetBatch batch = dataset_batch(dataset, first, count);
+    if (batch.count == 0) return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (int j = 0; j <= dataset->num_features; j++) {
+        uintptr_t begin, end;
+        if (j < dataset->num_features) {
+            begin = (uintptr_t)(batch.features + j * batch.column_stride);
+            end = (uintptr_t)(batch.features + j * batch.column_stride + batch.count);
+        } else {
+            begin = (uintptr_t)batch.labels;
+            end = (uintptr_t)(batch.labels + batch.count);
+        }
+        if (whole_pages_only) {
+            begin = (begin + page - 1) & ~(page - 1);
+            end &= ~(page - 1);
+        } else {
+            begin &= ~(page - 1);
+        }
+        if (end > begin) {
+            madvise((void*)begin, end - begin, advice);
+        }
+    }
+}
+
+void dataset_prefetch(const Dataset* dataset, int first, int count) {
+    advise_batch(dataset, first, count, MADV_WILLNEED, 0);
+}
+
+void dataset_evict(const Dataset* dataset, int first, int count) {
+    advise_batch(dataset, first, count, MADV_DONTNEED, 1);
+}
+
+void close_dataset(Dataset* dataset) {
+    munmap(dataset->map, dataset->map_size);
+    free(dataset);
+}
@@ -0,0 +1,83 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary, columnar training sets. A file starts with a DatasetHeader and
+// holds one column of num_samples doubles per feature, then one int32
+// label per sample:
+//
+//   features_offset + (j * column_stride + i) * 8   feature j of sample i
+//   labels_offset + i * 4                           label of sample i
+//
+// Columns start on DATASET_ALIGNMENT boundaries, so the stride may exceed
+// num_samples. Everything is little-endian, as written by the host.
+//
+// open_dataset() maps the file read-only instead of reading it: pages are
+// faulted in as batches touch them, and since they are clean file pages the
+// kernel can drop them again, so a dataset larger than RAM streams through
+// the page cache. Opening reads only the header, so it takes the same time
+// for any size. Labels are checked against num_classes once, when the file
+// is written, which records that in flags; open_dataset() refuses files
+// without DATASET_LABELS_CHECKED, so training never meets a label that is
+// not a class index.
+#define DATASET_MAGIC 0x53444441u  // "ADDS"
+#define DATASET_VERSION 2
+#define DATASET_ALIGNMENT 64
+#define DATASET_LABELS_CHECKED 1u  // Every label is in [0, num_classes)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_samples;
+    uint32_t num_features;
+    uint32_t num_classes;
+    uint64_t column_stride;  // In doubles
+    uint64_t features_offset;  // In bytes from the start of the file
+    uint64_t labels_offset;
+    uint64_t flags;
+} DatasetHeader;
+
+typedef struct {
+    int num_samples;
+    int num_features;
+    int num_classes;
+    size_t column_stride;
+    const double* features;
+    const int32_t* labels;
+    void* map;
+    size_t map_size;
+} Dataset;
+
+// Samples [first, first + count) without copying: feature j of sample
+// first + i is features[j * column_stride + i], its label labels[i]. Views
+// stay valid until the dataset is closed.
+typedef struct {
+    int first;
+    int count;
+    size_t column_stride;
+    const double* features;
+    const int32_t* labels;
+} DatasetBatch;
+
+// features is row-major, num_features values per sample. Fails without
+// writing anything if a label is not in [0, num_classes).
+int write_dataset(const char* path, const double* features, const int* labels, int num_samples, int num_features,
+                  int num_classes);
+// Converts CSV lines of numeric features followed by a label, like
+// iris.data. Labels that are not integers are class names, numbered in
+// order of first appearance.
+int convert_csv_dataset(const char* csv_path, const char* path);
+
+Dataset* open_dataset(const char* path);
+const double* dataset_feature(const Dataset* dataset, int feature);
+// count is clipped to the end of the dataset
+DatasetBatch dataset_batch(const Dataset* dataset, int first, int count);
+// Paging hints for streaming: start reading a range ahead of use, or let
+// the kernel drop a range that has been consumed
+void dataset_prefetch(const Dataset* dataset, int first, int count);
+void dataset_evict(const Dataset* dataset, int first, int count);
+void close_dataset(Dataset* dataset);
+
+#endif
@@ -1,37 +1,111 @@
 #include "differentiable_operation.h"
+#include "arena.h"
+#include "traversal.h"
+
+_Static_assert(sizeof(DifferentiableOperation) <= 32, "DifferentiableOperation should fit twice in a cache line");
+
+// Allocates a node, for n-ary nodes its input array, and for variables
+// their grad, from the bound arena if there is one. Without an arena a
+// variable's grad shares the node's allocation.
+DifferentiableOperation* alloc_operation(OperationType type, int num_inputs) {
+    if (num_inputs > MAX_OPERATION_INPUTS) {
+        fprintf(stderr, "Error: A node cannot have %d inputs; the limit is %d.\n", num_inputs, MAX_OPERATION_INPUTS);
+        return NULL;
+    }
+    GraphArena* arena = bound_graph_arena();
+    DifferentiableOperation* op;
+    double* grad = NULL;
+    DifferentiableOperation** inputs = NULL;
+    size_t inputs_size = num_inputs * sizeof(DifferentiableOperation*);
+    if (arena) {
+        // What was taken from the arena before a failure goes back with it
+        op = arena_alloc(arena, sizeof(DifferentiableOperation));
+        if (op && type == OP_VARIABLE) grad = arena_alloc_data(arena, sizeof(double));
+        if (op && num_inputs > MAX_INLINE_INPUTS) inputs = arena_alloc(arena, inputs_size);
+    } else {
+        op = malloc(sizeof(DifferentiableOperation) + (type == OP_VARIABLE ? sizeof(double) : 0));
+        if (op && type == OP_VARIABLE) grad = (double*)(op + 1);
+        if (op && num_inputs > MAX_INLINE_INPUTS) inputs = malloc(inputs_size);
+    }
+    if (!op || (type == OP_VARIABLE && !grad) || (num_inputs > MAX_INLINE_INPUTS && !inputs)) {
+        fprintf(stderr, "Error: Out of memory allocating a node with %d inputs.\n", num_inputs);
+        if (!arena) free(op);
+        return NULL;
+    }
+    op->value = 0.0;
+    op->operands[0] = NULL;
+    op->operands[1] = NULL;
+    if (type == OP_VARIABLE) {
+        op->value_slot = &op->value;
+        op->grad_slot = grad;
+        *grad = 0.0;
+    } else if (num_inputs > MAX_INLINE_INPUTS) {
+        op->inputs = inputs;
+    }
+    op->num_inputs = num_inputs;
+    op->type = type;
+    op->visit_state = UNVISITED;
+    op->generation = 0;
+    op->from_arena = arena != NULL;
+    op->constant = 0;
+    op->parameter = 0;
+    op->on_stack = 0;
+    return op;
+}
 
 DifferentiableOperation* create_variable(double value) {
-    DifferentiableOperation* var = malloc(sizeof(DifferentiableOperation));
+    DifferentiableOperation* var = alloc_operation(OP_VARIABLE, 0);
+    if (!var) {
+        return NULL;
+    }
     var->value = value;
-    var->grad = 0.0;
-    var->inputs = NULL;
-    var->num_inputs = 0;
-    var->compute = NULL;
-    var->backward = NULL;
-    var->visit_state = UNVISITED;
     return var;
 }
 
-void free_operation(DifferentiableOperation* op) {
-    if (op->visit_state == UNVISITED) {
-        return;
+DifferentiableOperation* create_constant(double value) {
+    DifferentiableOperation* var = create_variable(value);
+    if (!var) {
+        return NULL;
     }
-    op->visit_state = UNVISITED;
-    for (int i = 0; i < op->num_inputs; ++i) {
-        free_operation(op->inputs[i]);
+    var->constant = 1;
+    return var;
+}
+
+void release_operation(DifferentiableOperation* op) {
+    if (op->from_arena) {
+        return;  // Released with its arena
     }
-    if (op->inputs) {
+    if (op->num_inputs > MAX_INLINE_INPUTS) {
         free(op->inputs);
     }
     free(op);
 }
 
-void reset_visit_state(DifferentiableOperation* op) {
-    if (op->visit_state == UNVISITED) {
-        return;
+// Frees op and everything reachable from it. Nodes are gathered first so
+// that no freed node is inspected again through another consumer. Tensor
+// nodes own buffers this cannot free, so graphs holding any are refused.
+void free_operation(DifferentiableOperation* op) {
+    NodeList list;
+    init_node_list(&list);
+    traverse_graph(thread_traversal_stack(), &op, 1, next_traversal_generation(), append_node, &list);
+    for (int i = 0; i < list.num_nodes; ++i) {
+        if (list.nodes[i]->type == OP_TENSOR) {
+            fprintf(stderr, "Error: Tensor nodes are freed by free_tensor_operation(), not free_operation().\n");
+            free_node_list(&list);
+            return;
+        }
     }
-    op->visit_state = UNVISITED;
-    for (int i = 0; i < op->num_inputs; ++i) {
-        reset_visit_state(op->inputs[i]);
+    for (int i = 0; i < list.num_nodes; ++i) {
+        release_operation(list.nodes[i]);
     }
-}
\ No newline at end of file
+    free_node_list(&list);
+}
+
+static void unmark_node(DifferentiableOperation* op, void* data) {
+    (void)data;
+    op->visit_state = UNVISITED;
+}
+
+void reset_visit_state(DifferentiableOperation* op) {
+    traverse_graph(thread_traversal_stack(), &op, 1, next_traversal_generation(), unmark_node, NULL);
+}
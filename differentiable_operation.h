@@ -5,21 +5,63 @@
 #include <stdlib.h>
 #include <math.h>
 
+#define MAX_INLINE_INPUTS 2
+#define MAX_OPERATION_INPUTS 65535  // Largest num_inputs a node can hold
+
 typedef struct DifferentiableOperation DifferentiableOperation;
 typedef enum { UNVISITED, VISITING, VISITED } VisitState;
+typedef enum { OP_VARIABLE, OP_ADD, OP_MUL, OP_EXP, OP_SOFTMAX, OP_SOFTMAX_CROSS_ENTROPY, OP_SUM, OP_TENSOR } OperationType;
 
+// 32 bytes, so a cache line holds two nodes. Nodes with up to
+// MAX_INLINE_INPUTS inputs keep them in operands[]; only wider (n-ary)
+// nodes point to an out-of-line array. An operation keeps its value
+// inline, so reading an operation operand costs the load of the operand
+// pointer and one load from the operand's node. Its grad is not stored in the node at
+// all: sweeps keep grads in arrays of their own (a Tape's grads, or the
+// grads of a GraphContext). Variables have no operands, so they keep
+// pointers to their value and grad instead, which lets a
+// ParameterRegistry own both; a variable outside a registry points at its
+// inline value and a grad allocated with the node.
 struct DifferentiableOperation {
-    void (*compute)(DifferentiableOperation*);
-    void (*backward)(DifferentiableOperation*, double grad);
-    double value;
-    double grad;
-    DifferentiableOperation** inputs;
-    int num_inputs;
-    VisitState visit_state;
+    double value;  // Read through operation_value()
+    union {
+        DifferentiableOperation* operands[MAX_INLINE_INPUTS];
+        DifferentiableOperation** inputs;
+        struct {  // Variables only
+            double* value_slot;
+            double* grad_slot;
+        };
+    };
+    unsigned int generation;  // Last forward pass that evaluated this node
+    unsigned short num_inputs;
+    unsigned char type;  // OperationType
+    unsigned char visit_state : 2;  // VisitState
+    unsigned char from_arena : 1;  // Storage is owned by a GraphArena
+    unsigned char constant : 1;  // A variable that needs no gradient and may be folded
+    unsigned char parameter : 1;  // A variable registered with a ParameterRegistry
+    unsigned char on_stack : 1;  // On the stack of a generation-stamped traversal
 };
 
+static inline DifferentiableOperation** operation_inputs(DifferentiableOperation* op) {
+    return op->num_inputs <= MAX_INLINE_INPUTS ? op->operands : op->inputs;
+}
+
+static inline double* operation_value(DifferentiableOperation* op) {
+    return op->type == OP_VARIABLE ? op->value_slot : &op->value;
+}
+
+// Variables only; operation grads live with the sweep that computes them
+static inline double* variable_grad(DifferentiableOperation* op) {
+    return op->grad_slot;
+}
+
+// NULL if num_inputs is over MAX_OPERATION_INPUTS
+DifferentiableOperation* alloc_operation(OperationType type, int num_inputs);
 DifferentiableOperation* create_variable(double value);
+DifferentiableOperation* create_constant(double value);
 void free_operation(DifferentiableOperation* op);
+// Frees op alone, leaving its inputs; arena nodes are left to their arena
+void release_operation(DifferentiableOperation* op);
 void reset_visit_state(DifferentiableOperation* op);
 
-#endif
\ No newline at end of file
+#endif
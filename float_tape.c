@@ -0,0 +1,152 @@
+#include "float_tape.h"
+#include "kernels.h"
+#include "operations.h"
+#include "profiler.h"
+#include <math.h>
+#include <string.h>
+
+#define TAPE_REAL float
+#define TAPE_KERNEL_TABLE FloatKernelTable
+#define TAPE_KERNELS float_kernels()
+#define TAPE_LOG logf
+#define TAPE_FORWARD_RULE forward_rule
+#define TAPE_BACKWARD_RULE backward_rule
+#include "tape_rules.h"
+
+FloatTape* compile_float_tape(DifferentiableOperation** roots, int num_roots, int lanes, TapePrecision precision) {
+    Tape* layout = compile_batched_tape(roots, num_roots, 1);
+    if (!layout) {
+        return NULL;
+    }
+    int n = layout->num_nodes;
+    FloatTape* tape = malloc(sizeof(FloatTape));
+    tape->layout = layout;
+    tape->num_nodes = n;
+    tape->lanes = lanes;
+    tape->precision = precision;
+    tape->values = malloc((size_t)n * lanes * sizeof(float));
+    tape->grads = calloc((size_t)n * lanes, sizeof(float));
+    tape->scratch = malloc(3 * lanes * sizeof(float));
+    tape->accumulated = precision == PRECISION_MIXED ? calloc(n, sizeof(double)) : NULL;
+    for (int i = 0; i < n; i++) {
+        for (int l = 0; l < lanes; l++) {
+            tape->values[(size_t)i * lanes + l] = (float)*operation_value(layout->nodes[i]);
+        }
+    }
+    return tape;
+}
+
+void float_tape_load_variables(FloatTape* tape) {
+    int lanes = tape->lanes;
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->layout->opcodes[i] == OP_VARIABLE) {
+            float* v = tape->values + (size_t)i * lanes;
+            float value = (float)*operation_value(tape->layout->nodes[i]);
+            for (int l = 0; l < lanes; l++) {
+                v[l] = value;
+            }
+        }
+    }
+}
+
+// As tape_store_results, except that mixed mode leaves the master copies
+// of the variables alone and hands out the double accumulators
+void float_tape_store_results(FloatTape* tape) {
+    int lanes = tape->lanes;
+    for (int i = 0; i < tape->num_nodes; i++) {
+        DifferentiableOperation* node = tape->layout->nodes[i];
+        const float* g = tape->grads + (size_t)i * lanes;
+        if (tape->layout->opcodes[i] != OP_VARIABLE) {
+            node->value = tape->values[(size_t)i * lanes];
+        } else if (tape->precision == PRECISION_MIXED) {
+            *variable_grad(node) = tape->accumulated[i];
+        } else {
+            *operation_value(node) = tape->values[(size_t)i * lanes];
+            float sum = 0.0f;
+            for (int l = 0; l < lanes; l++) {
+                sum += g[l];
+            }
+            *variable_grad(node) = sum;
+        }
+    }
+}
+
+// The profiled sweeps time every node, as those of the double tape do
+static void profiled_forward(FloatTape* tape) {
+    ProfilePass pass;
+    begin_profile_pass(&pass);
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->layout->opcodes[i] == OP_VARIABLE) continue;
+        long long start = profile_clock_ns();
+        forward_rule(tape->layout, i, tape->values, tape->lanes, tape->scratch);
+        profile_node(&pass, tape->layout->opcodes[i], start);
+    }
+    end_profile_pass(&pass, 0, "float_tape_forward");
+}
+
+void float_tape_forward(FloatTape* tape) {
+    if (profiling_enabled()) {
+        profiled_forward(tape);
+        return;
+    }
+    for (int i = 0; i < tape->num_nodes; i++) {
+        forward_rule(tape->layout, i, tape->values, tape->lanes, tape->scratch);
+    }
+}
+
+void float_tape_zero_grads(FloatTape* tape) {
+    memset(tape->grads, 0, (size_t)tape->num_nodes * tape->lanes * sizeof(float));
+    if (tape->accumulated) {
+        memset(tape->accumulated, 0, tape->num_nodes * sizeof(double));
+    }
+}
+
+static int all_zero(const float* x, int n) {
+    for (int l = 0; l < n; l++) {
+        if (x[l] != 0.0f) return 0;
+    }
+    return 1;
+}
+
+// Same consume semantics as tape_backward. In mixed mode the variable
+// lanes are folded into the double accumulators and cleared, so float
+// grads never build up across sweeps.
+void float_tape_backward(FloatTape* tape) {
+    int lanes = tape->lanes;
+    const int* input_start = tape->layout->input_start;
+    int profiled = profiling_enabled();
+    ProfilePass pass;
+    if (profiled) begin_profile_pass(&pass);
+    for (int i = tape->num_nodes - 1; i >= 0; i--) {
+        float* g = tape->grads + (size_t)i * lanes;
+        if (tape->layout->opcodes[i] == OP_VARIABLE) {
+            if (tape->precision == PRECISION_MIXED) {
+                double sum = 0.0;
+                for (int l = 0; l < lanes; l++) {
+                    sum += g[l];
+                }
+                tape->accumulated[i] += sum;
+                memset(g, 0, lanes * sizeof(float));
+            }
+            continue;
+        }
+        if (all_zero(g, lanes)) {
+            continue;
+        }
+        long long start = profiled ? profile_clock_ns() : 0;
+        backward_rule(tape->layout, i, tape->values, g, tape->grads, tape->layout->input_indices + input_start[i],
+                      lanes, tape->scratch);
+        memset(g, 0, lanes * sizeof(float));
+        if (profiled) profile_node(&pass, tape->layout->opcodes[i], start);
+    }
+    if (profiled) end_profile_pass(&pass, 1, "float_tape_backward");
+}
+
+void free_float_tape(FloatTape* tape) {
+    free_tape(tape->layout);
+    free(tape->values);
+    free(tape->grads);
+    free(tape->scratch);
+    free(tape->accumulated);
+    free(tape);
+}
@@ -0,0 +1,43 @@
+#ifndef FLOAT_TAPE_H
+#define FLOAT_TAPE_H
+
+#include "tape.h"
+
+// Single-precision execution of a compiled graph. The slots, opcodes and
+// inputs are those of a Tape (kept in layout); values and grads are float
+// lanes swept with float_kernels(), which halves the memory traffic and
+// doubles the SIMD width of the double tape.
+//
+// PRECISION_FLOAT32 keeps everything in float: variable grads accumulate
+// in their float lanes, and tape_store_results writes the rounded values
+// back, so parameters are held at float precision.
+//
+// PRECISION_MIXED keeps float activations but treats the nodes' double
+// values as master copies: they are only read (rounded) when loading, and
+// never overwritten. After each backward sweep the variable grads are
+// reduced over the lanes in double and accumulated in double.
+typedef enum {
+    PRECISION_FLOAT32,
+    PRECISION_MIXED
+} TapePrecision;
+
+typedef struct {
+    Tape* layout;  // One double lane; only its structure and nodes are used
+    int num_nodes;
+    int lanes;
+    TapePrecision precision;
+    float* values;
+    float* grads;
+    float* scratch;  // Three values per lane
+    double* accumulated;  // Mixed mode: reduced variable grads per slot
+} FloatTape;
+
+FloatTape* compile_float_tape(DifferentiableOperation** roots, int num_roots, int lanes, TapePrecision precision);
+void float_tape_load_variables(FloatTape* tape);
+void float_tape_store_results(FloatTape* tape);
+void float_tape_forward(FloatTape* tape);
+void float_tape_zero_grads(FloatTape* tape);
+void float_tape_backward(FloatTape* tape);
+void free_float_tape(FloatTape* tape);
+
+#endif
@@ -0,0 +1,127 @@
+#include "forward_mode.h"
+#include "kernels.h"
+#include "operations.h"
+#include <string.h>
+
+void tape_enable_tangents(Tape* tape, int num_tangents) {
+    free(tape->tangents);
+    free(tape->grad_tangents);
+    tape->num_tangents = num_tangents;
+    tape->tangents = calloc((size_t)tape->num_nodes * num_tangents * tape->lanes, sizeof(double));
+    tape->grad_tangents = NULL;
+}
+
+void tape_zero_tangents(Tape* tape) {
+    size_t size = (size_t)tape->num_nodes * tape->num_tangents * tape->lanes * sizeof(double);
+    memset(tape->tangents, 0, size);
+    if (tape->grad_tangents) {
+        memset(tape->grad_tangents, 0, size);
+    }
+}
+
+void tape_seed_tangent(Tape* tape, int slot, int t, double value) {
+    double* dv = tape->tangents + ((size_t)slot * tape->num_tangents + t) * tape->lanes;
+    for (int l = 0; l < tape->lanes; l++) {
+        dv[l] = value;
+    }
+}
+
+// Tangents of slot i from the tangents of its inputs; the value of slot i
+// is already computed
+static void tangent_node(Tape* tape, int i) {
+    const KernelTable* k = kernels();
+    const int* start = tape->input_start;
+    const int* args = tape->input_indices + start[i];
+    const double* values = tape->values;
+    int lanes = tape->lanes;
+    int num_tangents = tape->num_tangents;
+    size_t block = (size_t)num_tangents * lanes;  // All tangents of one slot
+    const double* v = values + (size_t)i * lanes;
+    double* dv = tape->tangents + i * block;
+
+    switch (tape->opcodes[i]) {
+    case OP_VARIABLE:
+        break;
+    case OP_ADD:
+        k->add(dv, tape->tangents + args[0] * block, tape->tangents + args[1] * block, (int)block);
+        break;
+    case OP_MUL: {
+        const double* a = values + (size_t)args[0] * lanes;
+        const double* b = values + (size_t)args[1] * lanes;
+        for (int t = 0; t < num_tangents; t++) {
+            double* out = dv + (size_t)t * lanes;
+            k->mul(out, tape->tangents + args[0] * block + (size_t)t * lanes, b, lanes);
+            k->fma_acc(out, a, tape->tangents + args[1] * block + (size_t)t * lanes, lanes);
+        }
+        break;
+    }
+    case OP_EXP:
+        for (int t = 0; t < num_tangents; t++) {
+            k->mul(dv + (size_t)t * lanes, v, tape->tangents + args[0] * block + (size_t)t * lanes, lanes);
+        }
+        break;
+    case OP_SOFTMAX: {
+        // d(x0 / sum) = (dx0 - s * dsum) / sum
+        int num_args = start[i + 1] - start[i];
+        double* sum = tape->scratch;
+        double* dsum = tape->scratch + lanes;
+        memset(sum, 0, lanes * sizeof(double));
+        for (int j = 0; j < num_args; j++) {
+            k->add(sum, sum, values + (size_t)args[j] * lanes, lanes);
+        }
+        for (int t = 0; t < num_tangents; t++) {
+            double* out = dv + (size_t)t * lanes;
+            memset(dsum, 0, lanes * sizeof(double));
+            for (int j = 0; j < num_args; j++) {
+                k->add(dsum, dsum, tape->tangents + args[j] * block + (size_t)t * lanes, lanes);
+            }
+            memcpy(out, tape->tangents + args[0] * block + (size_t)t * lanes, lanes * sizeof(double));
+            k->fnma_acc(out, v, dsum, lanes);
+            k->div(out, out, sum, lanes);
+        }
+        break;
+    }
+    case OP_SUM: {
+        int num_args = start[i + 1] - start[i];
+        memcpy(dv, tape->tangents + args[0] * block, block * sizeof(double));
+        for (int j = 1; j < num_args; j++) {
+            k->add(dv, dv, tape->tangents + args[j] * block, (int)block);
+        }
+        break;
+    }
+    case OP_SOFTMAX_CROSS_ENTROPY: {
+        // d loss = sum_j p_j dz_j - dz[label], with lse = loss + z[label]
+        int num_classes = start[i + 1] - start[i] - 1;
+        const double* label = values + (size_t)args[num_classes] * lanes;
+        double* lse = tape->scratch;
+        double* p = tape->scratch + lanes;
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            lse[l] = v[l] + values[(size_t)target * lanes + l];
+        }
+        memset(dv, 0, block * sizeof(double));
+        for (int j = 0; j < num_classes; j++) {
+            const double* z = values + (size_t)args[j] * lanes;
+            for (int l = 0; l < lanes; l++) p[l] = z[l] - lse[l];
+            k->exp(p, p, lanes);
+            for (int t = 0; t < num_tangents; t++) {
+                k->fma_acc(dv + (size_t)t * lanes, p, tape->tangents + args[j] * block + (size_t)t * lanes, lanes);
+            }
+        }
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            for (int t = 0; t < num_tangents; t++) {
+                dv[(size_t)t * lanes + l] -= tape->tangents[target * block + (size_t)t * lanes + l];
+            }
+        }
+        break;
+    }
+    }
+}
+
+void tape_forward_tangents(Tape* tape) {
+    for (int i = 0; i < tape->num_nodes; i++) {
+        tape_forward_node(tape, i, tape->scratch);
+        tangent_node(tape, i);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FORWARD_MODE_H
+#define FORWARD_MODE_H
+
+#include "tape.h"
+
+// Forward-mode differentiation on a tape. Every slot carries num_tangents
+// directional derivatives per lane next to its value, laid out as
+// tangents[(i * num_tangents + t) * lanes + l]. Seeding the tangents of
+// the variables with unit vectors and running one tangent sweep yields
+// num_tangents columns of the Jacobian at once, which beats one reverse
+// sweep per output when a graph has few inputs and many outputs.
+//
+// The label input of a softmax cross-entropy node is treated as a
+// constant: its tangent is ignored.
+
+// Allocates (or resizes) the tangent storage and clears it
+void tape_enable_tangents(Tape* tape, int num_tangents);
+// Clears the tangents of every slot, including the variable seeds, and the
+// grad tangents of a forward-over-reverse sweep
+void tape_zero_tangents(Tape* tape);
+// Sets tangent t of slot on every lane
+void tape_seed_tangent(Tape* tape, int slot, int t, double value);
+// Computes values and the tangents of every operation slot in one sweep
+void tape_forward_tangents(Tape* tape);
+
+#endif
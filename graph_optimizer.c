@@ -0,0 +1,276 @@
+#include "graph_optimizer.h"
+#include "operations.h"
+#include "graph_utils.h"
+#include "traversal.h"
+#include <stdint.h>
+#include <string.h>
+
+// Open-addressing table from the original nodes to their position in the
+// post-order, and from node contents to the first node seen with them
+typedef struct {
+    DifferentiableOperation** keys;
+    int* positions;
+    size_t mask;
+} NodeTable;
+
+static size_t hash_pointer(const void* p) {
+    return (size_t)(((uintptr_t)p >> 4) * (uintptr_t)0x9E3779B97F4A7C15ull);
+}
+
+static void init_node_table(NodeTable* table, int capacity) {
+    size_t size = 16;
+    while (size < 2 * (size_t)capacity) size *= 2;
+    table->keys = calloc(size, sizeof(DifferentiableOperation*));
+    table->positions = malloc(size * sizeof(int));
+    table->mask = size - 1;
+}
+
+static void free_node_table(NodeTable* table) {
+    free(table->keys);
+    free(table->positions);
+}
+
+static int position_of(const NodeTable* table, const DifferentiableOperation* op) {
+    size_t h = hash_pointer(op) & table->mask;
+    while (table->keys[h] && table->keys[h] != op) h = (h + 1) & table->mask;
+    return table->keys[h] ? table->positions[h] : -1;
+}
+
+static int is_constant(const DifferentiableOperation* op) {
+    return op->num_inputs == 0 && op->constant;
+}
+
+static int is_sum(const DifferentiableOperation* op) {
+    return op->type == OP_ADD || op->type == OP_SUM;
+}
+
+static int is_commutative(const DifferentiableOperation* op) {
+    return op->type == OP_ADD || op->type == OP_MUL || op->type == OP_SUM;
+}
+
+static size_t content_hash(DifferentiableOperation* op) {
+    size_t h = (size_t)((op->type + 1) * 0x9E3779B97F4A7C15ull);
+    if (op->num_inputs == 0) {
+        uint64_t bits;
+        memcpy(&bits, operation_value(op), sizeof(bits));
+        return h ^ (size_t)(bits * 0x9E3779B97F4A7C15ull);
+    }
+    DifferentiableOperation** inputs = operation_inputs(op);
+    for (int i = 0; i < op->num_inputs; i++) {
+        h = (h ^ hash_pointer(inputs[i])) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+static int same_content(DifferentiableOperation* a, DifferentiableOperation* b) {
+    if (a->type != b->type || a->num_inputs != b->num_inputs) return 0;
+    if (a->num_inputs == 0) {
+        return memcmp(operation_value(a), operation_value(b), sizeof(double)) == 0;
+    }
+    return memcmp(operation_inputs(a), operation_inputs(b), a->num_inputs * sizeof(DifferentiableOperation*)) == 0;
+}
+
+// Returns the node already in the table with op's contents, or inserts op
+static DifferentiableOperation* intern(NodeTable* table, DifferentiableOperation* op) {
+    size_t h = content_hash(op) & table->mask;
+    while (table->keys[h]) {
+        if (same_content(table->keys[h], op)) return table->keys[h];
+        h = (h + 1) & table->mask;
+    }
+    table->keys[h] = op;
+    return op;
+}
+
+static int compare_pointers(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(DifferentiableOperation* const*)a;
+    uintptr_t y = (uintptr_t)*(DifferentiableOperation* const*)b;
+    return (x > y) - (x < y);
+}
+
+// Leaf terms of the chain of absorbed adds and sums below top, left to
+// right. Absorbed nodes have a single consumer, so every chain is walked
+// once, from its top. Returns the number of absorbed nodes passed.
+static int collect_terms(DifferentiableOperation* top, const NodeTable* positions, const unsigned char* absorbed,
+                         DifferentiableOperation** replacement, NodeList* pending, NodeList* terms) {
+    int num_absorbed = 0;
+    pending->num_nodes = 0;
+    terms->num_nodes = 0;
+    DifferentiableOperation** inputs = operation_inputs(top);
+    for (int k = top->num_inputs - 1; k >= 0; k--) append_node(inputs[k], pending);
+    while (pending->num_nodes > 0) {
+        DifferentiableOperation* op = pending->nodes[--pending->num_nodes];
+        int j = position_of(positions, op);
+        if (!absorbed[j]) {
+            append_node(replacement[j], terms);
+            continue;
+        }
+        num_absorbed++;
+        inputs = operation_inputs(op);
+        for (int k = op->num_inputs - 1; k >= 0; k--) append_node(inputs[k], pending);
+    }
+    return num_absorbed;
+}
+
+// Sum of all terms. Over MAX_OPERATION_INPUTS terms, groups of terms are
+// summed first, so no node outgrows num_inputs. Consumes terms.
+static DifferentiableOperation* create_fused_sum(NodeList* terms, NodeList* created) {
+    while (terms->num_nodes > MAX_OPERATION_INPUTS) {
+        int num_groups = 0;
+        for (int first = 0; first < terms->num_nodes; first += MAX_OPERATION_INPUTS) {
+            int count = terms->num_nodes - first < MAX_OPERATION_INPUTS ? terms->num_nodes - first
+                                                                        : MAX_OPERATION_INPUTS;
+            DifferentiableOperation* group = terms->nodes[first];
+            if (count > 1) {
+                group = create_sum_operation(terms->nodes + first, count);
+                append_node(group, created);
+            }
+            terms->nodes[num_groups++] = group;
+        }
+        terms->num_nodes = num_groups;
+    }
+    DifferentiableOperation* sum = create_sum_operation(terms->nodes, terms->num_nodes);
+    append_node(sum, created);
+    return sum;
+}
+
+static void count_node(DifferentiableOperation* op, void* data) {
+    (void)op;
+    (*(int*)data)++;
+}
+
+int optimize_graph(DifferentiableOperation** roots, int num_roots, GraphOptimizationReport* report) {
+    GraphOptimizationReport stats = { 0 };
+    TraversalStack* stack = thread_traversal_stack();
+
+    NodeList order;
+    init_node_list(&order);
+    if (!traverse_graph(stack, roots, num_roots, next_traversal_generation(), append_node, &order)) {
+        free_node_list(&order);
+        return 0;
+    }
+    int n = order.num_nodes;
+    stats.nodes_before = n;
+
+    NodeTable positions;
+    init_node_table(&positions, n);
+    for (int i = 0; i < n; i++) {
+        size_t h = hash_pointer(order.nodes[i]) & positions.mask;
+        while (positions.keys[h]) h = (h + 1) & positions.mask;
+        positions.keys[h] = order.nodes[i];
+        positions.positions[h] = i;
+    }
+
+    // An add or sum that is not a root and whose only consumer is another
+    // add or sum is absorbed into the sum that replaces the top of its chain
+    int* fanout = calloc(n, sizeof(int));
+    unsigned char* is_root = calloc(n, 1);
+    unsigned char* absorbed = calloc(n, 1);
+    DifferentiableOperation** replacement = malloc(n * sizeof(DifferentiableOperation*));
+    for (int i = 0; i < n; i++) {
+        DifferentiableOperation** inputs = operation_inputs(order.nodes[i]);
+        for (int k = 0; k < order.nodes[i]->num_inputs; k++) {
+            fanout[position_of(&positions, inputs[k])]++;
+        }
+    }
+    for (int r = 0; r < num_roots; r++) {
+        is_root[position_of(&positions, roots[r])] = 1;
+    }
+    for (int i = 0; i < n; i++) {
+        DifferentiableOperation* op = order.nodes[i];
+        DifferentiableOperation** inputs = operation_inputs(op);
+        for (int k = 0; k < op->num_inputs && is_sum(op); k++) {
+            int j = position_of(&positions, inputs[k]);
+            absorbed[j] |= is_sum(inputs[k]) && fanout[j] == 1 && !is_root[j];
+        }
+    }
+
+    NodeTable contents;
+    init_node_table(&contents, 2 * n);
+    NodeList created, pending, terms;
+    init_node_list(&created);
+    init_node_list(&pending);
+    init_node_list(&terms);
+
+    // Inputs come first in the post-order, so each node sees the final
+    // replacements of its inputs
+    for (int i = 0; i < n; i++) {
+        DifferentiableOperation* op = order.nodes[i];
+        DifferentiableOperation** inputs = operation_inputs(op);
+        if (op->num_inputs == 0) {
+            replacement[i] = is_constant(op) ? intern(&contents, op) : op;
+            if (replacement[i] != op) stats.merged++;
+            continue;
+        }
+        if (absorbed[i]) {
+            replacement[i] = NULL;  // Only its chain's top reads it
+            continue;
+        }
+
+        int num_absorbed = 0;
+        if (is_sum(op)) {
+            num_absorbed = collect_terms(op, &positions, absorbed, replacement, &pending, &terms);
+        } else {
+            terms.num_nodes = 0;
+            for (int k = 0; k < op->num_inputs; k++) {
+                append_node(replacement[position_of(&positions, inputs[k])], &terms);
+            }
+        }
+        int all_constant = 1;
+        for (int k = 0; k < terms.num_nodes; k++) {
+            all_constant &= is_constant(terms.nodes[k]);
+        }
+
+        DifferentiableOperation* candidate = op;
+        if (num_absorbed > 0) {
+            candidate = create_fused_sum(&terms, &created);
+            stats.fused += num_absorbed;
+        } else {
+            memcpy(inputs, terms.nodes, op->num_inputs * sizeof(DifferentiableOperation*));
+        }
+        if (all_constant) {
+            forward(candidate);
+            candidate = create_constant(candidate->value);
+            append_node(candidate, &created);
+            stats.folded++;
+        }
+
+        if (is_commutative(candidate)) {
+            qsort(operation_inputs(candidate), candidate->num_inputs, sizeof(DifferentiableOperation*), compare_pointers);
+        }
+        replacement[i] = intern(&contents, candidate);
+        if (replacement[i] != candidate) stats.merged++;
+    }
+
+    for (int r = 0; r < num_roots; r++) {
+        roots[r] = replacement[position_of(&positions, roots[r])];
+    }
+
+    // Anything the new roots do not reach is dead
+    unsigned int generation = next_traversal_generation();
+    traverse_graph(stack, roots, num_roots, generation, count_node, &stats.nodes_after);
+    for (int i = 0; i < n; i++) {
+        if (order.nodes[i]->generation != generation && !order.nodes[i]->from_arena) {
+            release_operation(order.nodes[i]);
+            stats.freed++;
+        }
+    }
+    for (int i = 0; i < created.num_nodes; i++) {
+        if (created.nodes[i]->generation != generation && !created.nodes[i]->from_arena) {
+            release_operation(created.nodes[i]);
+            stats.freed++;
+        }
+    }
+
+    free_node_list(&terms);
+    free_node_list(&pending);
+    free_node_list(&created);
+    free_node_table(&contents);
+    free_node_table(&positions);
+    free(fanout);
+    free(is_root);
+    free(absorbed);
+    free(replacement);
+    free_node_list(&order);
+    if (report) *report = stats;
+    return 1;
+}
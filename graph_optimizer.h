@@ -0,0 +1,36 @@
+#ifndef GRAPH_OPTIMIZER_H
+#define GRAPH_OPTIMIZER_H
+
+#include "differentiable_operation.h"
+
+typedef struct {
+    int nodes_before;
+    int nodes_after;
+    int folded;  // Operations replaced by a constant
+    int merged;  // Nodes replaced by an identical earlier node
+    int fused;  // Add nodes absorbed into an n-ary sum
+    int freed;  // Dead nodes released (arena nodes stay with their arena)
+} GraphOptimizationReport;
+
+// Rewrites the graph reachable from roots before it is executed:
+//  - constant folding: operations whose inputs are all constants become
+//    constants (see create_constant(); plain variables are never folded)
+//  - n-ary sum fusion: adds and sums used only by another add or sum are
+//    absorbed into it, so a chain ((b + t0) + t1) + t2 becomes one
+//    sum(b, t0, t1, t2). Each chain is flattened once, from its top, in
+//    time linear in its length; sums of more than MAX_OPERATION_INPUTS
+//    terms are split into a sum of partial sums
+//  - common subexpression elimination: nodes with the same type and the
+//    same inputs (in any order for add, mul and sum) are merged, as are
+//    constants with equal values
+//  - dead node elimination: nodes no longer reachable from the roots are
+//    released
+//
+// Surviving nodes keep their identity, but their inputs are rewritten in
+// place, and roots[] receives the replacement of every root. Keep any node
+// you still need as a root; other pointers into the graph may dangle.
+// New nodes come from the bound arena, if any. Returns 0 if the graph has
+// a cycle.
+int optimize_graph(DifferentiableOperation** roots, int num_roots, GraphOptimizationReport* report);
+
+#endif
@@ -1,58 +1,184 @@
 #include "graph_utils.h"
-#include "operations.h"  // Add this line
+#include "operations.h"
+#include "profiler.h"
+#include <stdint.h>
 #include <string.h>
 
-int visited_nodes = 0;
-DifferentiableOperation* nodes[MAX_NODES];
+GraphContext* create_graph_context() {
+    GraphContext* ctx = malloc(sizeof(GraphContext));
+    init_node_list(&ctx->order);
+    init_traversal_stack(&ctx->stack);
+    ctx->num_indexed = 0;
+    ctx->grads = NULL;
+    ctx->input_start = NULL;
+    ctx->input_grads = NULL;
+    ctx->index_keys = NULL;
+    ctx->index_slots = NULL;
+    ctx->index_mask = 0;
+    return ctx;
+}
 
-int collect_nodes(DifferentiableOperation* op) {
-    if (op->visit_state == VISITED) {
-        return 1;
+// Collected nodes stay VISITED until the context is cleared
+void clear_graph_context(GraphContext* ctx) {
+    for (int i = 0; i < ctx->order.num_nodes; i++) {
+        ctx->order.nodes[i]->visit_state = UNVISITED;
     }
-    if (op->visit_state == VISITING) {
-        fprintf(stderr, "Error: Cycle detected in computation graph involving node at address %p.\n", (void*)op);
-        return 0;
+    ctx->order.num_nodes = 0;
+    ctx->num_indexed = 0;
+}
+
+void free_graph_context(GraphContext* ctx) {
+    clear_graph_context(ctx);
+    free_node_list(&ctx->order);
+    free_traversal_stack(&ctx->stack);
+    free(ctx->grads);
+    free(ctx->input_start);
+    free(ctx->input_grads);
+    free(ctx->index_keys);
+    free(ctx->index_slots);
+    free(ctx);
+}
+
+static size_t hash_node(const DifferentiableOperation* op, size_t mask) {
+    return (size_t)(((uintptr_t)op >> 4) * (uintptr_t)0x9E3779B97F4A7C15ull) & mask;
+}
+
+static int find_position(const GraphContext* ctx, const DifferentiableOperation* op) {
+    if (!ctx->index_keys) return -1;
+    size_t h = hash_node(op, ctx->index_mask);
+    while (ctx->index_keys[h]) {
+        if (ctx->index_keys[h] == op) return ctx->index_slots[h] < ctx->num_indexed ? ctx->index_slots[h] : -1;
+        h = (h + 1) & ctx->index_mask;
     }
+    return -1;
+}
 
-    op->visit_state = VISITING;
+static double* grad_at(GraphContext* ctx, DifferentiableOperation* op, int position) {
+    return op->type == OP_VARIABLE ? variable_grad(op) : &ctx->grads[position];
+}
+
+// Brings the grads, the position index and the input grad pointers up to
+// date with order. Grads of nodes indexed before are kept.
+static void index_context(GraphContext* ctx) {
+    int n = ctx->order.num_nodes;
+    if (ctx->num_indexed == n) return;
+    DifferentiableOperation** nodes = ctx->order.nodes;
+    ctx->grads = realloc(ctx->grads, (n > 0 ? n : 1) * sizeof(double));
+    memset(ctx->grads + ctx->num_indexed, 0, (n - ctx->num_indexed) * sizeof(double));
+
+    size_t table_size = 16;
+    while (table_size < 2 * (size_t)n) table_size *= 2;
+    free(ctx->index_keys);
+    free(ctx->index_slots);
+    ctx->index_keys = calloc(table_size, sizeof(DifferentiableOperation*));
+    ctx->index_slots = malloc(table_size * sizeof(int));
+    ctx->index_mask = table_size - 1;
+    int num_edges = 0;
+    for (int i = 0; i < n; i++) {
+        size_t h = hash_node(nodes[i], ctx->index_mask);
+        while (ctx->index_keys[h]) h = (h + 1) & ctx->index_mask;
+        ctx->index_keys[h] = nodes[i];
+        ctx->index_slots[h] = i;
+        num_edges += nodes[i]->type == OP_VARIABLE ? 0 : nodes[i]->num_inputs;
+    }
 
-    for (int i = 0; i < op->num_inputs; ++i) {
-        if (!collect_nodes(op->inputs[i])) {
-            return 0;
+    ctx->num_indexed = n;
+    ctx->input_start = realloc(ctx->input_start, (n + 1) * sizeof(int));
+    ctx->input_grads = realloc(ctx->input_grads, (num_edges > 0 ? num_edges : 1) * sizeof(double*));
+    int edge = 0;
+    for (int i = 0; i < n; i++) {
+        ctx->input_start[i] = edge;
+        if (nodes[i]->type == OP_VARIABLE) continue;
+        DifferentiableOperation** inputs = operation_inputs(nodes[i]);
+        for (int k = 0; k < nodes[i]->num_inputs; k++) {
+            ctx->input_grads[edge++] = grad_at(ctx, inputs[k], find_position(ctx, inputs[k]));
         }
     }
+    ctx->input_start[n] = edge;
+}
 
-    op->visit_state = VISITED;
-    nodes[visited_nodes++] = op;
+double* context_grad(GraphContext* ctx, DifferentiableOperation* op) {
+    index_context(ctx);
+    int position = find_position(ctx, op);
+    return position < 0 ? NULL : grad_at(ctx, op, position);
+}
+
+int collect_nodes(GraphContext* ctx, DifferentiableOperation* op) {
+    return traverse_graph(&ctx->stack, &op, 1, 0, append_node, &ctx->order);
+}
 
-    return 1;
+// data is the ProfilePass of the sweep, or NULL when not profiling
+static void compute_visitor(DifferentiableOperation* op, void* data) {
+    ProfilePass* pass = data;
+    if (op->type != OP_VARIABLE) {
+        long long start = pass ? profile_clock_ns() : 0;
+        compute_operation(op);
+        if (pass) profile_node(pass, op->type, start);
+    }
 }
 
+// Shared subgraphs are evaluated once per pass: the traversal skips nodes
+// already stamped with the pass's generation.
 void forward(DifferentiableOperation* op) {
-    if (op->compute) {
-        for (int i = 0; i < op->num_inputs; ++i) {
-            forward(op->inputs[i]);
+    forward_all(&op, 1);
+}
+
+void forward_all(DifferentiableOperation** roots, int num_roots) {
+    if (!profiling_enabled()) {
+        traverse_graph(thread_traversal_stack(), roots, num_roots, next_traversal_generation(), compute_visitor, NULL);
+        return;
+    }
+    ProfilePass pass;
+    begin_profile_pass(&pass);
+    traverse_graph(thread_traversal_stack(), roots, num_roots, next_traversal_generation(), compute_visitor, &pass);
+    end_profile_pass(&pass, 0, "forward");
+}
+
+void backward_pass(GraphContext* ctx) {
+    index_context(ctx);
+    int profiled = profiling_enabled();
+    ProfilePass pass;
+    if (profiled) begin_profile_pass(&pass);
+    for (int i = ctx->order.num_nodes - 1; i >= 0; i--) {
+        DifferentiableOperation* op = ctx->order.nodes[i];
+        LOG(LOG_TRACE, "Backward node %d: %s %p\n", i, operation_name(op), (void*)op);
+        if (op->type != OP_VARIABLE) {
+            long long start = profiled ? profile_clock_ns() : 0;
+            backward_operation(op, ctx->grads[i], ctx->input_grads + ctx->input_start[i]);
+            ctx->grads[i] = 0.0;
+            if (profiled) profile_node(&pass, op->type, start);
         }
-        op->compute(op);
     }
+    if (profiled) end_profile_pass(&pass, 1, "backward_pass");
 }
 
-void backward_pass() {
-    printf("Starting backward pass...\n");
-    for (int i = visited_nodes - 1; i >= 0; i--) {
-        DifferentiableOperation* op = nodes[i];
-        printf("Processing node %d: %p\n", i, (void*)op);
-        if (op->backward) {
-            printf("Calling backward function for node %d\n", i);
-            op->backward(op, op->grad);
-        } else {
-            printf("No backward function for node %d\n", i);
+typedef struct {
+    FILE* file;
+    GraphContext* ctx;
+} DotWriter;
+
+// Variables show their grad; operations show one if ctx has collected them.
+// Tensor values are buffers, so tensor nodes show their name only.
+static void dot_visitor(DifferentiableOperation* op, void* data) {
+    DotWriter* writer = data;
+    int position = find_position(writer->ctx, op);
+    fprintf(writer->file, "    node%p [label=\"%s", (void*)op, operation_name(op));
+    if (op->type != OP_TENSOR) {
+        fprintf(writer->file, "\\nvalue: %.2f", *operation_value(op));
+        if (op->type == OP_VARIABLE) {
+            fprintf(writer->file, "\\ngrad: %.2f", *variable_grad(op));
+        } else if (position >= 0) {
+            fprintf(writer->file, "\\ngrad: %.2f", writer->ctx->grads[position]);
         }
     }
-    printf("Backward pass completed.\n");
+    fprintf(writer->file, "\"];\n");
+    DifferentiableOperation** inputs = operation_inputs(op);
+    for (int i = 0; i < op->num_inputs; i++) {
+        fprintf(writer->file, "    node%p -> node%p;\n", (void*)inputs[i], (void*)op);
+    }
 }
 
-void generate_dot_file(DifferentiableOperation* root, const char* filename) {
+void generate_dot_file(GraphContext* ctx, DifferentiableOperation* root, const char* filename) {
     FILE* file = fopen(filename, "w");
     if (!file) {
         fprintf(stderr, "Error opening file %s\n", filename);
@@ -60,43 +186,8 @@ void generate_dot_file(DifferentiableOperation* root, const char* filename) {
     }
 
     fprintf(file, "digraph ComputationGraph {\n");
-
-    reset_visit_state(root);
-
-    DifferentiableOperation* stack[MAX_NODES];
-    int stack_size = 0;
-    stack[stack_size++] = root;
-
-    while (stack_size > 0) {
-        DifferentiableOperation* op = stack[--stack_size];
-        
-        if (op->visit_state == VISITED) continue;
-        op->visit_state = VISITED;
-
-        fprintf(file, "    node%p [label=\"", (void*)op);
-        if (op->compute == add_compute) {
-            fprintf(file, "+\\nvalue: %.2f\\ngrad: %.2f", op->value, op->grad);
-        } else if (op->compute == mul_compute) {
-            fprintf(file, "*\\nvalue: %.2f\\ngrad: %.2f", op->value, op->grad);
-        } else if (op->compute == exp_compute) {
-            fprintf(file, "exp\\nvalue: %.2f\\ngrad: %.2f", op->value, op->grad);
-        } else if (op->compute == softmax_compute) {
-            fprintf(file, "softmax\\nvalue: %.2f\\ngrad: %.2f", op->value, op->grad);
-        } else {
-            fprintf(file, "var\\nvalue: %.2f\\ngrad: %.2f", op->value, op->grad);
-        }
-        fprintf(file, "\"];\n");
-
-        for (int i = 0; i < op->num_inputs; i++) {
-            fprintf(file, "    node%p -> node%p;\n", (void*)op->inputs[i], (void*)op);
-            if (op->inputs[i]->visit_state == UNVISITED) {
-                stack[stack_size++] = op->inputs[i];
-            }
-        }
-    }
-
+    DotWriter writer = { file, ctx };
+    traverse_graph(&ctx->stack, &root, 1, next_traversal_generation(), dot_visitor, &writer);
     fprintf(file, "}\n");
     fclose(file);
-
-    reset_visit_state(root);
-}
\ No newline at end of file
+}
@@ -2,12 +2,43 @@
 #define GRAPH_UTILS_H
 
 #include "differentiable_operation.h"
+#include "traversal.h"
 
-#define MAX_NODES 100
+// Per-graph traversal state. A context owns the node order recorded by
+// collect_nodes() and the scratch space of its traversals, so independent
+// graphs can be processed on different threads with their own contexts.
+//
+// It also owns the grads of the collected operations, which nodes do not
+// store: grads[i] belongs to order.nodes[i], and input_grads, from
+// input_start[i], points at the grad of each input of node i, so
+// backward_pass() looks nothing up. Variables keep their own grads.
+typedef struct {
+    NodeList order;  // Topological order, inputs first
+    TraversalStack stack;
+    int num_indexed;  // Nodes of order covered by the arrays below
+    double* grads;
+    int* input_start;
+    double** input_grads;
+    DifferentiableOperation** index_keys;  // Open addressing, node to position
+    int* index_slots;
+    size_t index_mask;
+} GraphContext;
 
-int collect_nodes(DifferentiableOperation* op);
+GraphContext* create_graph_context();
+void clear_graph_context(GraphContext* ctx);
+void free_graph_context(GraphContext* ctx);
+
+int collect_nodes(GraphContext* ctx, DifferentiableOperation* op);
 void forward(DifferentiableOperation* op);
-void backward_pass();
-void generate_dot_file(DifferentiableOperation* root, const char* filename);
+void forward_all(DifferentiableOperation** roots, int num_roots);
+// Where the grad of a collected node accumulates: the variable's own grad,
+// or the context's slot for an operation. NULL for a node that was not
+// collected. Seed the root through here before backward_pass().
+double* context_grad(GraphContext* ctx, DifferentiableOperation* op);
+// Propagates the grads of the collected nodes to their inputs, in reverse
+// order. Operation grads are cleared once propagated, as on a tape, while
+// variable grads keep accumulating.
+void backward_pass(GraphContext* ctx);
+void generate_dot_file(GraphContext* ctx, DifferentiableOperation* root, const char* filename);
 
 #endif
\ No newline at end of file
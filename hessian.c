@@ -0,0 +1,193 @@
+#include "hessian.h"
+#include "kernels.h"
+#include "operations.h"
+#include <string.h>
+
+static int all_zero(const double* x, size_t n) {
+    for (size_t l = 0; l < n; l++) {
+        if (x[l] != 0.0) return 0;
+    }
+    return 1;
+}
+
+// Backward rule of slot i and its derivative along every tangent. With
+// a dot for tangents: the rule ga += g * b of mul becomes
+// gda += gd * b + g * db.
+static void backward_tangent_node(Tape* tape, int i) {
+    const KernelTable* k = kernels();
+    const int* start = tape->input_start;
+    const int* args = tape->input_indices + start[i];
+    const double* values = tape->values;
+    const double* tangents = tape->tangents;
+    double* grads = tape->grads;
+    double* grad_tangents = tape->grad_tangents;
+    int lanes = tape->lanes;
+    int num_tangents = tape->num_tangents;
+    size_t block = (size_t)num_tangents * lanes;
+    const double* g = grads + (size_t)i * lanes;
+    const double* gd = grad_tangents + i * block;
+    const double* v = values + (size_t)i * lanes;
+    const double* dv = tangents + i * block;
+
+    switch (tape->opcodes[i]) {
+    case OP_ADD:
+        for (int j = 0; j < 2; j++) {
+            double* ga = grads + (size_t)args[j] * lanes;
+            double* gda = grad_tangents + args[j] * block;
+            k->add(ga, ga, g, lanes);
+            k->add(gda, gda, gd, (int)block);
+        }
+        break;
+    case OP_MUL:
+        for (int j = 0; j < 2; j++) {
+            int other = args[1 - j];
+            const double* b = values + (size_t)other * lanes;
+            k->fma_acc(grads + (size_t)args[j] * lanes, g, b, lanes);
+            for (int t = 0; t < num_tangents; t++) {
+                double* gda = grad_tangents + args[j] * block + (size_t)t * lanes;
+                k->fma_acc(gda, gd + (size_t)t * lanes, b, lanes);
+                k->fma_acc(gda, g, tangents + other * block + (size_t)t * lanes, lanes);
+            }
+        }
+        break;
+    case OP_EXP:
+        k->fma_acc(grads + (size_t)args[0] * lanes, g, v, lanes);
+        for (int t = 0; t < num_tangents; t++) {
+            double* gda = grad_tangents + args[0] * block + (size_t)t * lanes;
+            k->fma_acc(gda, gd + (size_t)t * lanes, v, lanes);
+            k->fma_acc(gda, g, dv + (size_t)t * lanes, lanes);
+        }
+        break;
+    case OP_SOFTMAX: {
+        // With c = g / sum: ga_j -= c * s, plus c for input 0, where
+        // dc = (gd - c * dsum) / sum
+        int num_args = start[i + 1] - start[i];
+        double* sum = tape->scratch;
+        double* c = tape->scratch + lanes;
+        double* dc = tape->scratch + 2 * lanes;
+        memset(sum, 0, lanes * sizeof(double));
+        for (int j = 0; j < num_args; j++) {
+            k->add(sum, sum, values + (size_t)args[j] * lanes, lanes);
+        }
+        k->div(c, g, sum, lanes);
+        for (int t = 0; t < num_tangents; t++) {
+            memset(dc, 0, lanes * sizeof(double));
+            for (int j = 0; j < num_args; j++) {
+                k->add(dc, dc, tangents + args[j] * block + (size_t)t * lanes, lanes);
+            }
+            for (int l = 0; l < lanes; l++) {
+                dc[l] = (gd[(size_t)t * lanes + l] - c[l] * dc[l]) / sum[l];
+            }
+            for (int j = 0; j < num_args; j++) {
+                double* gda = grad_tangents + args[j] * block + (size_t)t * lanes;
+                k->fnma_acc(gda, dc, v, lanes);
+                k->fnma_acc(gda, c, dv + (size_t)t * lanes, lanes);
+            }
+            double* first = grad_tangents + args[0] * block + (size_t)t * lanes;
+            k->add(first, first, dc, lanes);
+        }
+        for (int j = 0; j < num_args; j++) {
+            k->fnma_acc(grads + (size_t)args[j] * lanes, c, v, lanes);
+        }
+        double* first = grads + (size_t)args[0] * lanes;
+        k->add(first, first, c, lanes);
+        break;
+    }
+    case OP_SUM:
+        for (int j = 0; j < start[i + 1] - start[i]; j++) {
+            double* ga = grads + (size_t)args[j] * lanes;
+            double* gda = grad_tangents + args[j] * block;
+            k->add(ga, ga, g, lanes);
+            k->add(gda, gda, gd, (int)block);
+        }
+        break;
+    case OP_SOFTMAX_CROSS_ENTROPY: {
+        // gz_j += g * (p_j - onehot_j), and dp_j = p_j * (dz_j - sum_k p_k dz_k)
+        // where sum_k p_k dz_k = dloss + dz[label]
+        int num_classes = start[i + 1] - start[i] - 1;
+        const double* label = values + (size_t)args[num_classes] * lanes;
+        double* lse = tape->scratch;
+        double* p = tape->scratch + lanes;
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            lse[l] = v[l] + values[(size_t)target * lanes + l];
+        }
+        for (int j = 0; j < num_classes; j++) {
+            const double* z = values + (size_t)args[j] * lanes;
+            for (int l = 0; l < lanes; l++) p[l] = z[l] - lse[l];
+            k->exp(p, p, lanes);
+            k->fma_acc(grads + (size_t)args[j] * lanes, g, p, lanes);
+            for (int t = 0; t < num_tangents; t++) {
+                const double* dz = tangents + args[j] * block + (size_t)t * lanes;
+                const double* dl = dv + (size_t)t * lanes;
+                const double* gdt = gd + (size_t)t * lanes;
+                double* gda = grad_tangents + args[j] * block + (size_t)t * lanes;
+                for (int l = 0; l < lanes; l++) {
+                    int target = args[checked_label(label[l], num_classes)];
+                    double mean = dl[l] + tangents[target * block + (size_t)t * lanes + l];
+                    gda[l] += gdt[l] * p[l] + g[l] * p[l] * (dz[l] - mean);
+                }
+            }
+        }
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            grads[(size_t)target * lanes + l] -= g[l];
+            for (int t = 0; t < num_tangents; t++) {
+                grad_tangents[target * block + (size_t)t * lanes + l] -= gd[(size_t)t * lanes + l];
+            }
+        }
+        break;
+    }
+    }
+}
+
+void tape_backward_tangents(Tape* tape) {
+    int lanes = tape->lanes;
+    size_t block = (size_t)tape->num_tangents * lanes;
+    if (!tape->grad_tangents) {
+        tape->grad_tangents = calloc(tape->num_nodes * block, sizeof(double));
+    }
+
+    for (int i = tape->num_nodes - 1; i >= 0; i--) {
+        double* g = tape->grads + (size_t)i * lanes;
+        double* gd = tape->grad_tangents + i * block;
+        if (tape->opcodes[i] == OP_VARIABLE || (all_zero(g, lanes) && all_zero(gd, block))) {
+            continue;
+        }
+        backward_tangent_node(tape, i);
+        memset(g, 0, lanes * sizeof(double));
+        memset(gd, 0, block * sizeof(double));
+    }
+}
+
+int hessian_vector_product(DifferentiableOperation* root, DifferentiableOperation** params, int num_params,
+                           const double* direction, double* gradient, double* hv) {
+    Tape* tape = compile_tape(&root, 1);
+    if (!tape) {
+        return 0;
+    }
+    tape_enable_tangents(tape, 1);
+    int* slots = malloc(num_params * sizeof(int));
+    for (int p = 0; p < num_params; p++) {
+        slots[p] = tape_index_of(tape, params[p]);
+        if (slots[p] < 0) {
+            fprintf(stderr, "Error: Parameter %d is not part of the graph.\n", p);
+            free(slots);
+            free_tape(tape);
+            return 0;
+        }
+        tape_seed_tangent(tape, slots[p], 0, direction[p]);
+    }
+
+    tape_forward_tangents(tape);
+    tape->grads[tape_index_of(tape, root)] = 1.0;
+    tape_backward_tangents(tape);
+
+    for (int p = 0; p < num_params; p++) {
+        if (gradient) gradient[p] = tape->grads[slots[p]];
+        hv[p] = tape->grad_tangents[slots[p]];
+    }
+    free(slots);
+    free_tape(tape);
+    return 1;
+}
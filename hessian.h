@@ -0,0 +1,23 @@
+#ifndef HESSIAN_H
+#define HESSIAN_H
+
+#include "forward_mode.h"
+
+// Second-order derivatives by forward-over-reverse differentiation. After
+// tape_forward_tangents() has pushed directions v through the values,
+// tape_backward_tangents() runs the reverse sweep and differentiates every
+// backward rule along v as it goes. Besides the usual grads it leaves
+// grad_tangents[(i * num_tangents + t) * lanes + l], the derivative of the
+// gradient along direction t: for the variables, that is the Hessian-vector
+// product H v_t. It costs a small constant multiple of one gradient.
+//
+// grad_tangents follow the same rules as grads: cleared on operation slots
+// once propagated, accumulated on variables until tape_zero_tangents().
+void tape_backward_tangents(Tape* tape);
+
+// H v for the scalar root with respect to params, along direction. The
+// gradient is written as well unless it is NULL. Returns 0 on failure.
+int hessian_vector_product(DifferentiableOperation* root, DifferentiableOperation** params, int num_params,
+                           const double* direction, double* gradient, double* hv);
+
+#endif
@@ -0,0 +1,53 @@
+#include "jacobian.h"
+
+void tape_jacobian(Tape* tape, const int* output_slots, int num_outputs, const int* input_slots, int num_inputs,
+                   double* jacobian) {
+    int lanes = tape->lanes;
+    tape_load_variables(tape);
+    tape_forward(tape);
+
+    for (int first = 0; first < num_outputs; first += lanes) {
+        int count = num_outputs - first < lanes ? num_outputs - first : lanes;
+        tape_zero_grads(tape);
+        for (int k = 0; k < count; k++) {
+            tape->grads[(size_t)output_slots[first + k] * lanes + k] = 1.0;
+        }
+        tape_backward(tape);
+        for (int k = 0; k < count; k++) {
+            double* row = jacobian + (size_t)(first + k) * num_inputs;
+            for (int j = 0; j < num_inputs; j++) {
+                row[j] = input_slots[j] < 0 ? 0.0 : tape->grads[(size_t)input_slots[j] * lanes + k];
+            }
+        }
+    }
+    tape_zero_grads(tape);
+}
+
+int compute_jacobian(DifferentiableOperation** outputs, int num_outputs, DifferentiableOperation** inputs,
+                     int num_inputs, double* jacobian) {
+    for (int j = 0; j < num_inputs; j++) {
+        if (inputs[j]->num_inputs != 0) {
+            fprintf(stderr, "Error: Jacobian input %d is not a variable.\n", j);
+            return 0;
+        }
+    }
+    Tape* tape = compile_batched_tape(outputs, num_outputs, num_outputs < JACOBIAN_BLOCK ? num_outputs : JACOBIAN_BLOCK);
+    if (!tape) {
+        return 0;
+    }
+
+    int* output_slots = malloc(num_outputs * sizeof(int));
+    int* input_slots = malloc(num_inputs * sizeof(int));
+    for (int k = 0; k < num_outputs; k++) {
+        output_slots[k] = tape_index_of(tape, outputs[k]);
+    }
+    for (int j = 0; j < num_inputs; j++) {
+        input_slots[j] = tape_index_of(tape, inputs[j]);
+    }
+    tape_jacobian(tape, output_slots, num_outputs, input_slots, num_inputs, jacobian);
+
+    free(output_slots);
+    free(input_slots);
+    free_tape(tape);
+    return 1;
+}
@@ -0,0 +1,28 @@
+#ifndef JACOBIAN_H
+#define JACOBIAN_H
+
+#include "tape.h"
+
+// Jacobians from a multi-seed reverse sweep: with one lane per output, the
+// grad of output k is seeded with 1 on lane k only, so a single backward
+// sweep leaves row k of the Jacobian in lane k of the variable grads.
+// Outputs beyond the number of lanes are handled in further sweeps of
+// tape->lanes outputs each.
+//
+// jacobian is row-major: jacobian[k * num_inputs + j] = d output_k / d input_j.
+// Inputs must be variables. Entries of inputs an output does not depend on
+// are exact zeros; an input slot of -1 gives a zero column.
+
+#define JACOBIAN_BLOCK 64
+
+// Evaluates the tape with the current variable values first. Clears the
+// tape's grads.
+void tape_jacobian(Tape* tape, const int* output_slots, int num_outputs, const int* input_slots, int num_inputs,
+                   double* jacobian);
+
+// Compiles outputs with min(num_outputs, JACOBIAN_BLOCK) lanes. Returns 0
+// on failure.
+int compute_jacobian(DifferentiableOperation** outputs, int num_outputs, DifferentiableOperation** inputs,
+                     int num_inputs, double* jacobian);
+
+#endif
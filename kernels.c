@@ -0,0 +1,582 @@
+#include "kernels.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+// Constants of the vectorized exp, shared by every SIMD implementation.
+// Inputs are clamped to [EXP_LO, EXP_HI], which already overflows to inf
+// or underflows to 0; the 2^k scale is applied in two halves so that k may
+// leave the normal exponent range.
+#define EXP_HI 710.0
+#define EXP_LO -746.0
+#define EXP_LOG2E 1.4426950408889634
+#define EXP_LN2_HI 6.93147180369123816490e-01
+#define EXP_LN2_LO 1.90821492927058770002e-10
+#define EXP_ROUND_MAGIC 6755399441055744.0  // 1.5 * 2^52
+
+static const double exp_poly[] = {
+    1.0 / 6227020800.0,  // 1/13!
+    1.0 / 479001600.0,
+    1.0 / 39916800.0,
+    1.0 / 3628800.0,
+    1.0 / 362880.0,
+    1.0 / 40320.0,
+    1.0 / 5040.0,
+    1.0 / 720.0,
+    1.0 / 120.0,
+    1.0 / 24.0,
+    1.0 / 6.0,
+    1.0 / 2.0,
+    1.0,
+    1.0,
+};
+#define EXP_POLY_TERMS ((int)(sizeof(exp_poly) / sizeof(exp_poly[0])))
+
+// Single-precision counterparts. The clamp bounds again saturate to inf
+// and 0; a degree-8 polynomial is enough for float.
+#define EXPF_HI 89.0f
+#define EXPF_LO -104.0f
+#define EXPF_LOG2E 1.44269504f
+#define EXPF_LN2_HI 0.693359375f
+#define EXPF_LN2_LO -2.12194440e-4f
+
+static const float expf_poly[] = {
+    1.0f / 40320.0f,  // 1/8!
+    1.0f / 5040.0f,
+    1.0f / 720.0f,
+    1.0f / 120.0f,
+    1.0f / 24.0f,
+    1.0f / 6.0f,
+    1.0f / 2.0f,
+    1.0f,
+    1.0f,
+};
+#define EXPF_POLY_TERMS ((int)(sizeof(expf_poly) / sizeof(expf_poly[0])))
+
+// Scalar fallback. Plain loops, left to the compiler to vectorize.
+
+static void scalar_add(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void scalar_mul(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void scalar_div(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] / b[i];
+}
+
+static void scalar_exp(double* out, const double* a, int n) {
+    for (int i = 0; i < n; i++) out[i] = exp(a[i]);
+}
+
+static void scalar_fma_acc(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] += a[i] * b[i];
+}
+
+static void scalar_fnma_acc(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+static const KernelTable scalar_kernels = {
+    "scalar", scalar_add, scalar_mul, scalar_div, scalar_exp, scalar_fma_acc, scalar_fnma_acc
+};
+
+static void scalar_add_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void scalar_mul_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void scalar_div_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] / b[i];
+}
+
+static void scalar_exp_f32(float* out, const float* a, int n) {
+    for (int i = 0; i < n; i++) out[i] = expf(a[i]);
+}
+
+static void scalar_fma_acc_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] += a[i] * b[i];
+}
+
+static void scalar_fnma_acc_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+static const FloatKernelTable scalar_float_kernels = {
+    "scalar", scalar_add_f32, scalar_mul_f32, scalar_div_f32, scalar_exp_f32, scalar_fma_acc_f32, scalar_fnma_acc_f32
+};
+
+#ifdef KERNELS_X86
+
+// SSE2: two doubles per vector, no FMA
+
+static void sse2_add(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void sse2_mul(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void sse2_div(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_div_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] / b[i];
+}
+
+static void sse2_fma_acc(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d p = _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(out + i), p));
+    }
+    for (; i < n; i++) out[i] += a[i] * b[i];
+}
+
+static void sse2_fnma_acc(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d p = _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        _mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(out + i), p));
+    }
+    for (; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+// 2^k for integral k in [-1022, 1023] held in a double
+static inline __m128d sse2_pow2(__m128d k) {
+    const __m128d magic = _mm_set1_pd(EXP_ROUND_MAGIC);
+    __m128i bits = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(k, magic)), _mm_castpd_si128(magic));
+    return _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(bits, _mm_set1_epi64x(1023)), 52));
+}
+
+static inline __m128d sse2_exp_vector(__m128d x) {
+    const __m128d magic = _mm_set1_pd(EXP_ROUND_MAGIC);
+    // max/min return their second operand for NaN, so NaN propagates
+    x = _mm_min_pd(_mm_set1_pd(EXP_HI), _mm_max_pd(_mm_set1_pd(EXP_LO), x));
+    __m128d k = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(EXP_LOG2E)), magic), magic);
+    __m128d r = _mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(EXP_LN2_HI)));
+    r = _mm_sub_pd(r, _mm_mul_pd(k, _mm_set1_pd(EXP_LN2_LO)));
+    __m128d p = _mm_set1_pd(exp_poly[0]);
+    for (int j = 1; j < EXP_POLY_TERMS; j++) {
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(exp_poly[j]));
+    }
+    __m128d k1 = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(k, _mm_set1_pd(0.5)), magic), magic);
+    __m128d k2 = _mm_sub_pd(k, k1);
+    return _mm_mul_pd(_mm_mul_pd(p, sse2_pow2(k1)), sse2_pow2(k2));
+}
+
+static void sse2_exp(double* out, const double* a, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, sse2_exp_vector(_mm_loadu_pd(a + i)));
+    for (; i < n; i++) out[i] = exp(a[i]);
+}
+
+static const KernelTable sse2_kernels = {
+    "sse2", sse2_add, sse2_mul, sse2_div, sse2_exp, sse2_fma_acc, sse2_fnma_acc
+};
+
+// SSE2, single precision: four floats per vector
+
+static void sse2_add_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void sse2_mul_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void sse2_div_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, _mm_div_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] / b[i];
+}
+
+static void sse2_fma_acc_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 p = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), p));
+    }
+    for (; i < n; i++) out[i] += a[i] * b[i];
+}
+
+static void sse2_fnma_acc_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 p = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        _mm_storeu_ps(out + i, _mm_sub_ps(_mm_loadu_ps(out + i), p));
+    }
+    for (; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+// 2^k for integral k in [-126, 127] held in a float
+static inline __m128 sse2_pow2_f32(__m128 k) {
+    __m128i bits = _mm_add_epi32(_mm_cvtps_epi32(k), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+}
+
+static inline __m128 sse2_exp_vector_f32(__m128 x) {
+    x = _mm_min_ps(_mm_set1_ps(EXPF_HI), _mm_max_ps(_mm_set1_ps(EXPF_LO), x));
+    // cvtps rounds to nearest under the default rounding mode
+    __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(EXPF_LOG2E))));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(EXPF_LN2_HI)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(EXPF_LN2_LO)));
+    __m128 p = _mm_set1_ps(expf_poly[0]);
+    for (int j = 1; j < EXPF_POLY_TERMS; j++) {
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expf_poly[j]));
+    }
+    __m128 k1 = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(k, _mm_set1_ps(0.5f))));
+    __m128 k2 = _mm_sub_ps(k, k1);
+    return _mm_mul_ps(_mm_mul_ps(p, sse2_pow2_f32(k1)), sse2_pow2_f32(k2));
+}
+
+static void sse2_exp_f32(float* out, const float* a, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, sse2_exp_vector_f32(_mm_loadu_ps(a + i)));
+    for (; i < n; i++) out[i] = expf(a[i]);
+}
+
+static const FloatKernelTable sse2_float_kernels = {
+    "sse2", sse2_add_f32, sse2_mul_f32, sse2_div_f32, sse2_exp_f32, sse2_fma_acc_f32, sse2_fnma_acc_f32
+};
+
+// AVX2 + FMA: four doubles per vector
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+AVX2_TARGET static void avx2_add(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+AVX2_TARGET static void avx2_mul(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+AVX2_TARGET static void avx2_div(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    for (; i < n; i++) out[i] = a[i] / b[i];
+}
+
+AVX2_TARGET static void avx2_fma_acc(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(out + i)));
+    }
+    for (; i < n; i++) out[i] += a[i] * b[i];
+}
+
+AVX2_TARGET static void avx2_fnma_acc(double* out, const double* a, const double* b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_fnmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(out + i)));
+    }
+    for (; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+AVX2_TARGET static inline __m256d avx2_pow2(__m256d k) {
+    const __m256d magic = _mm256_set1_pd(EXP_ROUND_MAGIC);
+    __m256i bits = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(k, magic)), _mm256_castpd_si256(magic));
+    return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52));
+}
+
+AVX2_TARGET static inline __m256d avx2_exp_vector(__m256d x) {
+    x = _mm256_min_pd(_mm256_set1_pd(EXP_HI), _mm256_max_pd(_mm256_set1_pd(EXP_LO), x));
+    __m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(EXP_LN2_HI), x);
+    r = _mm256_fnmadd_pd(k, _mm256_set1_pd(EXP_LN2_LO), r);
+    __m256d p = _mm256_set1_pd(exp_poly[0]);
+    for (int j = 1; j < EXP_POLY_TERMS; j++) {
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_poly[j]));
+    }
+    __m256d k1 = _mm256_round_pd(_mm256_mul_pd(k, _mm256_set1_pd(0.5)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d k2 = _mm256_sub_pd(k, k1);
+    return _mm256_mul_pd(_mm256_mul_pd(p, avx2_pow2(k1)), avx2_pow2(k2));
+}
+
+AVX2_TARGET static void avx2_exp(double* out, const double* a, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, avx2_exp_vector(_mm256_loadu_pd(a + i)));
+    for (; i < n; i++) out[i] = exp(a[i]);
+}
+
+static const KernelTable avx2_kernels = {
+    "avx2", avx2_add, avx2_mul, avx2_div, avx2_exp, avx2_fma_acc, avx2_fnma_acc
+};
+
+// AVX2 + FMA, single precision: eight floats per vector
+
+AVX2_TARGET static void avx2_add_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+AVX2_TARGET static void avx2_mul_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+AVX2_TARGET static void avx2_div_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    for (; i < n; i++) out[i] = a[i] / b[i];
+}
+
+AVX2_TARGET static void avx2_fma_acc_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) out[i] += a[i] * b[i];
+}
+
+AVX2_TARGET static void avx2_fnma_acc_f32(float* out, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_fnmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) out[i] -= a[i] * b[i];
+}
+
+AVX2_TARGET static inline __m256 avx2_pow2_f32(__m256 k) {
+    __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+
+AVX2_TARGET static inline __m256 avx2_exp_vector_f32(__m256 x) {
+    x = _mm256_min_ps(_mm256_set1_ps(EXPF_HI), _mm256_max_ps(_mm256_set1_ps(EXPF_LO), x));
+    __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXPF_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXPF_LN2_HI), x);
+    r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXPF_LN2_LO), r);
+    __m256 p = _mm256_set1_ps(expf_poly[0]);
+    for (int j = 1; j < EXPF_POLY_TERMS; j++) {
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expf_poly[j]));
+    }
+    __m256 k1 = _mm256_round_ps(_mm256_mul_ps(k, _mm256_set1_ps(0.5f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 k2 = _mm256_sub_ps(k, k1);
+    return _mm256_mul_ps(_mm256_mul_ps(p, avx2_pow2_f32(k1)), avx2_pow2_f32(k2));
+}
+
+AVX2_TARGET static void avx2_exp_f32(float* out, const float* a, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, avx2_exp_vector_f32(_mm256_loadu_ps(a + i)));
+    for (; i < n; i++) out[i] = expf(a[i]);
+}
+
+static const FloatKernelTable avx2_float_kernels = {
+    "avx2", avx2_add_f32, avx2_mul_f32, avx2_div_f32, avx2_exp_f32, avx2_fma_acc_f32, avx2_fnma_acc_f32
+};
+
+// AVX-512F: eight doubles per vector, masked tails
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+AVX512_TARGET static void avx512_add(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_pd(out + i, m, _mm512_add_pd(_mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i)));
+    }
+}
+
+AVX512_TARGET static void avx512_mul(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_pd(out + i, m, _mm512_mul_pd(_mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i)));
+    }
+}
+
+AVX512_TARGET static void avx512_div(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        // Masked-off lanes divide 1 by 1 rather than 0 by 0
+        __m512d den = _mm512_mask_loadu_pd(_mm512_set1_pd(1.0), m, b + i);
+        _mm512_mask_storeu_pd(out + i, m, _mm512_div_pd(_mm512_maskz_loadu_pd(m, a + i), den));
+    }
+}
+
+AVX512_TARGET static void avx512_fma_acc(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        __m512d acc = _mm512_maskz_loadu_pd(m, out + i);
+        _mm512_mask_storeu_pd(out + i, m, _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i), acc));
+    }
+}
+
+AVX512_TARGET static void avx512_fnma_acc(double* out, const double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        __m512d acc = _mm512_maskz_loadu_pd(m, out + i);
+        _mm512_mask_storeu_pd(out + i, m, _mm512_fnmadd_pd(_mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i), acc));
+    }
+}
+
+AVX512_TARGET static inline __m512d avx512_exp_vector(__m512d x) {
+    x = _mm512_min_pd(_mm512_set1_pd(EXP_HI), _mm512_max_pd(_mm512_set1_pd(EXP_LO), x));
+    __m512d k = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(EXP_LN2_HI), x);
+    r = _mm512_fnmadd_pd(k, _mm512_set1_pd(EXP_LN2_LO), r);
+    __m512d p = _mm512_set1_pd(exp_poly[0]);
+    for (int j = 1; j < EXP_POLY_TERMS; j++) {
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_poly[j]));
+    }
+    // scalef computes p * 2^k directly, including results outside the
+    // normal range
+    return _mm512_scalef_pd(p, k);
+}
+
+AVX512_TARGET static void avx512_exp(double* out, const double* a, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_pd(out + i, m, avx512_exp_vector(_mm512_maskz_loadu_pd(m, a + i)));
+    }
+}
+
+static const KernelTable avx512_kernels = {
+    "avx512", avx512_add, avx512_mul, avx512_div, avx512_exp, avx512_fma_acc, avx512_fnma_acc
+};
+
+// AVX-512F, single precision: sixteen floats per vector
+
+#define AVX512_MASK16(remaining) ((remaining) >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (remaining)) - 1))
+
+AVX512_TARGET static void avx512_add_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i)));
+    }
+}
+
+AVX512_TARGET static void avx512_mul_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i)));
+    }
+}
+
+AVX512_TARGET static void avx512_div_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        __m512 den = _mm512_mask_loadu_ps(_mm512_set1_ps(1.0f), m, b + i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_div_ps(_mm512_maskz_loadu_ps(m, a + i), den));
+    }
+}
+
+AVX512_TARGET static void avx512_fma_acc_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        __m512 acc = _mm512_maskz_loadu_ps(m, out + i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc));
+    }
+}
+
+AVX512_TARGET static void avx512_fnma_acc_f32(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        __m512 acc = _mm512_maskz_loadu_ps(m, out + i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc));
+    }
+}
+
+AVX512_TARGET static inline __m512 avx512_exp_vector_f32(__m512 x) {
+    x = _mm512_min_ps(_mm512_set1_ps(EXPF_HI), _mm512_max_ps(_mm512_set1_ps(EXPF_LO), x));
+    __m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(EXPF_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXPF_LN2_HI), x);
+    r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXPF_LN2_LO), r);
+    __m512 p = _mm512_set1_ps(expf_poly[0]);
+    for (int j = 1; j < EXPF_POLY_TERMS; j++) {
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expf_poly[j]));
+    }
+    return _mm512_scalef_ps(p, k);
+}
+
+AVX512_TARGET static void avx512_exp_f32(float* out, const float* a, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = AVX512_MASK16(n - i);
+        _mm512_mask_storeu_ps(out + i, m, avx512_exp_vector_f32(_mm512_maskz_loadu_ps(m, a + i)));
+    }
+}
+
+static const FloatKernelTable avx512_float_kernels = {
+    "avx512", avx512_add_f32, avx512_mul_f32, avx512_div_f32, avx512_exp_f32, avx512_fma_acc_f32, avx512_fnma_acc_f32
+};
+
+#endif
+
+static const KernelTable* select_kernels() {
+    const char* cap = getenv("AUTODIFF_SIMD");
+    if (cap && strcmp(cap, "scalar") == 0) {
+        return &scalar_kernels;
+    }
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    int allow_avx2 = !cap || strcmp(cap, "sse2") != 0;
+    int allow_avx512 = allow_avx2 && (!cap || strcmp(cap, "avx2") != 0);
+    if (allow_avx512 && __builtin_cpu_supports("avx512f")) {
+        return &avx512_kernels;
+    }
+    if (allow_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return &avx2_kernels;
+    }
+    return &sse2_kernels;
+#else
+    return &scalar_kernels;
+#endif
+}
+
+const KernelTable* kernels() {
+    // Selection is deterministic, so racing threads store the same table
+    static _Atomic(const KernelTable*) active = NULL;
+    const KernelTable* table = atomic_load_explicit(&active, memory_order_acquire);
+    if (!table) {
+        table = select_kernels();
+        atomic_store_explicit(&active, table, memory_order_release);
+    }
+    return table;
+}
+
+// The float table always matches the instruction set of kernels()
+static const FloatKernelTable* select_float_kernels() {
+    const char* name = kernels()->name;
+#ifdef KERNELS_X86
+    if (strcmp(name, "avx512") == 0) return &avx512_float_kernels;
+    if (strcmp(name, "avx2") == 0) return &avx2_float_kernels;
+    if (strcmp(name, "sse2") == 0) return &sse2_float_kernels;
+#endif
+    (void)name;
+    return &scalar_float_kernels;
+}
+
+const FloatKernelTable* float_kernels() {
+    static _Atomic(const FloatKernelTable*) active = NULL;
+    const FloatKernelTable* table = atomic_load_explicit(&active, memory_order_acquire);
+    if (!table) {
+        table = select_float_kernels();
+        atomic_store_explicit(&active, table, memory_order_release);
+    }
+    return table;
+}
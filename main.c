@@ -2,208 +2,413 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "differentiable_operation.h"
 #include "operations.h"
 #include "graph_utils.h"
-#include "iris_data.h"
-
-#define LEARNING_RATE 0.01
+#include "tape.h"
+#include "arena.h"
+#include "trainer.h"
+#include "graph_optimizer.h"
+#include "dataset.h"
+#include "batch_pipeline.h"
+#include "optimizer.h"
+#include "parameters.h"
+#include "profiler.h"
+#include "tensor.h"
+
+#define LEARNING_RATE 0.01  // SGD and momentum, per sample of a full batch
+#define ADAM_LEARNING_RATE 0.05
 #define EPOCHS 1000
 #define BATCH_SIZE 32
-
-DifferentiableOperation* create_model() {
-    printf("Creating model...\n");
-    DifferentiableOperation* inputs[IRIS_FEATURES];
-    DifferentiableOperation* weights[IRIS_FEATURES][IRIS_CLASSES];
-    DifferentiableOperation* biases[IRIS_CLASSES];
-
-    double xavier_init = sqrt(2.0 / (IRIS_FEATURES + IRIS_CLASSES));
-    for (int i = 0; i < IRIS_FEATURES; i++) {
-        inputs[i] = create_variable(0.0);
-        printf("Created input %d: %p\n", i, (void*)inputs[i]);
-        for (int j = 0; j < IRIS_CLASSES; j++) {
-            weights[i][j] = create_variable(((double)rand() / RAND_MAX * 2 - 1) * xavier_init);
-        }
+#define MIN_LANES_PER_THREAD 8
+#define PIPELINE_DEPTH 3  // Batches in flight between the loader and training
+#define DATASET_PATH "iris.bin"
+#define DATASET_SOURCE "iris.data"  // Converted when DATASET_PATH is missing
+
+typedef struct {
+    int num_features;
+    int num_classes;
+    DifferentiableOperation** inputs;
+    DifferentiableOperation* label;  // Class index of the current sample
+    DifferentiableOperation** logits;
+    DifferentiableOperation* loss;  // Reaches every node of the model
+    ParameterRegistry* params;  // Weights [num_classes, num_features], then biases
+} Model;
+
+// Slots of the model on the worker tapes, the batch being trained on and
+// the feature scaling, plus per-worker statistics
+typedef struct {
+    const PackedBatch* batch;
+    double* mean;
+    double* scale;  // 1 / standard deviation
+    int num_features;
+    int num_classes;
+    int* input_slots;
+    int* logit_slots;
+    int label_slot;
+    int loss_slot;
+    double* loss;
+    int* correct;
+} TrainingState;
+
+Model create_model(int num_features, int num_classes) {
+    LOG(LOG_DEBUG, "Creating model...\n");
+    Model model;
+    model.num_features = num_features;
+    model.num_classes = num_classes;
+    model.inputs = malloc(num_features * sizeof(DifferentiableOperation*));
+    model.logits = malloc(num_classes * sizeof(DifferentiableOperation*));
+    model.params = create_parameter_registry((num_features + 1) * num_classes);
+
+    double xavier_init = sqrt(2.0 / (num_features + num_classes));
+    for (int i = 0; i < num_features; i++) {
+        model.inputs[i] = create_variable(0.0);
+        LOG(LOG_DEBUG, "Created input %d: %p\n", i, (void*)model.inputs[i]);
+    }
+    for (int i = 0; i < num_classes * num_features; i++) {
+        create_parameter(model.params, ((double)rand() / RAND_MAX * 2 - 1) * xavier_init);
     }
 
-    for (int i = 0; i < IRIS_CLASSES; i++) {
-        biases[i] = create_variable((double)rand() / RAND_MAX * 0.2 - 0.1);
+    for (int i = 0; i < num_classes; i++) {
+        create_parameter(model.params, (double)rand() / RAND_MAX * 0.2 - 0.1);
     }
+    DifferentiableOperation** weights = model.params->nodes;  // weights[i * num_features + j]
+    DifferentiableOperation** biases = model.params->nodes + num_features * num_classes;
 
-    DifferentiableOperation* z[IRIS_CLASSES];
-    for (int i = 0; i < IRIS_CLASSES; i++) {
-        z[i] = biases[i];
-        for (int j = 0; j < IRIS_FEATURES; j++) {
-            z[i] = create_add_operation(z[i], create_mul_operation(inputs[j], weights[j][i]));
+    for (int i = 0; i < num_classes; i++) {
+        DifferentiableOperation* z = biases[i];
+        for (int j = 0; j < num_features; j++) {
+            z = create_add_operation(z, create_mul_operation(model.inputs[j], weights[i * num_features + j]));
         }
+        model.logits[i] = z;
     }
 
-    DifferentiableOperation* exp_z[IRIS_CLASSES];
-    for (int i = 0; i < IRIS_CLASSES; i++) {
-        exp_z[i] = create_exp_operation(z[i]);
+    model.label = create_variable(0.0);
+    model.loss = create_softmax_cross_entropy_operation(model.logits, num_classes, model.label);
+
+    LOG(LOG_DEBUG, "Model created successfully.\n");
+    return model;
+}
+
+// The logits stay roots so the tape still has a slot for each of them
+void optimize_model(Model* model) {
+    DifferentiableOperation** roots = malloc((1 + model->num_classes) * sizeof(DifferentiableOperation*));
+    roots[0] = model->loss;
+    for (int i = 0; i < model->num_classes; i++) {
+        roots[1 + i] = model->logits[i];
     }
 
-    DifferentiableOperation* softmax[IRIS_CLASSES];
-    for (int i = 0; i < IRIS_CLASSES; i++) {
-        softmax[i] = create_softmax_operation(exp_z, IRIS_CLASSES);
+    GraphOptimizationReport report;
+    optimize_graph(roots, 1 + model->num_classes, &report);
+    model->loss = roots[0];
+    for (int i = 0; i < model->num_classes; i++) {
+        model->logits[i] = roots[1 + i];
+    }
+    free(roots);
+    LOG(LOG_INFO, "Optimized graph: %d -> %d nodes (%d folded, %d merged, %d adds fused).\n", report.nodes_before,
+           report.nodes_after, report.folded, report.merged, report.fused);
+}
+
+void free_model(Model* model) {
+    free(model->inputs);
+    free(model->logits);
+    free_parameter_registry(model->params);
+}
+
+// The dataset is mapped read-only, so features are standardized as they
+// are packed into batches
+void compute_normalization(const Dataset* dataset, double* mean, double* scale) {
+    int n = dataset->num_samples;
+    for (int j = 0; j < dataset->num_features; j++) {
+        const double* x = dataset_feature(dataset, j);
+        double sum = 0.0, var = 0.0;
+        for (int i = 0; i < n; i++) {
+            sum += x[i];
+        }
+        mean[j] = sum / n;
+        for (int i = 0; i < n; i++) {
+            double d = x[i] - mean[j];
+            var += d * d;
+        }
+        double std = sqrt(var / n);
+        scale[j] = 1.0 / (std > 0 ? std : 1.0);
     }
+}
 
-    DifferentiableOperation* result = softmax[IRIS_CLASSES - 1];
-    
-    // Ensure the result has the correct inputs
-    result->inputs = malloc(IRIS_FEATURES * sizeof(DifferentiableOperation*));
-    result->num_inputs = IRIS_FEATURES;
-    for (int i = 0; i < IRIS_FEATURES; i++) {
-        result->inputs[i] = inputs[i];
+// Opens the binary dataset, converting the CSV source on first use
+Dataset* load_dataset(const char* path, const char* source) {
+    if (access(path, R_OK) != 0) {
+        LOG(LOG_INFO, "Converting %s to %s...\n", source, path);
+        if (!convert_csv_dataset(source, path)) {
+            return NULL;
+        }
     }
+    return open_dataset(path);
+}
 
-    printf("Model created successfully.\n");
-    return result;
+// AUTODIFF_OPTIMIZER picks "sgd", "momentum" (the default), "adam" or
+// "adamw". The rate decays along a cosine over the whole run.
+Optimizer* create_model_optimizer(const Model* model, int total_steps) {
+    const char* name = getenv("AUTODIFF_OPTIMIZER");
+    OptimizerType type = OPTIMIZER_MOMENTUM;
+    if (name && strcmp(name, "sgd") == 0) type = OPTIMIZER_SGD;
+    if (name && strcmp(name, "adam") == 0) type = OPTIMIZER_ADAM;
+    if (name && strcmp(name, "adamw") == 0) type = OPTIMIZER_ADAMW;
+
+    // Grads are averaged over the batch, so SGD takes the per-sample rate
+    // times the batch size
+    double learning_rate = type == OPTIMIZER_SGD || type == OPTIMIZER_MOMENTUM ? LEARNING_RATE * BATCH_SIZE
+                                                                                : ADAM_LEARNING_RATE;
+    Optimizer* optimizer = create_optimizer(model->params->nodes, model->params->num_params,
+                                            default_optimizer_config(type, learning_rate));
+    set_learning_rate_schedule(optimizer, (LearningRateSchedule){ SCHEDULE_COSINE, 0, 0, 1.0, total_steps, 0.0 });
+    return optimizer;
 }
 
-void reset_gradients(DifferentiableOperation* op) {
-    if (op->visit_state == VISITED) return;
-    op->visit_state = VISITED;
+// Softmax is monotonic, so the largest logit is the most probable class
+static int predict(const Tape* tape, const int* logit_slots, int num_classes, int lane) {
+    int predicted_class = 0;
+    double max_logit = -DBL_MAX;
+    for (int j = 0; j < num_classes; j++) {
+        double logit = tape->values[logit_slots[j] * tape->lanes + lane];
+        if (logit > max_logit) {
+            max_logit = logit;
+            predicted_class = j;
+        }
+    }
+    return predicted_class;
+}
 
-    op->grad = 0.0;
+// The trained weights as one dense layer: the samples of a batch are the
+// rows of x, and the logits are x W^T + b. The weights and biases are views
+// of the registry, so nothing is copied out of the scalar model.
+static int count_correct(Model* model, const Dataset* dataset, const double* mean, const double* scale) {
+    int num_features = model->num_features;
+    int num_classes = model->num_classes;
+    int x_shape[] = { BATCH_SIZE, num_features };
+    int weight_shape[] = { num_classes, num_features };
+    int bias_shape[] = { num_classes };
+    TensorOperation* x = create_tensor_variable(2, x_shape, NULL);
+    TensorOperation* weights = create_tensor_view(model->params, 0, 2, weight_shape);
+    TensorOperation* biases = create_tensor_view(model->params, num_classes * num_features, 1, bias_shape);
+    TensorOperation* logits = create_tensor_dense_operation(x, weights, biases, ACTIVATION_NONE);
 
-    for (int i = 0; i < op->num_inputs; i++) {
-        reset_gradients(op->inputs[i]);
+    int correct_predictions = 0;
+    for (int batch_start = 0; batch_start < dataset->num_samples; batch_start += BATCH_SIZE) {
+        DatasetBatch batch = dataset_batch(dataset, batch_start, BATCH_SIZE);
+        for (int j = 0; j < num_features; j++) {
+            const double* column = batch.features + j * batch.column_stride;
+            for (int i = 0; i < batch.count; i++) {
+                x->value[i * num_features + j] = (column[i] - mean[j]) * scale[j];
+            }
+        }
+        tensor_forward(logits);
+
+        // Rows past batch.count hold the previous batch and are ignored
+        for (int i = 0; i < batch.count; i++) {
+            const double* row = logits->value + i * num_classes;
+            int predicted_class = 0;
+            for (int j = 1; j < num_classes; j++) {
+                if (row[j] > row[predicted_class]) predicted_class = j;
+            }
+            if (predicted_class == batch.labels[i]) {
+                correct_predictions++;
+            }
+        }
     }
+    free_tensor_operation(logits);
+    return correct_predictions;
 }
 
-void update_parameters(DifferentiableOperation* op, double learning_rate) {
-    if (op->visit_state == VISITED) return;
-    op->visit_state = VISITED;
+static void train_step(Tape* tape, int worker, int first, int count, void* data) {
+    TrainingState* state = data;
+    const PackedBatch* batch = state->batch;
+    int lanes = tape->lanes;
 
-    if (op->num_inputs == 0) {  // This is a variable (weight or bias)
-        op->value -= learning_rate * op->grad;
+    // Forward pass, one lane per sample; packed batches are already in
+    // lane order
+    for (int j = 0; j < state->num_features; j++) {
+        memcpy(tape->values + state->input_slots[j] * lanes, batch->features + j * batch->stride + first,
+               count * sizeof(double));
     }
+    memcpy(tape->values + state->label_slot * lanes, batch->labels + first, count * sizeof(double));
+    tape_forward(tape);
 
-    for (int i = 0; i < op->num_inputs; i++) {
-        update_parameters(op->inputs[i], learning_rate);
+    for (int lane = 0; lane < count; lane++) {
+        // Compute loss and accuracy
+        state->loss[worker] += tape->values[state->loss_slot * lanes + lane];
+
+        if (predict(tape, state->logit_slots, state->num_classes, lane) == (int)batch->labels[first + lane]) {
+            state->correct[worker]++;
+        }
+
+        // Seed the backward pass
+        tape->grads[state->loss_slot * lanes + lane] = 1.0;
     }
+    tape_backward(tape);
 }
 
-int main() {
-    printf("Starting program...\n");
+// AUTODIFF_THREADS overrides the number of online CPUs; either way every
+// thread keeps at least MIN_LANES_PER_THREAD samples of a batch
+static int training_threads() {
+    const char* env = getenv("AUTODIFF_THREADS");
+    int threads = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > BATCH_SIZE / MIN_LANES_PER_THREAD) threads = BATCH_SIZE / MIN_LANES_PER_THREAD;
+    return threads > 0 ? threads : 1;
+}
+
+// Usage: iris_softmax_regression [dataset.bin]
+int main(int argc, char** argv) {
+    configure_instrumentation();
+    LOG(LOG_INFO, "Starting program...\n");
     srand(time(NULL));
 
-    printf("Creating model...\n");
-    DifferentiableOperation* model = create_model();
-    printf("Model created.\n");
-    printf("Model address: %p\n", (void*)model);
-    printf("Model inputs: %p\n", (void*)model->inputs);
-    printf("Number of model inputs: %d\n", model->num_inputs);
+    Dataset* dataset = argc > 1 ? open_dataset(argv[1]) : load_dataset(DATASET_PATH, DATASET_SOURCE);
+    if (!dataset) {
+        fprintf(stderr, "Failed to load dataset.\n");
+        return EXIT_FAILURE;
+    }
+    int num_samples = dataset->num_samples;
+    int num_features = dataset->num_features;
+    int num_classes = dataset->num_classes;
+    LOG(LOG_INFO, "Loaded %d samples with %d features and %d classes.\n", num_samples, num_features, num_classes);
+
+    LOG(LOG_INFO, "Creating model...\n");
+    GraphArena* arena = create_graph_arena(0);
+    bind_graph_arena(arena);
+    Model model = create_model(num_features, num_classes);
+    optimize_model(&model);
+    bind_graph_arena(NULL);
+    LOG(LOG_DEBUG, "Model created.\n");
+    LOG(LOG_DEBUG, "Model address: %p\n", (void*)model.loss);
 
     // Print information about each input
-    for (int i = 0; i < model->num_inputs; i++) {
-        printf("Input %d: %p\n", i, (void*)model->inputs[i]);
+    for (int i = 0; i < num_features; i++) {
+        LOG(LOG_DEBUG, "Input %d: %p\n", i, (void*)model.inputs[i]);
     }
 
-    // Normalize features
-    normalize_features();
+    // Compile the graph once per worker; each worker trains on its share of
+    // a minibatch with one lane per sample
+    int num_threads = training_threads();
+    int lanes = (BATCH_SIZE + num_threads - 1) / num_threads;
+    ParallelTrainer* trainer = create_parallel_trainer(&model.loss, 1, lanes, num_threads,
+                                                       model.params, PARALLEL_REDUCE);
+    if (!trainer) {
+        fprintf(stderr, "Failed to compile model.\n");
+        return EXIT_FAILURE;
+    }
+    Tape* tape = parallel_trainer_tape(trainer, 0);
+    TrainingState state;
+    state.num_features = num_features;
+    state.num_classes = num_classes;
+    state.mean = malloc(num_features * sizeof(double));
+    state.scale = malloc(num_features * sizeof(double));
+    state.input_slots = malloc(num_features * sizeof(int));
+    state.logit_slots = malloc(num_classes * sizeof(int));
+    for (int j = 0; j < num_features; j++) {
+        state.input_slots[j] = tape_index_of(tape, model.inputs[j]);
+    }
+    for (int j = 0; j < num_classes; j++) {
+        state.logit_slots[j] = tape_index_of(tape, model.logits[j]);
+    }
+    state.label_slot = tape_index_of(tape, model.label);
+    state.loss_slot = tape_index_of(tape, model.loss);
+    state.loss = malloc(num_threads * sizeof(double));
+    state.correct = malloc(num_threads * sizeof(int));
+    LOG(LOG_INFO, "Compiled tape with %d nodes and %d lanes on %d threads.\n", tape->num_nodes, lanes, num_threads);
+
+    // Batches are shuffled, normalized and packed on a background thread
+    compute_normalization(dataset, state.mean, state.scale);
+    int batches_per_epoch = (num_samples + BATCH_SIZE - 1) / BATCH_SIZE;
+    Optimizer* optimizer = create_model_optimizer(&model, EPOCHS * batches_per_epoch);
+    BatchPipeline* pipeline = create_batch_pipeline(dataset, BATCH_SIZE, PIPELINE_DEPTH, EPOCHS, state.mean,
+                                                    state.scale, rand());
+    if (!pipeline) {
+        fprintf(stderr, "Failed to start the batch pipeline.\n");
+        return EXIT_FAILURE;
+    }
 
     // Training loop
     for (int epoch = 0; epoch < EPOCHS; epoch++) {
-        double total_loss = 0.0;
-        int correct_predictions = 0;
-
-        // Shuffle the dataset
-        for (int i = 0; i < IRIS_SAMPLES; i++) {
-            int j = i + rand() / (RAND_MAX / (IRIS_SAMPLES - i) + 1);
-            IrisData temp = iris_dataset[j];
-            iris_dataset[j] = iris_dataset[i];
-            iris_dataset[i] = temp;
+        for (int w = 0; w < num_threads; w++) {
+            state.loss[w] = 0.0;
+            state.correct[w] = 0;
         }
 
-        for (int batch_start = 0; batch_start < IRIS_SAMPLES; batch_start += BATCH_SIZE) {
-            int batch_end = batch_start + BATCH_SIZE;
-            if (batch_end > IRIS_SAMPLES) batch_end = IRIS_SAMPLES;
-
-            // Reset gradients
-            reset_gradients(model);
-
-            for (int i = batch_start; i < batch_end; i++) {
-                // Forward pass
-                for (int j = 0; j < IRIS_FEATURES; j++) {
-                    model->inputs[j]->value = iris_dataset[i].features[j];
-                }
-                forward(model);
-
-                // Compute loss and accuracy
-                double loss = -log(model->inputs[iris_dataset[i].label]->value);
-                total_loss += loss;
-
-                int predicted_class = 0;
-                double max_prob = -DBL_MAX;
-                for (int j = 0; j < IRIS_CLASSES; j++) {
-                    if (model->inputs[j]->value > max_prob) {
-                        max_prob = model->inputs[j]->value;
-                        predicted_class = j;
-                    }
-                }
-                if (predicted_class == iris_dataset[i].label) {
-                    correct_predictions++;
-                }
-
-                // Backward pass
-                for (int j = 0; j < IRIS_CLASSES; j++) {
-                    model->inputs[j]->grad += (j == iris_dataset[i].label) ? -1.0 / model->inputs[j]->value : 0;
-                }
-                backward_pass();
-            }
+        for (int batch_start = 0; batch_start < num_samples; batch_start += BATCH_SIZE) {
+            int traced = tracing_enabled();
+            long long wait_start = traced ? profile_clock_ns() : 0;
+            state.batch = next_batch(pipeline);
+            int count = state.batch->count;
+            long long batch_start_ns = traced ? profile_clock_ns() : 0;
+
+            // Forward and backward on the workers, gradients reduced into the parameters
+            parallel_train_batch(trainer, 0, count, train_step, &state, 0.0);
+            release_batch(pipeline);
+            long long update_start = traced ? profile_clock_ns() : 0;
 
             // Update parameters
-            update_parameters(model, LEARNING_RATE * BATCH_SIZE / (batch_end - batch_start));
+            optimizer_update(optimizer, model.params->values, model.params->grads, 1.0 / count);
+            if (traced) {
+                trace_event("wait_for_batch", "data", wait_start, batch_start_ns);
+                trace_event("train_batch", "train", batch_start_ns, update_start);
+                trace_event("optimizer_update", "train", update_start, profile_clock_ns());
+            }
         }
 
         // Print epoch statistics
         if (epoch % 10 == 0 || epoch == EPOCHS - 1) {
-            printf("Epoch %d: Loss = %f, Accuracy = %.2f%%\n", 
-                   epoch, total_loss / IRIS_SAMPLES, 
-                   100.0 * correct_predictions / IRIS_SAMPLES);
-        }
-    }
-
-    // Test the model on the training set
-    int correct_predictions = 0;
-    for (int i = 0; i < IRIS_SAMPLES; i++) {
-        // Set input values
-        for (int j = 0; j < IRIS_FEATURES; j++) {
-            model->inputs[j]->value = iris_dataset[i].features[j];
-        }
-
-        // Forward pass
-        forward(model);
-
-        // Predict class
-        int predicted_class = 0;
-        double max_prob = -DBL_MAX;
-        for (int j = 0; j < IRIS_CLASSES; j++) {
-            if (model->inputs[j]->value > max_prob) {
-                max_prob = model->inputs[j]->value;
-                predicted_class = j;
+            double total_loss = 0.0;
+            int correct_predictions = 0;
+            for (int w = 0; w < num_threads; w++) {
+                total_loss += state.loss[w];
+                correct_predictions += state.correct[w];
             }
-        }
-        if (predicted_class == iris_dataset[i].label) {
-            correct_predictions++;
+            LOG(LOG_INFO, "Epoch %d: Loss = %f, Accuracy = %.2f%%\n", 
+                   epoch, total_loss / num_samples, 
+                   100.0 * correct_predictions / num_samples);
         }
     }
 
-    printf("\nFinal test accuracy: %.2f%%\n", 100.0 * correct_predictions / IRIS_SAMPLES);
+    // Test the model on the training set, in file order
+    int correct_predictions = count_correct(&model, dataset, state.mean, state.scale);
+
+    LOG(LOG_INFO, "\nFinal test accuracy: %.2f%%\n", 100.0 * correct_predictions / num_samples);
 
     // Generate DOT file for final model
-    printf("Generating DOT file...\n");
-    generate_dot_file(model, "iris_softmax_regression_graph.dot");
-    printf("\nFinal model graph saved to iris_softmax_regression_graph.dot\n");
+    LOG(LOG_DEBUG, "Generating DOT file...\n");
+    tape_store_results(tape);
+    GraphContext* ctx = create_graph_context();
+    generate_dot_file(ctx, model.loss, "iris_softmax_regression_graph.dot");
+    free_graph_context(ctx);
+    LOG(LOG_INFO, "\nFinal model graph saved to iris_softmax_regression_graph.dot\n");
+
+    if (profiling_enabled()) {
+        print_profile_summary(stdout);
+    }
+    if (trace_output_path() && write_chrome_trace(trace_output_path())) {
+        LOG(LOG_INFO, "Trace written to %s\n", trace_output_path());
+    }
 
     // Free memory
-    printf("Freeing memory...\n");
-    reset_visit_state(model);
-    free_operation(model);
-
-    printf("Program completed successfully.\n");
+    LOG(LOG_DEBUG, "Freeing memory...\n");
+    free_batch_pipeline(pipeline);
+    free_optimizer(optimizer);
+    free(state.mean);
+    free(state.scale);
+    free(state.input_slots);
+    free(state.logit_slots);
+    free(state.loss);
+    free(state.correct);
+    free_parallel_trainer(trainer);
+    free_model(&model);
+    free_graph_arena(arena);
+    close_dataset(dataset);
+    free_instrumentation();
+
+    LOG(LOG_INFO, "Program completed successfully.\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -1,90 +1,233 @@
 #include "operations.h"
 #include <string.h>
 
+// Scalar nodes read the values of their inputs, which tensor nodes do not
+// have; see tensor.h
+static int scalar_inputs(DifferentiableOperation* const* inputs, int num_inputs) {
+    for (int i = 0; i < num_inputs; i++) {
+        if (inputs[i] && inputs[i]->type == OP_TENSOR) {
+            fprintf(stderr, "Error: Scalar operations cannot take tensor inputs.\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
 void add_compute(DifferentiableOperation* op) {
-    op->value = op->inputs[0]->value + op->inputs[1]->value;
+    op->value = *operation_value(op->operands[0]) + *operation_value(op->operands[1]);
 }
 
-void add_backward(DifferentiableOperation* op, double grad) {
-    op->inputs[0]->grad += grad;
-    op->inputs[1]->grad += grad;
+void add_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    (void)op;
+    *input_grads[0] += grad;
+    *input_grads[1] += grad;
 }
 
 DifferentiableOperation* create_add_operation(DifferentiableOperation* a, DifferentiableOperation* b) {
-    DifferentiableOperation* op = malloc(sizeof(DifferentiableOperation));
-    op->inputs = malloc(2 * sizeof(DifferentiableOperation*));
-    op->inputs[0] = a;
-    op->inputs[1] = b;
-    op->num_inputs = 2;
-    op->compute = add_compute;
-    op->backward = add_backward;
-    op->visit_state = UNVISITED;
+    DifferentiableOperation* inputs[] = { a, b };
+    if (!scalar_inputs(inputs, 2)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_ADD, 2);
+    if (!op) {
+        return NULL;
+    }
+    op->operands[0] = a;
+    op->operands[1] = b;
     return op;
 }
 
 void mul_compute(DifferentiableOperation* op) {
-    op->value = op->inputs[0]->value * op->inputs[1]->value;
+    op->value = *operation_value(op->operands[0]) * *operation_value(op->operands[1]);
 }
 
-void mul_backward(DifferentiableOperation* op, double grad) {
-    op->inputs[0]->grad += grad * op->inputs[1]->value;
-    op->inputs[1]->grad += grad * op->inputs[0]->value;
+void mul_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    *input_grads[0] += grad * *operation_value(op->operands[1]);
+    *input_grads[1] += grad * *operation_value(op->operands[0]);
 }
 
 DifferentiableOperation* create_mul_operation(DifferentiableOperation* a, DifferentiableOperation* b) {
-    DifferentiableOperation* op = malloc(sizeof(DifferentiableOperation));
-    op->inputs = malloc(2 * sizeof(DifferentiableOperation*));
-    op->inputs[0] = a;
-    op->inputs[1] = b;
-    op->num_inputs = 2;
-    op->compute = mul_compute;
-    op->backward = mul_backward;
-    op->visit_state = UNVISITED;
+    DifferentiableOperation* inputs[] = { a, b };
+    if (!scalar_inputs(inputs, 2)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_MUL, 2);
+    if (!op) {
+        return NULL;
+    }
+    op->operands[0] = a;
+    op->operands[1] = b;
     return op;
 }
 
 void exp_compute(DifferentiableOperation* op) {
-    op->value = exp(op->inputs[0]->value);
+    op->value = exp(*operation_value(op->operands[0]));
 }
 
-void exp_backward(DifferentiableOperation* op, double grad) {
-    op->inputs[0]->grad += grad * op->value;
+void exp_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    *input_grads[0] += grad * op->value;
 }
 
 DifferentiableOperation* create_exp_operation(DifferentiableOperation* input) {
-    DifferentiableOperation* op = malloc(sizeof(DifferentiableOperation));
-    op->inputs = malloc(sizeof(DifferentiableOperation*));
-    op->inputs[0] = input;
-    op->num_inputs = 1;
-    op->compute = exp_compute;
-    op->backward = exp_backward;
-    op->visit_state = UNVISITED;
+    if (!scalar_inputs(&input, 1)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_EXP, 1);
+    if (!op) {
+        return NULL;
+    }
+    op->operands[0] = input;
     return op;
 }
 
 void softmax_compute(DifferentiableOperation* op) {
+    DifferentiableOperation** inputs = operation_inputs(op);
     double sum = 0.0;
     for (int i = 0; i < op->num_inputs; i++) {
-        sum += op->inputs[i]->value;
+        sum += *operation_value(inputs[i]);
     }
-    op->value = op->inputs[0]->value / sum;
+    op->value = *operation_value(inputs[0]) / sum;
 }
 
-void softmax_backward(DifferentiableOperation* op, double grad) {
+void softmax_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    DifferentiableOperation** inputs = operation_inputs(op);
     double softmax = op->value;
-    op->inputs[0]->grad += grad * softmax * (1 - softmax);
+    double sum = 0.0;
+    for (int i = 0; i < op->num_inputs; i++) {
+        sum += *operation_value(inputs[i]);
+    }
+    *input_grads[0] += grad * (1 - softmax) / sum;
     for (int i = 1; i < op->num_inputs; i++) {
-        op->inputs[i]->grad += grad * (-softmax * op->inputs[i]->value / op->inputs[0]->value);
+        *input_grads[i] -= grad * softmax / sum;
     }
 }
 
 DifferentiableOperation* create_softmax_operation(DifferentiableOperation** inputs, int num_inputs) {
-    DifferentiableOperation* op = malloc(sizeof(DifferentiableOperation));
-    op->inputs = malloc(num_inputs * sizeof(DifferentiableOperation*));
-    memcpy(op->inputs, inputs, num_inputs * sizeof(DifferentiableOperation*));
-    op->num_inputs = num_inputs;
-    op->compute = softmax_compute;
-    op->backward = softmax_backward;
-    op->visit_state = UNVISITED;
+    if (!scalar_inputs(inputs, num_inputs)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_SOFTMAX, num_inputs);
+    if (!op) {
+        return NULL;
+    }
+    memcpy(operation_inputs(op), inputs, num_inputs * sizeof(DifferentiableOperation*));
     return op;
-}
\ No newline at end of file
+}
+
+void invalid_label(double label, int num_classes) {
+    fprintf(stderr, "Error: Label %g is not a class index in [0, %d).\n", label, num_classes);
+    abort();
+}
+
+static double log_sum_exp(DifferentiableOperation** logits, int num_classes) {
+    double max = *operation_value(logits[0]);
+    for (int i = 1; i < num_classes; i++) {
+        if (*operation_value(logits[i]) > max) max = *operation_value(logits[i]);
+    }
+    double sum = 0.0;
+    for (int i = 0; i < num_classes; i++) {
+        sum += exp(*operation_value(logits[i]) - max);
+    }
+    return max + log(sum);
+}
+
+// Inputs are the logits followed by the label variable
+void softmax_cross_entropy_compute(DifferentiableOperation* op) {
+    DifferentiableOperation** inputs = operation_inputs(op);
+    int num_classes = op->num_inputs - 1;
+    int label = checked_label(*operation_value(inputs[num_classes]), num_classes);
+    op->value = log_sum_exp(inputs, num_classes) - *operation_value(inputs[label]);
+}
+
+// d loss / d z_i = p_i - [i == label], with log p_i = z_i - lse
+void softmax_cross_entropy_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    DifferentiableOperation** inputs = operation_inputs(op);
+    int num_classes = op->num_inputs - 1;
+    int label = checked_label(*operation_value(inputs[num_classes]), num_classes);
+    double lse = op->value + *operation_value(inputs[label]);
+    for (int i = 0; i < num_classes; i++) {
+        *input_grads[i] += grad * exp(*operation_value(inputs[i]) - lse);
+    }
+    *input_grads[label] -= grad;
+}
+
+DifferentiableOperation* create_softmax_cross_entropy_operation(DifferentiableOperation** logits, int num_classes,
+                                                                DifferentiableOperation* label) {
+    if (!scalar_inputs(logits, num_classes) || !scalar_inputs(&label, 1)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_SOFTMAX_CROSS_ENTROPY, num_classes + 1);
+    if (!op) {
+        return NULL;
+    }
+    DifferentiableOperation** inputs = operation_inputs(op);
+    memcpy(inputs, logits, num_classes * sizeof(DifferentiableOperation*));
+    inputs[num_classes] = label;
+    return op;
+}
+
+void sum_compute(DifferentiableOperation* op) {
+    DifferentiableOperation** inputs = operation_inputs(op);
+    double sum = 0.0;
+    for (int i = 0; i < op->num_inputs; i++) {
+        sum += *operation_value(inputs[i]);
+    }
+    op->value = sum;
+}
+
+void sum_backward(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    for (int i = 0; i < op->num_inputs; i++) {
+        *input_grads[i] += grad;
+    }
+}
+
+DifferentiableOperation* create_sum_operation(DifferentiableOperation** inputs, int num_inputs) {
+    if (!scalar_inputs(inputs, num_inputs)) {
+        return NULL;
+    }
+    DifferentiableOperation* op = alloc_operation(OP_SUM, num_inputs);
+    if (!op) {
+        return NULL;
+    }
+    memcpy(operation_inputs(op), inputs, num_inputs * sizeof(DifferentiableOperation*));
+    return op;
+}
+
+void compute_operation(DifferentiableOperation* op) {
+    switch (op->type) {
+    case OP_ADD: add_compute(op); break;
+    case OP_MUL: mul_compute(op); break;
+    case OP_EXP: exp_compute(op); break;
+    case OP_SOFTMAX: softmax_compute(op); break;
+    case OP_SOFTMAX_CROSS_ENTROPY: softmax_cross_entropy_compute(op); break;
+    case OP_SUM: sum_compute(op); break;
+    case OP_TENSOR: fprintf(stderr, "Error: Tensor nodes run through tensor_forward(), not forward().\n"); break;
+    default: break;
+    }
+}
+
+void backward_operation(DifferentiableOperation* op, double grad, double* const* input_grads) {
+    switch (op->type) {
+    case OP_ADD: add_backward(op, grad, input_grads); break;
+    case OP_MUL: mul_backward(op, grad, input_grads); break;
+    case OP_EXP: exp_backward(op, grad, input_grads); break;
+    case OP_SOFTMAX: softmax_backward(op, grad, input_grads); break;
+    case OP_SOFTMAX_CROSS_ENTROPY: softmax_cross_entropy_backward(op, grad, input_grads); break;
+    case OP_SUM: sum_backward(op, grad, input_grads); break;
+    case OP_TENSOR: fprintf(stderr, "Error: Tensor nodes run through tensor_backward(), not backward_pass().\n"); break;
+    default: break;
+    }
+}
+
+const char* operation_name(const DifferentiableOperation* op) {
+    switch (op->type) {
+    case OP_ADD: return "+";
+    case OP_MUL: return "*";
+    case OP_EXP: return "exp";
+    case OP_SOFTMAX: return "softmax";
+    case OP_SOFTMAX_CROSS_ENTROPY: return "softmax_xent";
+    case OP_SUM: return "sum";
+    case OP_TENSOR: return "tensor";
+    default: return op->constant ? "const" : "var";
+    }
+}
@@ -8,11 +8,37 @@ void add_compute(DifferentiableOperation* op);
 void mul_compute(DifferentiableOperation* op);
 void exp_compute(DifferentiableOperation* op);
 void softmax_compute(DifferentiableOperation* op);
+void softmax_cross_entropy_compute(DifferentiableOperation* op);
+void sum_compute(DifferentiableOperation* op);
+
+// Class index held by the label input of a softmax cross-entropy node.
+// Every evaluator goes through here: a label outside [0, num_classes), or
+// NaN, would index past the logits, so it aborts with an error instead.
+_Noreturn void invalid_label(double label, int num_classes);
+static inline int checked_label(double label, int num_classes) {
+    if (!(label >= 0.0 && label < num_classes)) {
+        invalid_label(label, num_classes);
+    }
+    return (int)label;
+}
+
+// Dispatch on the node's type tag. backward_operation() adds the
+// contributions of op, whose grad is grad, to *input_grads[k] for its k-th
+// input.
+void compute_operation(DifferentiableOperation* op);
+void backward_operation(DifferentiableOperation* op, double grad, double* const* input_grads);
+const char* operation_name(const DifferentiableOperation* op);
 
 // Creation functions
 DifferentiableOperation* create_add_operation(DifferentiableOperation* a, DifferentiableOperation* b);
 DifferentiableOperation* create_mul_operation(DifferentiableOperation* a, DifferentiableOperation* b);
 DifferentiableOperation* create_exp_operation(DifferentiableOperation* input);
 DifferentiableOperation* create_softmax_operation(DifferentiableOperation** inputs, int num_inputs);
+// n-ary add, mostly produced by optimize_graph() from chains of binary adds
+DifferentiableOperation* create_sum_operation(DifferentiableOperation** inputs, int num_inputs);
+// -log(softmax(logits)[label]), computed with log-sum-exp. label is a
+// variable holding the class index; it receives no gradient.
+DifferentiableOperation* create_softmax_cross_entropy_operation(DifferentiableOperation** logits, int num_classes,
+                                                                DifferentiableOperation* label);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "differentiable_operation.h"
+
+// First-order optimizers over an explicit list of parameters. Each step
+// gathers the parameters' values and grads into contiguous arrays, runs one
+// fused loop that updates the values together with the optimizer state
+// (also contiguous, one entry per parameter) and writes the values back.
+// optimizer_update() runs the same loop on arrays the caller already has,
+// such as those of a ParameterRegistry.
+//
+//   OPTIMIZER_SGD       p -= lr * g
+//   OPTIMIZER_MOMENTUM  v = momentum * v + g; p -= lr * v
+//                       (p -= lr * (g + momentum * v) with nesterov)
+//   OPTIMIZER_ADAM      bias-corrected Adam; weight_decay adds an L2 term
+//                       to the gradient, as it does for SGD
+//   OPTIMIZER_ADAMW     Adam with decoupled weight decay: p -= lr * wd * p
+typedef enum {
+    OPTIMIZER_SGD,
+    OPTIMIZER_MOMENTUM,
+    OPTIMIZER_ADAM,
+    OPTIMIZER_ADAMW
+} OptimizerType;
+
+typedef struct {
+    OptimizerType type;
+    double learning_rate;
+    double momentum;
+    int nesterov;
+    double beta1;
+    double beta2;
+    double epsilon;
+    double weight_decay;
+} OptimizerConfig;
+
+// Learning rate at step t (counted from 0) for a base rate lr:
+//   SCHEDULE_CONSTANT  lr
+//   SCHEDULE_STEP      lr * gamma^floor(t / step_size)
+//   SCHEDULE_COSINE    cosine decay from lr to min_learning_rate over
+//                      total_steps, then min_learning_rate
+// The first warmup_steps steps of any schedule ramp up linearly from
+// lr / warmup_steps, and the decay starts after them.
+typedef enum {
+    SCHEDULE_CONSTANT,
+    SCHEDULE_STEP,
+    SCHEDULE_COSINE
+} ScheduleType;
+
+typedef struct {
+    ScheduleType type;
+    int warmup_steps;
+    int step_size;
+    double gamma;
+    int total_steps;
+    double min_learning_rate;
+} LearningRateSchedule;
+
+typedef struct Optimizer Optimizer;
+
+// Defaults of the common libraries: momentum 0.9, betas 0.9 and 0.999,
+// epsilon 1e-8, weight decay 0.01 for AdamW and 0 otherwise
+OptimizerConfig default_optimizer_config(OptimizerType type, double learning_rate);
+// Parameters must be variables (nodes without inputs)
+Optimizer* create_optimizer(DifferentiableOperation** params, int num_params, OptimizerConfig config);
+void set_learning_rate_schedule(Optimizer* optimizer, LearningRateSchedule schedule);
+// Learning rate of the next step
+double optimizer_learning_rate(const Optimizer* optimizer);
+int optimizer_steps(const Optimizer* optimizer);
+// One update from the grads of the parameters, multiplied by grad_scale
+// first (e.g. 1 / batch size for a summed loss)
+void optimizer_step(Optimizer* optimizer, double grad_scale);
+// The same update on the caller's arrays of num_params values and grads
+void optimizer_update(Optimizer* optimizer, double* values, const double* grads, double grad_scale);
+void free_optimizer(Optimizer* optimizer);
+
+#endif
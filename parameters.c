@@ -0,0 +1,100 @@
+#include "parameters.h"
+#include <stdint.h>
+#include <string.h>
+
+static double* alloc_parameter_array(int capacity) {
+    size_t size = (size_t)capacity * sizeof(double);
+    size = (size + PARAMETER_ALIGNMENT - 1) / PARAMETER_ALIGNMENT * PARAMETER_ALIGNMENT;
+    return aligned_alloc(PARAMETER_ALIGNMENT, size > 0 ? size : PARAMETER_ALIGNMENT);
+}
+
+ParameterRegistry* create_parameter_registry(int capacity) {
+    if (capacity < 1) capacity = 16;
+    ParameterRegistry* registry = malloc(sizeof(ParameterRegistry));
+    registry->num_params = 0;
+    registry->capacity = capacity;
+    registry->values = alloc_parameter_array(capacity);
+    registry->grads = alloc_parameter_array(capacity);
+    registry->nodes = malloc(capacity * sizeof(DifferentiableOperation*));
+    return registry;
+}
+
+static void point_at_registry(ParameterRegistry* registry, int p) {
+    registry->nodes[p]->value_slot = &registry->values[p];
+    registry->nodes[p]->grad_slot = &registry->grads[p];
+}
+
+static void grow_registry(ParameterRegistry* registry) {
+    int capacity = 2 * registry->capacity;
+    double* values = alloc_parameter_array(capacity);
+    double* grads = alloc_parameter_array(capacity);
+    memcpy(values, registry->values, registry->num_params * sizeof(double));
+    memcpy(grads, registry->grads, registry->num_params * sizeof(double));
+    free(registry->values);
+    free(registry->grads);
+    registry->values = values;
+    registry->grads = grads;
+    registry->nodes = realloc(registry->nodes, capacity * sizeof(DifferentiableOperation*));
+    registry->capacity = capacity;
+    for (int p = 0; p < registry->num_params; p++) {
+        point_at_registry(registry, p);
+    }
+}
+
+DifferentiableOperation* create_parameter(ParameterRegistry* registry, double value) {
+    if (registry->num_params == registry->capacity) {
+        grow_registry(registry);
+    }
+    int p = registry->num_params++;
+    DifferentiableOperation* var = create_variable(value);
+    var->parameter = 1;
+    registry->values[p] = value;
+    registry->grads[p] = 0.0;
+    registry->nodes[p] = var;
+    point_at_registry(registry, p);
+    return var;
+}
+
+int parameter_index(const ParameterRegistry* registry, const DifferentiableOperation* op) {
+    // A parameter's value slot is its place in the registry's values
+    uintptr_t offset = (uintptr_t)op->value_slot - (uintptr_t)registry->values;
+    if (!op->parameter || offset / sizeof(double) >= (uintptr_t)registry->num_params) return -1;
+    int p = (int)(offset / sizeof(double));
+    return registry->nodes[p] == op ? p : -1;
+}
+
+void zero_parameter_grads(ParameterRegistry* registry) {
+    memset(registry->grads, 0, registry->num_params * sizeof(double));
+}
+
+void parameter_axpy(ParameterRegistry* registry, double alpha) {
+    double* restrict values = registry->values;
+    const double* restrict grads = registry->grads;
+    for (int p = 0; p < registry->num_params; p++) {
+        values[p] += alpha * grads[p];
+    }
+}
+
+void snapshot_parameters(const ParameterRegistry* registry, double* values) {
+    memcpy(values, registry->values, registry->num_params * sizeof(double));
+}
+
+void restore_parameters(ParameterRegistry* registry, const double* values) {
+    memcpy(registry->values, values, registry->num_params * sizeof(double));
+}
+
+void copy_parameters(ParameterRegistry* dst, const ParameterRegistry* src) {
+    if (dst->num_params != src->num_params) {
+        fprintf(stderr, "Error: Cannot copy %d parameters into a registry of %d.\n", src->num_params,
+                dst->num_params);
+        return;
+    }
+    restore_parameters(dst, src->values);
+}
+
+void free_parameter_registry(ParameterRegistry* registry) {
+    free(registry->values);
+    free(registry->grads);
+    free(registry->nodes);
+    free(registry);
+}
@@ -0,0 +1,46 @@
+#ifndef PARAMETERS_H
+#define PARAMETERS_H
+
+#include "differentiable_operation.h"
+
+// Flat storage for the trainable variables of a model. Parameter p keeps
+// its value and grad in values[p] and grads[p], two contiguous arrays
+// aligned to PARAMETER_ALIGNMENT bytes. Trainers and optimizers read and write these arrays,
+// so clearing the grads is one memset, an SGD step one axpy, and a
+// checkpoint of the model one memcpy, none of which walks the graph.
+//
+// The node has no copy of its own: its value and grad pointers lead into
+// the arrays, and are moved along when the registry grows. Code that
+// evaluates nodes directly (forward(), tape_load_variables(), code
+// generation) therefore always sees the current parameters, for as long as
+// the registry lives.
+#define PARAMETER_ALIGNMENT 64
+
+typedef struct {
+    int num_params;
+    int capacity;
+    double* values;
+    double* grads;
+    DifferentiableOperation** nodes;
+} ParameterRegistry;
+
+ParameterRegistry* create_parameter_registry(int capacity);
+// Creates a variable holding value and registers it. Registering may move
+// the arrays, so do not keep pointers into them across this call.
+DifferentiableOperation* create_parameter(ParameterRegistry* registry, double value);
+// Index of a registered variable, or -1
+int parameter_index(const ParameterRegistry* registry, const DifferentiableOperation* op);
+
+void zero_parameter_grads(ParameterRegistry* registry);
+// values += alpha * grads
+void parameter_axpy(ParameterRegistry* registry, double alpha);
+
+// Bulk copies of all values, e.g. for keeping the best model seen so far.
+// copy_parameters() requires registries of the same size.
+void snapshot_parameters(const ParameterRegistry* registry, double* values);
+void restore_parameters(ParameterRegistry* registry, const double* values);
+void copy_parameters(ParameterRegistry* dst, const ParameterRegistry* src);
+// Frees the registry; the nodes belong to their graph
+void free_parameter_registry(ParameterRegistry* registry);
+
+#endif
@@ -0,0 +1,182 @@
+#include "profiler.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+
+LogLevel active_log_level = LOG_INFO;
+int profiling_active = 0;
+
+static const char* level_names[] = { "error", "warn", "info", "debug", "trace" };
+static const char* type_names[NUM_OPERATION_TYPES] = { "variable", "add", "mul", "exp", "softmax", "softmax_xent", "sum", "tensor" };
+
+void log_message(LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(level <= LOG_WARN ? stderr : stdout, format, args);
+    va_end(args);
+}
+
+void set_log_level(LogLevel level) {
+    active_log_level = level;
+}
+
+// Counters shared by all threads; each sweep adds its totals once
+static _Atomic long long op_counters[NUM_OPERATION_TYPES][4];
+static _Atomic long long pass_counters[4];  // Forward and backward passes, then nodes
+
+typedef struct {
+    const char* name;
+    const char* category;
+    long long start_ns;
+    long long duration_ns;
+    long long nodes;  // -1 when not a sweep
+    int thread;
+} TraceEvent;
+
+static TraceEvent* trace_events = NULL;
+static int trace_capacity = 0;
+static _Atomic long long trace_count = 0;
+static _Atomic int next_thread_id = 0;
+static _Thread_local int thread_id = -1;
+static long long trace_origin_ns = 0;
+static const char* trace_path = NULL;
+
+void configure_instrumentation() {
+    const char* level = getenv("AUTODIFF_LOG");
+    for (int l = LOG_ERROR; level && l <= LOG_TRACE; l++) {
+        if (strcmp(level, level_names[l]) == 0) set_log_level(l);
+    }
+    if (getenv("AUTODIFF_PROFILE")) {
+        enable_profiling(1);
+    }
+    trace_path = getenv("AUTODIFF_TRACE");
+    if (trace_path && *trace_path) {
+        enable_profiling(1);
+        enable_tracing(0);
+    } else {
+        trace_path = NULL;
+    }
+}
+
+void enable_profiling(int enabled) {
+    profiling_active = enabled;
+}
+
+void reset_profile() {
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        for (int k = 0; k < 4; k++) atomic_store(&op_counters[t][k], 0);
+    }
+    for (int k = 0; k < 4; k++) atomic_store(&pass_counters[k], 0);
+}
+
+void profile_snapshot(ProfileSummary* summary) {
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        summary->ops[t].forward_calls = atomic_load(&op_counters[t][0]);
+        summary->ops[t].backward_calls = atomic_load(&op_counters[t][1]);
+        summary->ops[t].forward_ns = atomic_load(&op_counters[t][2]);
+        summary->ops[t].backward_ns = atomic_load(&op_counters[t][3]);
+    }
+    summary->forward_passes = atomic_load(&pass_counters[0]);
+    summary->backward_passes = atomic_load(&pass_counters[1]);
+    summary->forward_nodes = atomic_load(&pass_counters[2]);
+    summary->backward_nodes = atomic_load(&pass_counters[3]);
+}
+
+void begin_profile_pass(ProfilePass* pass) {
+    memset(pass, 0, sizeof(ProfilePass));
+    pass->start_ns = profile_clock_ns();
+}
+
+static void record_trace_event(const char* name, const char* category, long long start_ns, long long end_ns,
+                               long long nodes) {
+    if (!trace_events) return;
+    long long i = atomic_fetch_add_explicit(&trace_count, 1, memory_order_relaxed);
+    if (i >= trace_capacity) return;  // Counted as dropped
+    if (thread_id < 0) thread_id = atomic_fetch_add(&next_thread_id, 1);
+    trace_events[i] = (TraceEvent){ name, category, start_ns, end_ns - start_ns, nodes, thread_id };
+}
+
+void end_profile_pass(ProfilePass* pass, int backward, const char* name) {
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        if (pass->calls[t] == 0) continue;
+        atomic_fetch_add_explicit(&op_counters[t][backward], pass->calls[t], memory_order_relaxed);
+        atomic_fetch_add_explicit(&op_counters[t][2 + backward], pass->ns[t], memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&pass_counters[backward], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pass_counters[2 + backward], pass->nodes, memory_order_relaxed);
+    record_trace_event(name, backward ? "backward" : "forward", pass->start_ns, profile_clock_ns(), pass->nodes);
+}
+
+void print_profile_summary(FILE* out) {
+    ProfileSummary s;
+    profile_snapshot(&s);
+    long long total_ns = 0;
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        total_ns += s.ops[t].forward_ns + s.ops[t].backward_ns;
+    }
+
+    fprintf(out, "%-14s %12s %12s %10s %12s %12s %10s %7s\n", "operation", "fwd calls", "fwd ms", "fwd ns/op",
+            "bwd calls", "bwd ms", "bwd ns/op", "share");
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        const OperationProfile* op = &s.ops[t];
+        if (op->forward_calls == 0 && op->backward_calls == 0) continue;
+        fprintf(out, "%-14s %12lld %12.3f %10.1f %12lld %12.3f %10.1f %6.1f%%\n", type_names[t], op->forward_calls,
+                op->forward_ns / 1e6, op->forward_calls ? (double)op->forward_ns / op->forward_calls : 0.0,
+                op->backward_calls, op->backward_ns / 1e6,
+                op->backward_calls ? (double)op->backward_ns / op->backward_calls : 0.0,
+                total_ns ? 100.0 * (op->forward_ns + op->backward_ns) / total_ns : 0.0);
+    }
+    fprintf(out, "%lld forward passes (%.1f nodes each), %lld backward passes (%.1f nodes each)\n",
+            s.forward_passes, s.forward_passes ? (double)s.forward_nodes / s.forward_passes : 0.0,
+            s.backward_passes, s.backward_passes ? (double)s.backward_nodes / s.backward_passes : 0.0);
+}
+
+void enable_tracing(int capacity) {
+    free(trace_events);
+    trace_capacity = capacity > 0 ? capacity : DEFAULT_TRACE_EVENTS;
+    trace_events = malloc(trace_capacity * sizeof(TraceEvent));
+    atomic_store(&trace_count, 0);
+    trace_origin_ns = profile_clock_ns();
+}
+
+int tracing_enabled() {
+    return trace_events != NULL;
+}
+
+void trace_event(const char* name, const char* category, long long start_ns, long long end_ns) {
+    record_trace_event(name, category, start_ns, end_ns, -1);
+}
+
+// Complete ("X") events with microsecond timestamps relative to
+// enable_tracing()
+int write_chrome_trace(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", path);
+        return 0;
+    }
+    long long recorded = atomic_load(&trace_count);
+    int count = recorded < trace_capacity ? (int)recorded : trace_capacity;
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (int i = 0; i < count; i++) {
+        const TraceEvent* e = &trace_events[i];
+        fprintf(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                e->name, e->category, (e->start_ns - trace_origin_ns) / 1e3, e->duration_ns / 1e3, e->thread);
+        if (e->nodes >= 0) {
+            fprintf(out, ",\"args\":{\"nodes\":%lld}", e->nodes);
+        }
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"dropped_events\":%lld}}\n", recorded - count);
+    return fclose(out) == 0;
+}
+
+const char* trace_output_path() {
+    return trace_path;
+}
+
+void free_instrumentation() {
+    free(trace_events);
+    trace_events = NULL;
+    trace_capacity = 0;
+}
@@ -0,0 +1,107 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <time.h>
+#include "differentiable_operation.h"
+
+// Logging. Messages above AUTODIFF_LOG_LEVEL are compiled out; the rest
+// are filtered at runtime against set_log_level(), or AUTODIFF_LOG
+// ("error", "warn", "info", "debug" or "trace") read by
+// configure_instrumentation(). Per-node messages use LOG_TRACE, which the
+// default build removes, so the sweeps never do I/O.
+typedef enum { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG, LOG_TRACE } LogLevel;
+
+#ifndef AUTODIFF_LOG_LEVEL
+#define AUTODIFF_LOG_LEVEL LOG_DEBUG
+#endif
+
+extern LogLevel active_log_level;
+
+#define LOG(level, ...)                                                           \
+    do {                                                                          \
+        if ((level) <= AUTODIFF_LOG_LEVEL && (level) <= active_log_level) {       \
+            log_message(level, __VA_ARGS__);                                      \
+        }                                                                         \
+    } while (0)
+
+// Errors and warnings go to stderr, everything else to stdout
+void log_message(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void set_log_level(LogLevel level);
+
+// Profiling. While enabled, every tape sweep times each node it runs and
+// adds the results to per-operation-type counters; when disabled, a sweep
+// pays one branch. With tracing on, each sweep and each span passed to
+// trace_event() is also recorded for a Chrome trace (chrome://tracing or
+// Perfetto). Counters are merged once per sweep, so worker threads can
+// profile concurrently.
+//
+// configure_instrumentation() also enables profiling when AUTODIFF_PROFILE
+// is set, and tracing when AUTODIFF_TRACE names the output file.
+#define NUM_OPERATION_TYPES (OP_TENSOR + 1)
+#define DEFAULT_TRACE_EVENTS 65536
+
+typedef struct {
+    long long forward_calls;
+    long long backward_calls;
+    long long forward_ns;
+    long long backward_ns;
+} OperationProfile;
+
+typedef struct {
+    OperationProfile ops[NUM_OPERATION_TYPES];
+    long long forward_passes;
+    long long backward_passes;
+    long long forward_nodes;
+    long long backward_nodes;
+} ProfileSummary;
+
+// Per-sweep accumulator, kept on the stack of the sweeping thread
+typedef struct {
+    long long start_ns;
+    long long nodes;
+    long long calls[NUM_OPERATION_TYPES];
+    long long ns[NUM_OPERATION_TYPES];
+} ProfilePass;
+
+extern int profiling_active;
+
+static inline int profiling_enabled() {
+    return profiling_active;
+}
+
+static inline long long profile_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void configure_instrumentation();
+void enable_profiling(int enabled);
+void reset_profile();
+void profile_snapshot(ProfileSummary* summary);
+
+void begin_profile_pass(ProfilePass* pass);
+// Charges the time since start_ns to one node of the given type
+static inline void profile_node(ProfilePass* pass, int type, long long start_ns) {
+    pass->calls[type]++;
+    pass->ns[type] += profile_clock_ns() - start_ns;
+    pass->nodes++;
+}
+// name must outlive the trace, e.g. a string literal
+void end_profile_pass(ProfilePass* pass, int backward, const char* name);
+
+// Table of calls, total and mean time per operation type, and nodes per pass
+void print_profile_summary(FILE* out);
+
+// Tracing keeps up to capacity events (0 for DEFAULT_TRACE_EVENTS) and
+// counts the ones it has to drop. Span names must outlive the trace.
+void enable_tracing(int capacity);
+int tracing_enabled();
+void trace_event(const char* name, const char* category, long long start_ns, long long end_ns);
+int write_chrome_trace(const char* path);
+// Output file named by AUTODIFF_TRACE, or NULL
+const char* trace_output_path();
+void free_instrumentation();
+
+#endif
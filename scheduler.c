@@ -0,0 +1,325 @@
+#include "scheduler.h"
+#include "kernels.h"
+#include "profiler.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    TapeScheduler* scheduler;
+    int index;
+} SchedulerWorker;
+
+struct TapeScheduler {
+    Tape* tape;
+    int num_workers;
+    int grain_size;
+    int num_levels;
+    int* level_start;  // Slots of level L are level_slots[level_start[L] .. level_start[L + 1])
+    int* level_slots;
+    int* consumer_start;  // Edges reading slot i are consumer_edges[consumer_start[i] .. consumer_start[i + 1])
+    int* consumer_edges;
+    int* edge_ids;  // Identity map, the backward targets of a slot's own edges
+    double* edge_grads;  // One adjoint per edge and lane
+    double* scratch;  // Three values per lane for every worker
+
+    // Tasks [begin, end) of the current level owned by each worker, packed
+    // as begin | end << 32. The owner takes from the front, thieves from the back.
+    _Atomic uint64_t* tasks;
+
+    pthread_t* threads;  // Workers 1 .. num_workers - 1
+    SchedulerWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int job;  // Bumped for every parallel level
+    int pending;
+    int shutdown;
+
+    // The level being run
+    int level;
+    int backward;
+
+    // While a sweep is profiled, each worker times its nodes into its own
+    // pass; they are merged into passes[0] when the sweep ends
+    int profiled;
+    ProfilePass* passes;
+};
+
+static int all_zero(const double* x, int n) {
+    for (int l = 0; l < n; l++) {
+        if (x[l] != 0.0) return 0;
+    }
+    return 1;
+}
+
+static uint64_t pack_tasks(uint32_t begin, uint32_t end) {
+    return (uint64_t)begin | (uint64_t)end << 32;
+}
+
+static int take_task(_Atomic uint64_t* tasks, int from_back) {
+    uint64_t range = atomic_load(tasks);
+    for (;;) {
+        uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+        if (begin >= end) return -1;
+        uint64_t rest = from_back ? pack_tasks(begin, end - 1) : pack_tasks(begin + 1, end);
+        if (atomic_compare_exchange_weak(tasks, &range, rest)) {
+            return from_back ? (int)end - 1 : (int)begin;
+        }
+    }
+}
+
+// Incoming edges are summed into the slot's grad first; all consumers sit
+// on higher levels, so their contributions are complete. Returns whether
+// the slot propagated anything.
+static int backward_slot(TapeScheduler* scheduler, int i, double* scratch) {
+    const KernelTable* k = kernels();
+    Tape* tape = scheduler->tape;
+    int lanes = tape->lanes;
+    double* g = tape->grads + (size_t)i * lanes;
+
+    for (int c = scheduler->consumer_start[i]; c < scheduler->consumer_start[i + 1]; c++) {
+        double* edge = scheduler->edge_grads + (size_t)scheduler->consumer_edges[c] * lanes;
+        k->add(g, g, edge, lanes);
+        memset(edge, 0, lanes * sizeof(double));
+    }
+    if (tape->opcodes[i] == OP_VARIABLE || all_zero(g, lanes)) {
+        return 0;
+    }
+    tape_backward_node(tape, i, scheduler->edge_grads, scheduler->edge_ids + tape->input_start[i], scratch);
+    memset(g, 0, lanes * sizeof(double));
+    return 1;
+}
+
+// pass is the worker's ProfilePass, or NULL when not profiling
+static void run_slots(TapeScheduler* scheduler, int first, int last, double* scratch, ProfilePass* pass) {
+    const unsigned char* opcodes = scheduler->tape->opcodes;
+    for (int s = first; s < last; s++) {
+        int i = scheduler->level_slots[s];
+        long long start = pass ? profile_clock_ns() : 0;
+        int ran;
+        if (scheduler->backward) {
+            ran = backward_slot(scheduler, i, scratch);
+        } else {
+            tape_forward_node(scheduler->tape, i, scratch);
+            ran = opcodes[i] != OP_VARIABLE;
+        }
+        if (pass && ran) profile_node(pass, opcodes[i], start);
+    }
+}
+
+// With tracing on, each worker's share of a level is a span of its own
+static void run_level(TapeScheduler* scheduler, int w) {
+    double* scratch = scheduler->scratch + (size_t)w * 3 * scheduler->tape->lanes;
+    ProfilePass* pass = scheduler->profiled ? &scheduler->passes[w] : NULL;
+    long long level_start_ns = pass ? profile_clock_ns() : 0;
+    int level_first = scheduler->level_start[scheduler->level];
+    int level_last = scheduler->level_start[scheduler->level + 1];
+
+    for (;;) {
+        int task = take_task(&scheduler->tasks[w], 0);
+        for (int v = 1; task < 0 && v < scheduler->num_workers; v++) {
+            task = take_task(&scheduler->tasks[(w + v) % scheduler->num_workers], 1);
+        }
+        // Tasks are only dealt out before a level starts, so once every
+        // range is empty the level is finished
+        if (task < 0) break;
+        int first = level_first + task * scheduler->grain_size;
+        int last = first + scheduler->grain_size < level_last ? first + scheduler->grain_size : level_last;
+        run_slots(scheduler, first, last, scratch, pass);
+    }
+    if (pass && tracing_enabled()) {
+        trace_event("scheduled_level", scheduler->backward ? "backward" : "forward", level_start_ns,
+                    profile_clock_ns());
+    }
+}
+
+static void* worker_main(void* arg) {
+    SchedulerWorker* worker = arg;
+    TapeScheduler* scheduler = worker->scheduler;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+    for (;;) {
+        while (scheduler->job == seen && !scheduler->shutdown) {
+            pthread_cond_wait(&scheduler->start, &scheduler->lock);
+        }
+        if (scheduler->shutdown) break;
+        seen = scheduler->job;
+        pthread_mutex_unlock(&scheduler->lock);
+
+        run_level(scheduler, worker->index);
+
+        pthread_mutex_lock(&scheduler->lock);
+        if (--scheduler->pending == 0) {
+            pthread_cond_signal(&scheduler->done);
+        }
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+TapeScheduler* create_tape_scheduler(Tape* tape, int num_threads, int grain_size) {
+    if (num_threads < 1) {
+        fprintf(stderr, "Error: A scheduler needs at least one thread.\n");
+        return NULL;
+    }
+    int n = tape->num_nodes;
+    int num_edges = tape->input_start[n];
+    const int* start = tape->input_start;
+    const int* in = tape->input_indices;
+
+    TapeScheduler* scheduler = malloc(sizeof(TapeScheduler));
+    scheduler->tape = tape;
+    scheduler->num_workers = num_threads;
+    scheduler->grain_size = grain_size > 0 ? grain_size : DEFAULT_GRAIN_SIZE;
+
+    // Inputs precede their consumers on the tape, so one ascending sweep
+    // assigns every level
+    int* level = malloc((n > 0 ? n : 1) * sizeof(int));
+    scheduler->num_levels = 0;
+    for (int i = 0; i < n; i++) {
+        level[i] = 0;
+        for (int e = start[i]; e < start[i + 1]; e++) {
+            if (level[in[e]] + 1 > level[i]) level[i] = level[in[e]] + 1;
+        }
+        if (level[i] + 1 > scheduler->num_levels) scheduler->num_levels = level[i] + 1;
+    }
+    scheduler->level_start = calloc(scheduler->num_levels + 1, sizeof(int));
+    scheduler->level_slots = malloc((n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++) scheduler->level_start[level[i] + 1]++;
+    for (int l = 0; l < scheduler->num_levels; l++) scheduler->level_start[l + 1] += scheduler->level_start[l];
+    int* fill = malloc((scheduler->num_levels + 1) * sizeof(int));
+    memcpy(fill, scheduler->level_start, (scheduler->num_levels + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) scheduler->level_slots[fill[level[i]]++] = i;
+    free(fill);
+    free(level);
+
+    scheduler->consumer_start = calloc(n + 1, sizeof(int));
+    scheduler->consumer_edges = malloc((num_edges > 0 ? num_edges : 1) * sizeof(int));
+    scheduler->edge_ids = malloc((num_edges > 0 ? num_edges : 1) * sizeof(int));
+    for (int e = 0; e < num_edges; e++) {
+        scheduler->consumer_start[in[e] + 1]++;
+        scheduler->edge_ids[e] = e;
+    }
+    for (int i = 0; i < n; i++) scheduler->consumer_start[i + 1] += scheduler->consumer_start[i];
+    fill = malloc((n + 1) * sizeof(int));
+    memcpy(fill, scheduler->consumer_start, (n + 1) * sizeof(int));
+    for (int e = 0; e < num_edges; e++) scheduler->consumer_edges[fill[in[e]]++] = e;
+    free(fill);
+
+    scheduler->edge_grads = calloc((size_t)(num_edges > 0 ? num_edges : 1) * tape->lanes, sizeof(double));
+    scheduler->scratch = malloc((size_t)num_threads * 3 * tape->lanes * sizeof(double));
+    scheduler->passes = malloc(num_threads * sizeof(ProfilePass));
+    scheduler->tasks = malloc(num_threads * sizeof(_Atomic uint64_t));
+    for (int w = 0; w < num_threads; w++) atomic_init(&scheduler->tasks[w], 0);
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->start, NULL);
+    pthread_cond_init(&scheduler->done, NULL);
+    scheduler->job = 0;
+    scheduler->pending = 0;
+    scheduler->shutdown = 0;
+    scheduler->profiled = 0;
+    scheduler->threads = malloc(num_threads * sizeof(pthread_t));
+    scheduler->workers = malloc(num_threads * sizeof(SchedulerWorker));
+    for (int w = 1; w < num_threads; w++) {
+        scheduler->workers[w] = (SchedulerWorker){ scheduler, w };
+        pthread_create(&scheduler->threads[w], NULL, worker_main, &scheduler->workers[w]);
+    }
+    return scheduler;
+}
+
+// Workers have finished the sweep, so their passes can be read
+static void end_profiled_pass(TapeScheduler* scheduler) {
+    ProfilePass* total = &scheduler->passes[0];
+    for (int w = 1; w < scheduler->num_workers; w++) {
+        const ProfilePass* pass = &scheduler->passes[w];
+        for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+            total->calls[t] += pass->calls[t];
+            total->ns[t] += pass->ns[t];
+        }
+        total->nodes += pass->nodes;
+    }
+    int backward = scheduler->backward;
+    end_profile_pass(total, backward, backward ? "scheduled_backward" : "scheduled_forward");
+}
+
+static void run_pass(TapeScheduler* scheduler, int backward) {
+    scheduler->backward = backward;
+    // Workers read this after the start of each level, under the lock
+    scheduler->profiled = profiling_enabled();
+    if (scheduler->profiled) {
+        for (int w = 0; w < scheduler->num_workers; w++) begin_profile_pass(&scheduler->passes[w]);
+    }
+    ProfilePass* caller_pass = scheduler->profiled ? &scheduler->passes[0] : NULL;
+    for (int step = 0; step < scheduler->num_levels; step++) {
+        int level = backward ? scheduler->num_levels - 1 - step : step;
+        int count = scheduler->level_start[level + 1] - scheduler->level_start[level];
+        scheduler->level = level;
+
+        if (count <= scheduler->grain_size || scheduler->num_workers == 1) {
+            run_slots(scheduler, scheduler->level_start[level], scheduler->level_start[level + 1], scheduler->scratch,
+                      caller_pass);
+            continue;
+        }
+
+        // Deal the tasks of the level out in contiguous runs
+        int num_tasks = (count + scheduler->grain_size - 1) / scheduler->grain_size;
+        for (int w = 0; w < scheduler->num_workers; w++) {
+            uint32_t begin = (uint32_t)((long long)num_tasks * w / scheduler->num_workers);
+            uint32_t end = (uint32_t)((long long)num_tasks * (w + 1) / scheduler->num_workers);
+            atomic_store(&scheduler->tasks[w], pack_tasks(begin, end));
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->pending = scheduler->num_workers - 1;
+        scheduler->job++;
+        pthread_cond_broadcast(&scheduler->start);
+        pthread_mutex_unlock(&scheduler->lock);
+
+        run_level(scheduler, 0);
+
+        pthread_mutex_lock(&scheduler->lock);
+        while (scheduler->pending > 0) {
+            pthread_cond_wait(&scheduler->done, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    if (scheduler->profiled) end_profiled_pass(scheduler);
+}
+
+void scheduled_forward(TapeScheduler* scheduler) {
+    run_pass(scheduler, 0);
+}
+
+void scheduled_backward(TapeScheduler* scheduler) {
+    run_pass(scheduler, 1);
+}
+
+void free_tape_scheduler(TapeScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->shutdown = 1;
+    pthread_cond_broadcast(&scheduler->start);
+    pthread_mutex_unlock(&scheduler->lock);
+    for (int w = 1; w < scheduler->num_workers; w++) {
+        pthread_join(scheduler->threads[w], NULL);
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->start);
+    pthread_cond_destroy(&scheduler->done);
+
+    free(scheduler->level_start);
+    free(scheduler->level_slots);
+    free(scheduler->consumer_start);
+    free(scheduler->consumer_edges);
+    free(scheduler->edge_ids);
+    free(scheduler->edge_grads);
+    free(scheduler->scratch);
+    free(scheduler->passes);
+    free(scheduler->tasks);
+    free(scheduler->threads);
+    free(scheduler->workers);
+    free(scheduler);
+}
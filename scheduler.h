@@ -0,0 +1,31 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "tape.h"
+
+// Runs the sweeps of one tape on a pool of threads. Slots are grouped into
+// wavefronts: a slot's level is one more than the highest level among its
+// inputs, so all slots of a level can run at once. A level is cut into
+// tasks of grain_size slots that are dealt out to the workers, and idle
+// workers steal tasks from the others. Levels with no more than grain_size
+// slots run on the calling thread without waking the pool.
+//
+// Backward contributions go to a private slot per edge instead of straight
+// into the inputs' grads, and each slot sums its incoming edges before it
+// propagates. Nodes that share an input therefore never write to the same
+// memory concurrently. Grad semantics match tape_backward().
+//
+// With profiling enabled, a sweep counts as one pass, named
+// scheduled_forward or scheduled_backward, with the nodes of every worker;
+// with tracing on, each worker's share of a parallel level is a span too.
+typedef struct TapeScheduler TapeScheduler;
+
+#define DEFAULT_GRAIN_SIZE 64
+
+// grain_size <= 0 selects DEFAULT_GRAIN_SIZE
+TapeScheduler* create_tape_scheduler(Tape* tape, int num_threads, int grain_size);
+void scheduled_forward(TapeScheduler* scheduler);
+void scheduled_backward(TapeScheduler* scheduler);
+void free_tape_scheduler(TapeScheduler* scheduler);
+
+#endif
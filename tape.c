@@ -0,0 +1,207 @@
+#include "tape.h"
+#include "operations.h"
+#include "traversal.h"
+#include "kernels.h"
+#include "profiler.h"
+#include <stdint.h>
+#include <string.h>
+
+#define TAPE_REAL double
+#define TAPE_KERNEL_TABLE KernelTable
+#define TAPE_KERNELS kernels()
+#define TAPE_LOG log
+#define TAPE_FORWARD_RULE forward_rule
+#define TAPE_BACKWARD_RULE backward_rule
+#include "tape_rules.h"
+
+static size_t hash_pointer(const void* p, size_t mask) {
+    return (size_t)(((uintptr_t)p >> 4) * (uintptr_t)0x9E3779B97F4A7C15ull) & mask;
+}
+
+Tape* compile_tape(DifferentiableOperation** roots, int num_roots) {
+    return compile_batched_tape(roots, num_roots, 1);
+}
+
+Tape* compile_batched_tape(DifferentiableOperation** roots, int num_roots, int lanes) {
+    NodeList list;
+    init_node_list(&list);
+    if (!traverse_graph(thread_traversal_stack(), roots, num_roots, next_traversal_generation(), append_node, &list)) {
+        free_node_list(&list);
+        return NULL;
+    }
+    int n = list.num_nodes;
+    DifferentiableOperation** order = list.nodes;
+    for (int i = 0; i < n; i++) {
+        if (order[i]->type == OP_TENSOR) {
+            fprintf(stderr, "Error: Tensor nodes run through tensor_forward(), not a tape.\n");
+            free_node_list(&list);
+            return NULL;
+        }
+    }
+
+    size_t table_size = 16;
+    while (table_size < 2 * (size_t)n) table_size *= 2;
+    size_t mask = table_size - 1;
+    DifferentiableOperation** keys = calloc(table_size, sizeof(DifferentiableOperation*));
+    int* slots = malloc(table_size * sizeof(int));
+    int num_edges = 0;
+    for (int i = 0; i < n; i++) {
+        size_t h = hash_pointer(order[i], mask);
+        while (keys[h]) h = (h + 1) & mask;
+        keys[h] = order[i];
+        slots[h] = i;
+        num_edges += order[i]->num_inputs;
+    }
+
+    Tape* tape = malloc(sizeof(Tape));
+    tape->num_nodes = n;
+    tape->lanes = lanes;
+    tape->opcodes = malloc(n);
+    tape->input_start = malloc((n + 1) * sizeof(int));
+    tape->input_indices = malloc((num_edges > 0 ? num_edges : 1) * sizeof(int));
+    tape->values = malloc((size_t)n * lanes * sizeof(double));
+    tape->grads = calloc((size_t)n * lanes, sizeof(double));
+    tape->scratch = malloc(3 * lanes * sizeof(double));
+    tape->nodes = order;
+    tape->num_tangents = 0;
+    tape->tangents = NULL;
+    tape->grad_tangents = NULL;
+
+    int edge = 0;
+    for (int i = 0; i < n; i++) {
+        DifferentiableOperation* op = order[i];
+        tape->opcodes[i] = op->type;
+        tape->input_start[i] = edge;
+        DifferentiableOperation** inputs = operation_inputs(op);
+        for (int k = 0; k < op->num_inputs; k++) {
+            size_t h = hash_pointer(inputs[k], mask);
+            while (keys[h] != inputs[k]) h = (h + 1) & mask;
+            tape->input_indices[edge++] = slots[h];
+        }
+        for (int l = 0; l < lanes; l++) {
+            tape->values[(size_t)i * lanes + l] = *operation_value(op);
+        }
+    }
+    tape->input_start[n] = edge;
+
+    free(keys);
+    free(slots);
+    return tape;
+}
+
+int tape_index_of(const Tape* tape, const DifferentiableOperation* op) {
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->nodes[i] == op) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Variables are broadcast to every lane
+void tape_load_variables(Tape* tape) {
+    int lanes = tape->lanes;
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->opcodes[i] == OP_VARIABLE) {
+            double* v = tape->values + (size_t)i * lanes;
+            for (int l = 0; l < lanes; l++) {
+                v[l] = *operation_value(tape->nodes[i]);
+            }
+        }
+    }
+}
+
+// Nodes receive the values of lane 0, and variables their grads reduced
+// across all lanes. Operation grads stay on the tape; nodes have no room
+// for them.
+void tape_store_results(Tape* tape) {
+    int lanes = tape->lanes;
+    for (int i = 0; i < tape->num_nodes; i++) {
+        *operation_value(tape->nodes[i]) = tape->values[(size_t)i * lanes];
+        if (tape->opcodes[i] == OP_VARIABLE) {
+            const double* g = tape->grads + (size_t)i * lanes;
+            double sum = 0.0;
+            for (int l = 0; l < lanes; l++) {
+                sum += g[l];
+            }
+            *variable_grad(tape->nodes[i]) = sum;
+        }
+    }
+}
+
+void tape_forward_node(Tape* tape, int i, double* scratch) {
+    forward_rule(tape, i, tape->values, tape->lanes, scratch);
+}
+
+// The profiled sweeps time every node; the plain ones stay free of any
+// instrumentation
+static void profiled_forward(Tape* tape) {
+    ProfilePass pass;
+    begin_profile_pass(&pass);
+    for (int i = 0; i < tape->num_nodes; i++) {
+        if (tape->opcodes[i] == OP_VARIABLE) continue;
+        long long start = profile_clock_ns();
+        tape_forward_node(tape, i, tape->scratch);
+        profile_node(&pass, tape->opcodes[i], start);
+    }
+    end_profile_pass(&pass, 0, "tape_forward");
+}
+
+void tape_forward(Tape* tape) {
+    if (profiling_enabled()) {
+        profiled_forward(tape);
+        return;
+    }
+    for (int i = 0; i < tape->num_nodes; i++) {
+        tape_forward_node(tape, i, tape->scratch);
+    }
+}
+
+void tape_zero_grads(Tape* tape) {
+    memset(tape->grads, 0, (size_t)tape->num_nodes * tape->lanes * sizeof(double));
+}
+
+static int all_zero(const double* x, int n) {
+    for (int l = 0; l < n; l++) {
+        if (x[l] != 0.0) return 0;
+    }
+    return 1;
+}
+
+void tape_backward_node(Tape* tape, int i, double* adjoints, const int* targets, double* scratch) {
+    int lanes = tape->lanes;
+    backward_rule(tape, i, tape->values, tape->grads + (size_t)i * lanes, adjoints, targets, lanes, scratch);
+}
+
+// Adjoints of operation slots are cleared once propagated, so the tape is
+// ready for the next seed while variable grads keep accumulating.
+void tape_backward(Tape* tape) {
+    int lanes = tape->lanes;
+    int profiled = profiling_enabled();
+    ProfilePass pass;
+    if (profiled) begin_profile_pass(&pass);
+    for (int i = tape->num_nodes - 1; i >= 0; i--) {
+        double* g = tape->grads + (size_t)i * lanes;
+        if (tape->opcodes[i] == OP_VARIABLE || all_zero(g, lanes)) {
+            continue;
+        }
+        long long start = profiled ? profile_clock_ns() : 0;
+        tape_backward_node(tape, i, tape->grads, tape->input_indices + tape->input_start[i], tape->scratch);
+        memset(g, 0, lanes * sizeof(double));
+        if (profiled) profile_node(&pass, tape->opcodes[i], start);
+    }
+    if (profiled) end_profile_pass(&pass, 1, "tape_backward");
+}
+
+void free_tape(Tape* tape) {
+    free(tape->opcodes);
+    free(tape->input_start);
+    free(tape->input_indices);
+    free(tape->values);
+    free(tape->grads);
+    free(tape->scratch);
+    free(tape->nodes);
+    free(tape->tangents);
+    free(tape->grad_tangents);
+    free(tape);
+}
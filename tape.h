@@ -0,0 +1,46 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "differentiable_operation.h"
+
+// A graph flattened into topological order. Node i reads its inputs from
+// input_indices[input_start[i] .. input_start[i + 1]), and every index is
+// smaller than i, so forward is one ascending sweep and backward one
+// descending sweep over contiguous arrays.
+//
+// A tape may carry several lanes, e.g. one per sample of a minibatch: slot
+// i, lane l lives at values[i * lanes + l], so one sweep runs all lanes.
+typedef struct {
+    int num_nodes;
+    int lanes;
+    unsigned char* opcodes;  // OperationType of each slot
+    int* input_start;
+    int* input_indices;
+    double* values;
+    double* grads;
+    double* scratch;  // Three values per lane for n-ary kernels
+    DifferentiableOperation** nodes;  // Source node of each slot
+    int num_tangents;  // Forward-mode directions, 0 until tape_enable_tangents()
+    double* tangents;
+    double* grad_tangents;  // Tangents of the grads, for forward-over-reverse
+} Tape;
+
+Tape* compile_tape(DifferentiableOperation** roots, int num_roots);
+Tape* compile_batched_tape(DifferentiableOperation** roots, int num_roots, int lanes);
+int tape_index_of(const Tape* tape, const DifferentiableOperation* op);
+void tape_load_variables(Tape* tape);
+void tape_store_results(Tape* tape);
+void tape_forward(Tape* tape);
+void tape_zero_grads(Tape* tape);
+void tape_backward(Tape* tape);
+
+// Single-slot steps of the sweeps above, for schedulers that run slots in
+// another order. scratch holds three values per lane and must not be shared
+// between threads. The backward step adds the contributions of slot i to
+// adjoints[targets[j] * lanes ...] for its j-th input; tape_backward passes
+// the grads and the slot's input indices.
+void tape_forward_node(Tape* tape, int i, double* scratch);
+void tape_backward_node(Tape* tape, int i, double* adjoints, const int* targets, double* scratch);
+void free_tape(Tape* tape);
+
+#endif
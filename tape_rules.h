@@ -0,0 +1,165 @@
+// Per-operation rules of the tape sweeps, written once for every element
+// type. This is a template, not an ordinary header: before including it, a
+// source file defines
+//
+//   TAPE_REAL           the element type of values and grads
+//   TAPE_KERNEL_TABLE   the kernel table type for it
+//   TAPE_KERNELS        an expression giving the active table
+//   TAPE_LOG            log() for that type
+//   TAPE_FORWARD_RULE   the name of the forward step to define
+//   TAPE_BACKWARD_RULE  the name of the backward step to define
+//
+// and gets two static functions; the parameters are undefined again at the
+// end. Both read only the structure of layout (opcodes and inputs), so a
+// float tape can sweep its own lanes over the slots of a double layout.
+//
+// TAPE_FORWARD_RULE(layout, i, values, lanes, scratch) computes slot i
+// from its inputs. TAPE_BACKWARD_RULE(layout, i, values, g, adjoints,
+// targets, lanes, scratch) adds the contributions of slot i, whose adjoint
+// is g, to adjoints[targets[j] * lanes ...] for its j-th input. scratch
+// holds three values per lane.
+#include "kernels.h"
+#include "operations.h"
+#include "tape.h"
+#include <math.h>
+#include <string.h>
+
+static void TAPE_FORWARD_RULE(const Tape* layout, int i, TAPE_REAL* values, int lanes, TAPE_REAL* scratch) {
+    const TAPE_KERNEL_TABLE* k = TAPE_KERNELS;
+    const int* start = layout->input_start;
+    const int* args = layout->input_indices + start[i];
+    TAPE_REAL* v = values + (size_t)i * lanes;
+
+    switch (layout->opcodes[i]) {
+    case OP_VARIABLE:
+        break;
+    case OP_ADD:
+        k->add(v, values + (size_t)args[0] * lanes, values + (size_t)args[1] * lanes, lanes);
+        break;
+    case OP_MUL:
+        k->mul(v, values + (size_t)args[0] * lanes, values + (size_t)args[1] * lanes, lanes);
+        break;
+    case OP_EXP:
+        k->exp(v, values + (size_t)args[0] * lanes, lanes);
+        break;
+    case OP_SOFTMAX: {
+        int num_args = start[i + 1] - start[i];
+        memset(v, 0, lanes * sizeof(TAPE_REAL));
+        for (int j = 0; j < num_args; j++) {
+            k->add(v, v, values + (size_t)args[j] * lanes, lanes);
+        }
+        k->div(v, values + (size_t)args[0] * lanes, v, lanes);
+        break;
+    }
+    case OP_SUM: {
+        int num_args = start[i + 1] - start[i];
+        memcpy(v, values + (size_t)args[0] * lanes, lanes * sizeof(TAPE_REAL));
+        for (int j = 1; j < num_args; j++) {
+            k->add(v, v, values + (size_t)args[j] * lanes, lanes);
+        }
+        break;
+    }
+    case OP_SOFTMAX_CROSS_ENTROPY: {
+        // loss = max + log(sum(exp(z - max))) - z[label], per lane
+        int num_classes = start[i + 1] - start[i] - 1;
+        const TAPE_REAL* label = values + (size_t)args[num_classes] * lanes;
+        TAPE_REAL* max = scratch;
+        TAPE_REAL* sum = scratch + lanes;
+        TAPE_REAL* shifted = scratch + 2 * lanes;
+        memcpy(max, values + (size_t)args[0] * lanes, lanes * sizeof(TAPE_REAL));
+        for (int j = 1; j < num_classes; j++) {
+            const TAPE_REAL* z = values + (size_t)args[j] * lanes;
+            for (int l = 0; l < lanes; l++) max[l] = z[l] > max[l] ? z[l] : max[l];
+        }
+        memset(sum, 0, lanes * sizeof(TAPE_REAL));
+        for (int j = 0; j < num_classes; j++) {
+            const TAPE_REAL* z = values + (size_t)args[j] * lanes;
+            for (int l = 0; l < lanes; l++) shifted[l] = z[l] - max[l];
+            k->exp(shifted, shifted, lanes);
+            k->add(sum, sum, shifted, lanes);
+        }
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            v[l] = max[l] + TAPE_LOG(sum[l]) - values[(size_t)target * lanes + l];
+        }
+        break;
+    }
+    }
+}
+
+static void TAPE_BACKWARD_RULE(const Tape* layout, int i, const TAPE_REAL* values, const TAPE_REAL* g,
+                               TAPE_REAL* adjoints, const int* targets, int lanes, TAPE_REAL* scratch) {
+    const TAPE_KERNEL_TABLE* k = TAPE_KERNELS;
+    const int* start = layout->input_start;
+    const int* args = layout->input_indices + start[i];
+    const TAPE_REAL* v = values + (size_t)i * lanes;
+
+    switch (layout->opcodes[i]) {
+    case OP_ADD: {
+        TAPE_REAL* ga = adjoints + (size_t)targets[0] * lanes;
+        TAPE_REAL* gb = adjoints + (size_t)targets[1] * lanes;
+        k->add(ga, ga, g, lanes);
+        k->add(gb, gb, g, lanes);
+        break;
+    }
+    case OP_MUL:
+        k->fma_acc(adjoints + (size_t)targets[0] * lanes, g, values + (size_t)args[1] * lanes, lanes);
+        k->fma_acc(adjoints + (size_t)targets[1] * lanes, g, values + (size_t)args[0] * lanes, lanes);
+        break;
+    case OP_EXP:
+        k->fma_acc(adjoints + (size_t)targets[0] * lanes, g, v, lanes);
+        break;
+    case OP_SOFTMAX: {
+        // d(x0 / sum)/dx0 = (1 - s) / sum and d(x0 / sum)/dxk = -s / sum
+        int num_args = start[i + 1] - start[i];
+        TAPE_REAL* sum = scratch;
+        TAPE_REAL* scaled = scratch + lanes;
+        memset(sum, 0, lanes * sizeof(TAPE_REAL));
+        for (int j = 0; j < num_args; j++) {
+            k->add(sum, sum, values + (size_t)args[j] * lanes, lanes);
+        }
+        k->div(scaled, g, sum, lanes);
+        for (int j = 0; j < num_args; j++) {
+            k->fnma_acc(adjoints + (size_t)targets[j] * lanes, scaled, v, lanes);
+        }
+        TAPE_REAL* first = adjoints + (size_t)targets[0] * lanes;
+        k->add(first, first, scaled, lanes);
+        break;
+    }
+    case OP_SUM:
+        for (int j = 0; j < start[i + 1] - start[i]; j++) {
+            TAPE_REAL* ga = adjoints + (size_t)targets[j] * lanes;
+            k->add(ga, ga, g, lanes);
+        }
+        break;
+    case OP_SOFTMAX_CROSS_ENTROPY: {
+        // d loss / d z = p - onehot(label), with lse = loss + z[label]
+        int num_classes = start[i + 1] - start[i] - 1;
+        const TAPE_REAL* label = values + (size_t)args[num_classes] * lanes;
+        TAPE_REAL* lse = scratch;
+        TAPE_REAL* p = scratch + lanes;
+        for (int l = 0; l < lanes; l++) {
+            int target = args[checked_label(label[l], num_classes)];
+            lse[l] = v[l] + values[(size_t)target * lanes + l];
+        }
+        for (int j = 0; j < num_classes; j++) {
+            const TAPE_REAL* z = values + (size_t)args[j] * lanes;
+            for (int l = 0; l < lanes; l++) p[l] = z[l] - lse[l];
+            k->exp(p, p, lanes);
+            k->fma_acc(adjoints + (size_t)targets[j] * lanes, g, p, lanes);
+        }
+        for (int l = 0; l < lanes; l++) {
+            int target = targets[checked_label(label[l], num_classes)];
+            adjoints[(size_t)target * lanes + l] -= g[l];
+        }
+        break;
+    }
+    }
+}
+
+#undef TAPE_REAL
+#undef TAPE_KERNEL_TABLE
+#undef TAPE_KERNELS
+#undef TAPE_LOG
+#undef TAPE_FORWARD_RULE
+#undef TAPE_BACKWARD_RULE
@@ -0,0 +1,441 @@
+#include "tensor.h"
+#include "traversal.h"
+#include "kernels.h"
+#include "profiler.h"
+#include <string.h>
+
+// Dense layers are evaluated in tiles of batch rows x weight rows, so a tile
+// of W stays in cache while every row of x in the tile streams past it.
+#define DENSE_TILE_ROWS 16
+#define DENSE_TILE_OUTPUTS 32
+
+// Views pass with_storage = 0 and point value and grad into their registry
+static TensorOperation* alloc_tensor(TensorOperationType type, int ndim, const int* shape, int with_storage) {
+    TensorOperation* op = malloc(sizeof(TensorOperation));
+    memset(&op->node, 0, sizeof(DifferentiableOperation));
+    op->node.type = OP_TENSOR;
+    op->ndim = ndim;
+    op->size = 1;
+    for (int d = ndim - 1; d >= 0; d--) {
+        op->shape[d] = shape[d];
+        op->strides[d] = op->size;
+        op->size *= shape[d];
+    }
+    op->value = with_storage ? calloc(op->size, sizeof(double)) : NULL;
+    op->grad = with_storage ? calloc(op->size, sizeof(double)) : NULL;
+    op->registry = NULL;
+    op->first_parameter = 0;
+    op->type = type;
+    op->activation = ACTIVATION_NONE;
+    return op;
+}
+
+static void set_tensor_inputs(TensorOperation* op, TensorOperation* a, TensorOperation* b, TensorOperation* c) {
+    TensorOperation* inputs[3] = { a, b, c };
+    int n = c ? 3 : b ? 2 : 1;
+    op->node.num_inputs = n;
+    if (n > MAX_INLINE_INPUTS) {
+        op->node.inputs = op->wide_inputs;
+    }
+    for (int i = 0; i < n; i++) {
+        operation_inputs(&op->node)[i] = &inputs[i]->node;
+    }
+}
+
+// Views read their storage from the registry at the start of every sweep,
+// as growing the registry moves its arrays
+static void point_at_registry(TensorOperation* op) {
+    op->value = op->registry->values + op->first_parameter;
+    op->grad = op->registry->grads + op->first_parameter;
+}
+
+static int last_dim(const TensorOperation* op) {
+    return op->shape[op->ndim - 1];
+}
+
+static int same_shape(const TensorOperation* a, const TensorOperation* b) {
+    if (a->ndim != b->ndim) return 0;
+    for (int d = 0; d < a->ndim; d++) {
+        if (a->shape[d] != b->shape[d]) return 0;
+    }
+    return 1;
+}
+
+TensorOperation* create_tensor_variable(int ndim, const int* shape, const double* data) {
+    if (ndim < 1 || ndim > MAX_TENSOR_DIMS) {
+        fprintf(stderr, "Error: Tensors must have between 1 and %d dimensions.\n", MAX_TENSOR_DIMS);
+        return NULL;
+    }
+    TensorOperation* var = alloc_tensor(TENSOR_VARIABLE, ndim, shape, 1);
+    if (data) {
+        memcpy(var->value, data, var->size * sizeof(double));
+    }
+    return var;
+}
+
+TensorOperation* create_tensor_view(ParameterRegistry* registry, int first, int ndim, const int* shape) {
+    if (ndim < 1 || ndim > MAX_TENSOR_DIMS) {
+        fprintf(stderr, "Error: Tensors must have between 1 and %d dimensions.\n", MAX_TENSOR_DIMS);
+        return NULL;
+    }
+    TensorOperation* view = alloc_tensor(TENSOR_VARIABLE, ndim, shape, 0);
+    if (first < 0 || view->size > registry->num_params - first) {
+        fprintf(stderr, "Error: The registry has no parameters [%d, %d).\n", first, first + view->size);
+        free(view);
+        return NULL;
+    }
+    view->registry = registry;
+    view->first_parameter = first;
+    point_at_registry(view);
+    return view;
+}
+
+TensorOperation* create_tensor_add_operation(TensorOperation* a, TensorOperation* b) {
+    int broadcast = a->ndim == 2 && b->ndim == 1 && b->shape[0] == last_dim(a);
+    if (!same_shape(a, b) && !broadcast) {
+        fprintf(stderr, "Error: Shape mismatch in tensor add.\n");
+        return NULL;
+    }
+    TensorOperation* op = alloc_tensor(TENSOR_ADD, a->ndim, a->shape, 1);
+    set_tensor_inputs(op, a, b, NULL);
+    return op;
+}
+
+TensorOperation* create_tensor_mul_operation(TensorOperation* a, TensorOperation* b) {
+    if (!same_shape(a, b)) {
+        fprintf(stderr, "Error: Shape mismatch in tensor mul.\n");
+        return NULL;
+    }
+    TensorOperation* op = alloc_tensor(TENSOR_MUL, a->ndim, a->shape, 1);
+    set_tensor_inputs(op, a, b, NULL);
+    return op;
+}
+
+TensorOperation* create_tensor_exp_operation(TensorOperation* input) {
+    TensorOperation* op = alloc_tensor(TENSOR_EXP, input->ndim, input->shape, 1);
+    set_tensor_inputs(op, input, NULL, NULL);
+    return op;
+}
+
+TensorOperation* create_tensor_matmul_operation(TensorOperation* a, TensorOperation* b) {
+    if (a->ndim != 2 || b->shape[0] != a->shape[1]) {
+        fprintf(stderr, "Error: Shape mismatch in tensor matmul.\n");
+        return NULL;
+    }
+    int shape[MAX_TENSOR_DIMS] = { a->shape[0], b->ndim == 2 ? b->shape[1] : 1 };
+    TensorOperation* op = alloc_tensor(TENSOR_MATMUL, b->ndim, shape, 1);
+    set_tensor_inputs(op, a, b, NULL);
+    return op;
+}
+
+TensorOperation* create_tensor_softmax_operation(TensorOperation* input) {
+    TensorOperation* op = alloc_tensor(TENSOR_SOFTMAX, input->ndim, input->shape, 1);
+    set_tensor_inputs(op, input, NULL, NULL);
+    return op;
+}
+
+TensorOperation* create_tensor_dense_operation(TensorOperation* x, TensorOperation* weights,
+                                               TensorOperation* bias, TensorActivation activation) {
+    if (weights->ndim != 2 || last_dim(x) != weights->shape[1] ||
+        (bias && (bias->ndim != 1 || bias->shape[0] != weights->shape[0]))) {
+        fprintf(stderr, "Error: Shape mismatch in tensor dense.\n");
+        return NULL;
+    }
+    int shape[MAX_TENSOR_DIMS] = { x->shape[0], weights->shape[0] };
+    if (x->ndim == 1) shape[0] = weights->shape[0];
+    TensorOperation* op = alloc_tensor(TENSOR_DENSE, x->ndim, shape, 1);
+    set_tensor_inputs(op, x, weights, bias);
+    op->activation = activation;
+    return op;
+}
+
+static double activate(TensorActivation activation, double z) {
+    switch (activation) {
+    case ACTIVATION_RELU:
+        return z > 0.0 ? z : 0.0;
+    case ACTIVATION_TANH:
+        return tanh(z);
+    case ACTIVATION_SIGMOID:
+        return 1.0 / (1.0 + exp(-z));
+    default:
+        return z;
+    }
+}
+
+// Derivative of the activation, written in terms of its output y
+static double activation_slope(TensorActivation activation, double y) {
+    switch (activation) {
+    case ACTIVATION_RELU:
+        return y > 0.0 ? 1.0 : 0.0;
+    case ACTIVATION_TANH:
+        return 1.0 - y * y;
+    case ACTIVATION_SIGMOID:
+        return y * (1.0 - y);
+    default:
+        return 1.0;
+    }
+}
+
+static void dense_forward(TensorOperation* op) {
+    const TensorOperation* x = tensor_input(op, 0);
+    const TensorOperation* w = tensor_input(op, 1);
+    const double* b = op->node.num_inputs == 3 ? tensor_input(op, 2)->value : NULL;
+    int out = w->shape[0], in = w->shape[1], rows = x->size / in;
+    TensorActivation activation = op->activation;
+
+    for (int r0 = 0; r0 < rows; r0 += DENSE_TILE_ROWS) {
+        int r1 = r0 + DENSE_TILE_ROWS < rows ? r0 + DENSE_TILE_ROWS : rows;
+        for (int j0 = 0; j0 < out; j0 += DENSE_TILE_OUTPUTS) {
+            int j1 = j0 + DENSE_TILE_OUTPUTS < out ? j0 + DENSE_TILE_OUTPUTS : out;
+            for (int r = r0; r < r1; r++) {
+                const double* xrow = x->value + (size_t)r * in;
+                double* y = op->value + (size_t)r * out;
+                for (int j = j0; j < j1; j++) {
+                    const double* wrow = w->value + (size_t)j * in;
+                    double z = b ? b[j] : 0.0;
+                    for (int p = 0; p < in; p++) z += xrow[p] * wrow[p];
+                    y[j] = activate(activation, z);
+                }
+            }
+        }
+    }
+}
+
+// One sweep over the same tiles produces dx, dW and db. The pre-activation
+// gradient overwrites op->grad, which is cleared after the node propagates.
+static void dense_backward(TensorOperation* op) {
+    TensorOperation* x = tensor_input(op, 0);
+    TensorOperation* w = tensor_input(op, 1);
+    double* db = op->node.num_inputs == 3 ? tensor_input(op, 2)->grad : NULL;
+    int out = w->shape[0], in = w->shape[1], rows = x->size / in;
+    double* dz = op->grad;
+
+    if (op->activation != ACTIVATION_NONE) {
+        for (int i = 0; i < op->size; i++) dz[i] *= activation_slope(op->activation, op->value[i]);
+    }
+
+    for (int r0 = 0; r0 < rows; r0 += DENSE_TILE_ROWS) {
+        int r1 = r0 + DENSE_TILE_ROWS < rows ? r0 + DENSE_TILE_ROWS : rows;
+        for (int j0 = 0; j0 < out; j0 += DENSE_TILE_OUTPUTS) {
+            int j1 = j0 + DENSE_TILE_OUTPUTS < out ? j0 + DENSE_TILE_OUTPUTS : out;
+            for (int r = r0; r < r1; r++) {
+                const double* xrow = x->value + (size_t)r * in;
+                double* dxrow = x->grad + (size_t)r * in;
+                const double* d = dz + (size_t)r * out;
+                for (int j = j0; j < j1; j++) {
+                    if (d[j] == 0.0) continue;
+                    const double* wrow = w->value + (size_t)j * in;
+                    double* dwrow = w->grad + (size_t)j * in;
+                    for (int p = 0; p < in; p++) {
+                        dwrow[p] += d[j] * xrow[p];
+                        dxrow[p] += d[j] * wrow[p];
+                    }
+                    if (db) db[j] += d[j];
+                }
+            }
+        }
+    }
+}
+
+static void compute_tensor(TensorOperation* op) {
+    TensorOperation* a = tensor_input(op, 0);
+    TensorOperation* b = op->node.num_inputs > 1 ? tensor_input(op, 1) : NULL;
+    const KernelTable* kern = kernels();
+    double* v = op->value;
+    int n = op->size;
+
+    switch (op->type) {
+    case TENSOR_ADD:
+        // A smaller b is a row vector broadcast across a
+        for (int r = 0; r < n; r += b->size) {
+            kern->add(v + r, a->value + r, b->value, b->size);
+        }
+        break;
+    case TENSOR_MUL:
+        kern->mul(v, a->value, b->value, n);
+        break;
+    case TENSOR_EXP:
+        kern->exp(v, a->value, n);
+        break;
+    case TENSOR_MATMUL: {
+        int m = a->shape[0], k = a->shape[1], cols = n / m;
+        memset(v, 0, n * sizeof(double));
+        for (int i = 0; i < m; i++) {
+            for (int p = 0; p < k; p++) {
+                double aip = a->value[i * k + p];
+                const double* brow = b->value + p * cols;
+                for (int j = 0; j < cols; j++) v[i * cols + j] += aip * brow[j];
+            }
+        }
+        break;
+    }
+    case TENSOR_SOFTMAX: {
+        int cols = last_dim(op);
+        for (int r = 0; r < n; r += cols) {
+            double max = a->value[r];
+            for (int j = 1; j < cols; j++) {
+                if (a->value[r + j] > max) max = a->value[r + j];
+            }
+            for (int j = 0; j < cols; j++) v[r + j] = a->value[r + j] - max;
+            kern->exp(v + r, v + r, cols);
+            double sum = 0.0;
+            for (int j = 0; j < cols; j++) sum += v[r + j];
+            double inv_sum = 1.0 / sum;
+            for (int j = 0; j < cols; j++) v[r + j] *= inv_sum;
+        }
+        break;
+    }
+    case TENSOR_DENSE:
+        dense_forward(op);
+        break;
+    default:
+        break;
+    }
+}
+
+static void backward_tensor(TensorOperation* op) {
+    TensorOperation* a = tensor_input(op, 0);
+    TensorOperation* b = op->node.num_inputs > 1 ? tensor_input(op, 1) : NULL;
+    const KernelTable* kern = kernels();
+    const double* g = op->grad;
+    int n = op->size;
+
+    switch (op->type) {
+    case TENSOR_ADD:
+        kern->add(a->grad, a->grad, g, n);
+        for (int r = 0; r < n; r += b->size) {
+            kern->add(b->grad, b->grad, g + r, b->size);
+        }
+        break;
+    case TENSOR_MUL:
+        kern->fma_acc(a->grad, g, b->value, n);
+        kern->fma_acc(b->grad, g, a->value, n);
+        break;
+    case TENSOR_EXP:
+        kern->fma_acc(a->grad, g, op->value, n);
+        break;
+    case TENSOR_MATMUL: {
+        int m = a->shape[0], k = a->shape[1], cols = n / m;
+        for (int i = 0; i < m; i++) {
+            const double* grow = g + i * cols;
+            for (int p = 0; p < k; p++) {
+                const double* brow = b->value + p * cols;
+                double* gbrow = b->grad + p * cols;
+                double aip = a->value[i * k + p];
+                double dot = 0.0;
+                for (int j = 0; j < cols; j++) {
+                    dot += grow[j] * brow[j];
+                    gbrow[j] += aip * grow[j];
+                }
+                a->grad[i * k + p] += dot;
+            }
+        }
+        break;
+    }
+    case TENSOR_SOFTMAX: {
+        int cols = last_dim(op);
+        for (int r = 0; r < n; r += cols) {
+            double dot = 0.0;
+            for (int j = 0; j < cols; j++) dot += g[r + j] * op->value[r + j];
+            for (int j = 0; j < cols; j++) a->grad[r + j] += op->value[r + j] * (g[r + j] - dot);
+        }
+        break;
+    }
+    case TENSOR_DENSE:
+        dense_backward(op);
+        break;
+    default:
+        break;
+    }
+}
+
+static void append_tensor(DifferentiableOperation* node, void* list) {
+    TensorOperation* op = (TensorOperation*)node;
+    if (op->registry) {
+        point_at_registry(op);
+    }
+    append_node(node, list);
+}
+
+// Topological order of the tensor graph, inputs first. Tensor graphs are a
+// handful of nodes, so the order is rebuilt on every pass.
+static int tensor_order(TensorOperation* root, NodeList* order) {
+    DifferentiableOperation* node = &root->node;
+    init_node_list(order);
+    return traverse_graph(thread_traversal_stack(), &node, 1, next_traversal_generation(), append_tensor, order);
+}
+
+static TensorOperation* tensor_at(const NodeList* order, int i) {
+    return (TensorOperation*)order->nodes[i];
+}
+
+static void profiled_tensor_forward(const NodeList* order) {
+    ProfilePass pass;
+    begin_profile_pass(&pass);
+    for (int i = 0; i < order->num_nodes; i++) {
+        if (tensor_at(order, i)->type == TENSOR_VARIABLE) continue;
+        long long start = profile_clock_ns();
+        compute_tensor(tensor_at(order, i));
+        profile_node(&pass, OP_TENSOR, start);
+    }
+    end_profile_pass(&pass, 0, "tensor_forward");
+}
+
+void tensor_forward(TensorOperation* root) {
+    NodeList order;
+    if (tensor_order(root, &order)) {
+        if (profiling_enabled()) {
+            profiled_tensor_forward(&order);
+        } else {
+            for (int i = 0; i < order.num_nodes; i++) {
+                compute_tensor(tensor_at(&order, i));
+            }
+        }
+    }
+    free_node_list(&order);
+}
+
+void tensor_zero_grads(TensorOperation* root) {
+    NodeList order;
+    if (tensor_order(root, &order)) {
+        for (int i = 0; i < order.num_nodes; i++) {
+            memset(tensor_at(&order, i)->grad, 0, tensor_at(&order, i)->size * sizeof(double));
+        }
+    }
+    free_node_list(&order);
+}
+
+// Seed root->grad first. As on the tape, operation grads are cleared once
+// propagated and variable grads accumulate until tensor_zero_grads().
+void tensor_backward(TensorOperation* root) {
+    NodeList order;
+    int profiled = profiling_enabled();
+    ProfilePass pass;
+    if (profiled) begin_profile_pass(&pass);
+    if (tensor_order(root, &order)) {
+        for (int i = order.num_nodes - 1; i >= 0; i--) {
+            TensorOperation* op = tensor_at(&order, i);
+            if (op->type == TENSOR_VARIABLE) continue;
+            long long start = profiled ? profile_clock_ns() : 0;
+            backward_tensor(op);
+            memset(op->grad, 0, op->size * sizeof(double));
+            if (profiled) profile_node(&pass, OP_TENSOR, start);
+        }
+    }
+    if (profiled) end_profile_pass(&pass, 1, "tensor_backward");
+    free_node_list(&order);
+}
+
+void free_tensor_operation(TensorOperation* root) {
+    NodeList order;
+    tensor_order(root, &order);
+    for (int i = 0; i < order.num_nodes; i++) {
+        TensorOperation* op = tensor_at(&order, i);
+        if (!op->registry) {
+            free(op->value);
+            free(op->grad);
+        }
+        free(op);
+    }
+    free_node_list(&order);
+}
@@ -0,0 +1,69 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include "differentiable_operation.h"
+#include "parameters.h"
+
+#define MAX_TENSOR_DIMS 2
+
+typedef struct TensorOperation TensorOperation;
+typedef enum { TENSOR_VARIABLE, TENSOR_ADD, TENSOR_MUL, TENSOR_EXP, TENSOR_MATMUL, TENSOR_SOFTMAX, TENSOR_DENSE } TensorOperationType;
+typedef enum { ACTIVATION_NONE, ACTIVATION_RELU, ACTIVATION_TANH, ACTIVATION_SIGMOID } TensorActivation;
+
+// A graph node whose value is a row-major vector ([n]) or matrix ([rows, cols]).
+// value and grad are contiguous buffers of size elements each.
+//
+// Every tensor starts with a DifferentiableOperation of type OP_TENSOR whose
+// inputs are the nodes of its input tensors, so the shared traversal, cycle
+// detection and profiler work on tensor graphs unchanged. The scalar node
+// has no value or grad of its own, so the scalar engine refuses it:
+// scalar operations do not take tensor inputs; the tape, forward() and
+// backward_pass() report an error instead of evaluating tensors, which run
+// through tensor_forward() and tensor_backward(); free_operation() leaves
+// graphs with tensors to free_tensor_operation(); and generate_dot_file()
+// labels tensors by name only.
+struct TensorOperation {
+    DifferentiableOperation node;  // Must stay first
+    int ndim;
+    int shape[MAX_TENSOR_DIMS];
+    int strides[MAX_TENSOR_DIMS];
+    int size;
+    double* value;
+    double* grad;
+    DifferentiableOperation* wide_inputs[3];  // node.inputs when there are more than MAX_INLINE_INPUTS
+    ParameterRegistry* registry;  // Views only: value and grad live in its arrays
+    int first_parameter;
+    unsigned char type;  // TensorOperationType
+    unsigned char activation;  // TensorActivation, dense nodes only
+};
+
+static inline TensorOperation* tensor_input(TensorOperation* op, int i) {
+    return (TensorOperation*)operation_inputs(&op->node)[i];
+}
+
+TensorOperation* create_tensor_variable(int ndim, const int* shape, const double* data);
+// A variable over parameters [first, first + size) of registry, e.g. the
+// weights of a layer, so optimizers and trainers of the registry see the
+// tensor's grads. The view follows the arrays if the registry grows.
+TensorOperation* create_tensor_view(ParameterRegistry* registry, int first, int ndim, const int* shape);
+
+// add: equal shapes, or b a vector broadcast across the rows of matrix a
+TensorOperation* create_tensor_add_operation(TensorOperation* a, TensorOperation* b);
+TensorOperation* create_tensor_mul_operation(TensorOperation* a, TensorOperation* b);
+TensorOperation* create_tensor_exp_operation(TensorOperation* input);
+// matmul: [m, k] x [k] -> [m] or [m, k] x [k, n] -> [m, n]
+TensorOperation* create_tensor_matmul_operation(TensorOperation* a, TensorOperation* b);
+// softmax over the last dimension
+TensorOperation* create_tensor_softmax_operation(TensorOperation* input);
+// dense: act(x W^T + b) for x [in] or [batch, in], weights [out, in] and
+// bias [out] (or NULL). The output is [out] or [batch, out].
+TensorOperation* create_tensor_dense_operation(TensorOperation* x, TensorOperation* weights,
+                                               TensorOperation* bias, TensorActivation activation);
+
+void tensor_forward(TensorOperation* root);
+void tensor_zero_grads(TensorOperation* root);
+void tensor_backward(TensorOperation* root);
+// Frees root and everything reachable from it; views leave the registry alone
+void free_tensor_operation(TensorOperation* root);
+
+#endif
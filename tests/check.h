@@ -0,0 +1,44 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <math.h>
+#include <stdio.h>
+
+// Minimal assertions for the test programs. A failed check is reported
+// and counted; the program keeps going so one run shows every failure,
+// and check_summary() turns the count into the exit status.
+static int check_failures = 0;
+static int check_count = 0;
+
+#define CHECK(condition, ...)                                                     \
+    do {                                                                          \
+        check_count++;                                                            \
+        if (!(condition)) {                                                       \
+            check_failures++;                                                     \
+            fprintf(stderr, "%s:%d: check failed: ", __FILE__, __LINE__);         \
+            fprintf(stderr, __VA_ARGS__);                                         \
+            fprintf(stderr, "\n");                                                \
+        }                                                                         \
+    } while (0)
+
+// |actual - expected| <= tolerance * max(1, |expected|); NaN never passes
+#define CHECK_CLOSE(actual, expected, tolerance, ...)                             \
+    do {                                                                          \
+        double check_a = (actual), check_e = (expected);                          \
+        double check_scale = fabs(check_e) > 1.0 ? fabs(check_e) : 1.0;          \
+        check_count++;                                                            \
+        if (!(fabs(check_a - check_e) <= (tolerance) * check_scale)) {            \
+            check_failures++;                                                     \
+            fprintf(stderr, "%s:%d: %.17g != %.17g: ", __FILE__, __LINE__,        \
+                    check_a, check_e);                                            \
+            fprintf(stderr, __VA_ARGS__);                                         \
+            fprintf(stderr, "\n");                                                \
+        }                                                                         \
+    } while (0)
+
+static int check_summary(const char* name) {
+    printf("%s: %d checks, %d failed\n", name, check_count, check_failures);
+    return check_failures ? 1 : 0;
+}
+
+#endif
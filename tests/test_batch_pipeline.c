@@ -0,0 +1,93 @@
+// Checks the batch pipeline: every epoch delivers each sample exactly
+// once, normalized and labelled, for one slot and several, with a consumer
+// slow enough that the producer has to sleep; and freeing the pipeline
+// while the producer waits for a slot returns.
+#include "batch_pipeline.h"
+#include "check.h"
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_SAMPLES 103
+#define BATCH_SIZE 8
+#define EPOCHS 3
+
+static char directory[] = "/tmp/autodiff_pipeline_XXXXXX";
+static char path[256];
+
+// Feature 0 of sample i is i and feature 1 is -2i, its label is i % 3
+static Dataset* open_test_dataset() {
+    double features[NUM_SAMPLES * 2];
+    int labels[NUM_SAMPLES];
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        features[i * 2] = i;
+        features[i * 2 + 1] = -2.0 * i;
+        labels[i] = i % 3;
+    }
+    snprintf(path, sizeof(path), "%s/samples.bin", directory);
+    if (!write_dataset(path, features, labels, NUM_SAMPLES, 2, 3)) return NULL;
+    return open_dataset(path);
+}
+
+static void pause_ms(int ms) {
+    struct timespec delay = { 0, ms * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+static void test_epochs(const Dataset* dataset, int depth) {
+    const double mean[] = { 1.0, 0.0 }, scale[] = { 2.0, -0.5 };
+    BatchPipeline* pipeline = create_batch_pipeline(dataset, BATCH_SIZE, depth, EPOCHS, mean, scale, 7);
+    CHECK(pipeline != NULL, "depth %d: no pipeline", depth);
+    if (!pipeline) return;
+    int seen[EPOCHS][NUM_SAMPLES] = { { 0 } };
+    int batches = 0;
+    for (const PackedBatch* batch; (batch = next_batch(pipeline)); batches++) {
+        CHECK(batch->epoch == batches / ((NUM_SAMPLES + BATCH_SIZE - 1) / BATCH_SIZE),
+              "depth %d: batch %d is from epoch %d", depth, batches, batch->epoch);
+        for (int i = 0; i < batch->count; i++) {
+            int sample = (int)(batch->features[i] / 2.0 + 1.0 + 0.5);
+            CHECK(sample >= 0 && sample < NUM_SAMPLES, "depth %d: batch %d holds sample %d", depth, batches, sample);
+            if (sample < 0 || sample >= NUM_SAMPLES) continue;
+            seen[batch->epoch][sample]++;
+            CHECK(batch->features[batch->stride + i] == -2.0 * sample * -0.5, "depth %d: feature 1 of sample %d",
+                  depth, sample);
+            CHECK(batch->labels[i] == sample % 3, "depth %d: label of sample %d", depth, sample);
+        }
+        if (batches % 5 == 0) pause_ms(2);  // Lets the producer fill the ring and sleep
+        release_batch(pipeline);
+    }
+    int missing = 0;
+    for (int e = 0; e < EPOCHS; e++) {
+        for (int i = 0; i < NUM_SAMPLES; i++) missing += seen[e][i] != 1;
+    }
+    CHECK(missing == 0, "depth %d: %d samples not seen exactly once in their epoch", depth, missing);
+    free_batch_pipeline(pipeline);
+}
+
+// The producer fills every slot and waits; freeing has to wake it
+static void test_free_while_full(const Dataset* dataset) {
+    const double mean[] = { 0.0, 0.0 }, scale[] = { 1.0, 1.0 };
+    BatchPipeline* pipeline = create_batch_pipeline(dataset, BATCH_SIZE, 2, EPOCHS, mean, scale, 11);
+    CHECK(next_batch(pipeline) != NULL, "full: no first batch");
+    pause_ms(20);
+    free_batch_pipeline(pipeline);
+}
+
+int main() {
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    Dataset* dataset = open_test_dataset();
+    CHECK(dataset != NULL, "no dataset");
+    if (dataset) {
+        CHECK(create_batch_pipeline(dataset, 0, 2, 1, NULL, NULL, 1) == NULL, "a pipeline with empty batches");
+        test_epochs(dataset, 1);
+        test_epochs(dataset, 3);
+        test_free_while_full(dataset);
+        close_dataset(dataset);
+    }
+    unlink(path);
+    rmdir(directory);
+    return check_summary("test_batch_pipeline");
+}
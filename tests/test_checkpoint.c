@@ -0,0 +1,105 @@
+// Checks checkpointed tapes against a plain tape on a deep graph, for
+// budgets from one segment for the whole tape down to one that nothing
+// fits, and on an empty tape.
+#include "checkpoint.h"
+#include "operations.h"
+#include "check.h"
+
+#define LANES 4
+#define DEPTH 400
+#define NUM_BUDGETS 16
+
+// A long chain with fanout, an exp every few steps and a softmax
+// cross-entropy on top, so segments cut through shared values
+static DifferentiableOperation* build_chain(DifferentiableOperation** weights, DifferentiableOperation* x) {
+    DifferentiableOperation* z = x;
+    for (int d = 0; d < DEPTH; d++) {
+        z = create_add_operation(create_mul_operation(z, weights[d % 3]), create_mul_operation(x, weights[(d + 1) % 3]));
+        if (d % 7 == 0) {
+            z = create_exp_operation(create_mul_operation(z, create_constant(0.01)));
+        }
+    }
+    DifferentiableOperation* logits[] = { z, create_mul_operation(z, weights[0]), x };
+    return create_softmax_cross_entropy_operation(logits, 3, create_constant(1.0));
+}
+
+static void seed(double* grads) {
+    for (int l = 0; l < LANES; l++) grads[l] = 1.0 + l;
+}
+
+static void check_budget(DifferentiableOperation* loss, DifferentiableOperation** weights, const Tape* reference,
+                         size_t budget, size_t smallest) {
+    CheckpointedTape* tape = compile_checkpointed_tape(&loss, 1, LANES, budget);
+    CHECK(tape != NULL, "budget %zu: no tape", budget);
+    if (!tape) return;
+    if (budget >= smallest) {
+        CHECK(checkpoint_memory(tape) <= budget, "budget %zu: %zu bytes in %d segments", budget,
+              checkpoint_memory(tape), checkpoint_segments(tape));
+    }
+
+    // Twice, so the second pass also checks that the sweeps leave no state behind
+    for (int pass = 0; pass < 2; pass++) {
+        checkpoint_zero_grads(tape);
+        checkpoint_forward(tape);
+        seed(checkpoint_grads(tape, loss));
+        checkpoint_backward(tape);
+    }
+    int loss_slot = tape_index_of(reference, loss);
+    for (int l = 0; l < LANES; l++) {
+        CHECK_CLOSE(checkpoint_values(tape, loss)[l], reference->values[loss_slot * LANES + l], 1e-12,
+                    "budget %zu: loss of lane %d", budget, l);
+    }
+    for (int k = 0; k < 3; k++) {
+        int slot = tape_index_of(reference, weights[k]);
+        for (int l = 0; l < LANES; l++) {
+            CHECK_CLOSE(checkpoint_grads(tape, weights[k])[l], reference->grads[slot * LANES + l], 1e-12,
+                        "budget %zu: grad of weight %d, lane %d", budget, k, l);
+        }
+    }
+    free_checkpointed_tape(tape);
+}
+
+static void test_budgets() {
+    DifferentiableOperation* weights[3];
+    for (int k = 0; k < 3; k++) weights[k] = create_variable(0.5 + 0.1 * k);
+    DifferentiableOperation* x = create_variable(0.3);
+    DifferentiableOperation* loss = build_chain(weights, x);
+
+    Tape* reference = compile_batched_tape(&loss, 1, LANES);
+    tape_forward(reference);
+    seed(reference->grads + tape_index_of(reference, loss) * LANES);
+    tape_backward(reference);
+
+    // A budget of one byte fits nothing and gets the smallest footprint
+    CheckpointedTape* tightest = compile_checkpointed_tape(&loss, 1, LANES, 1);
+    size_t smallest = checkpoint_memory(tightest);
+    free_checkpointed_tape(tightest);
+
+    size_t full = (size_t)reference->num_nodes * LANES * 2 * sizeof(double);
+    check_budget(loss, weights, reference, 0, smallest);
+    check_budget(loss, weights, reference, 1, smallest);
+    for (int b = 0; b <= NUM_BUDGETS; b++) {
+        check_budget(loss, weights, reference, smallest + (full - smallest) * b / NUM_BUDGETS, smallest);
+    }
+    free_tape(reference);
+    free_operation(loss);
+}
+
+static void test_empty_tape() {
+    for (size_t budget = 0; budget <= 1024; budget += 512) {
+        CheckpointedTape* tape = compile_checkpointed_tape(NULL, 0, LANES, budget);
+        CHECK(tape != NULL, "no empty tape for budget %zu", budget);
+        if (!tape) continue;
+        CHECK(checkpoint_segments(tape) == 0, "empty tape with budget %zu has %d segments", budget,
+              checkpoint_segments(tape));
+        checkpoint_forward(tape);
+        checkpoint_backward(tape);
+        free_checkpointed_tape(tape);
+    }
+}
+
+int main() {
+    test_budgets();
+    test_empty_tape();
+    return check_summary("test_checkpoint");
+}
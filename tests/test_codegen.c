@@ -0,0 +1,131 @@
+// Checks generated C code: gradients against the tape on a graph with
+// every scalar operation, constants that %g cannot spell (-0.0, infinities,
+// NaN), names that are not C identifiers, and a path the shell would split.
+#include "codegen.h"
+#include "operations.h"
+#include "tape.h"
+#include "check.h"
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+static char directory[] = "/tmp/autodiff_codegen_XXXXXX";
+
+// A file in the scratch directory; the name has a space, a quote and $()
+static void scratch_path(char* path, size_t size, const char* stem) {
+    snprintf(path, size, "%s/%s it's $(false).c", directory, stem);
+}
+
+static void remove_generated(const char* path) {
+    char library[512];
+    snprintf(library, sizeof(library), "%s.so", path);
+    unlink(path);
+    unlink(library);
+}
+
+static GeneratedGraph* generate_and_load(DifferentiableOperation* root, const char* name) {
+    char path[512];
+    scratch_path(path, sizeof(path), name);
+    GeneratedGraph* graph = generate_c_code(root, name, path);
+    CHECK(graph != NULL, "%s: no code generated", name);
+    if (graph && !load_generated_code(graph, name, path)) {
+        CHECK(0, "%s: generated code did not load", name);
+        free_generated_graph(graph);
+        graph = NULL;
+    }
+    remove_generated(path);
+    return graph;
+}
+
+static void test_gradients() {
+    DifferentiableOperation* in[4];
+    for (int j = 0; j < 4; j++) in[j] = create_variable(0.4 - 0.3 * j);
+    DifferentiableOperation* a = create_add_operation(create_mul_operation(in[0], in[1]), create_exp_operation(in[2]));
+    DifferentiableOperation* terms[] = { in[0], in[3], a, create_constant(0.1) };
+    DifferentiableOperation* b = create_sum_operation(terms, 4);
+    DifferentiableOperation* scores[] = { a, b, in[3] };
+    DifferentiableOperation* p = create_softmax_operation(scores, 3);
+    DifferentiableOperation* logits[] = { create_mul_operation(p, b), a, in[1] };
+    DifferentiableOperation* loss = create_softmax_cross_entropy_operation(logits, 3, create_constant(1.0));
+
+    GeneratedGraph* graph = generate_and_load(loss, "every_op");
+    if (graph) {
+        double inputs[4], grads[4];
+        CHECK(graph->num_inputs == 4, "every_op: %d inputs", graph->num_inputs);
+        gather_generated_inputs(graph, inputs);
+        double value = graph->gradient(inputs, grads);
+
+        Tape* tape = compile_tape(&loss, 1);
+        tape_forward(tape);
+        tape->grads[tape_index_of(tape, loss)] = 1.0;
+        tape_backward(tape);
+        CHECK_CLOSE(value, tape->values[tape_index_of(tape, loss)], 1e-14, "every_op: value");
+        CHECK_CLOSE(graph->forward(inputs), value, 1e-14, "every_op: forward");
+        for (int k = 0; k < graph->num_inputs; k++) {
+            CHECK_CLOSE(grads[k], tape->grads[tape_index_of(tape, graph->inputs[k])], 1e-14, "every_op: grad %d", k);
+        }
+        free_tape(tape);
+        free_generated_graph(graph);
+    }
+    free_operation(loss);
+}
+
+// exp(-inf) * x + (-0.0) keeps both constants in the source; only a
+// literal that keeps the sign of zero gives -0.0 for x = 0
+static void test_special_constants() {
+    DifferentiableOperation* x = create_variable(0.0);
+    DifferentiableOperation* vanishing = create_exp_operation(create_constant(-INFINITY));
+    DifferentiableOperation* root = create_add_operation(create_mul_operation(vanishing, x), create_constant(-0.0));
+    GeneratedGraph* graph = generate_and_load(root, "signed_zero");
+    if (graph) {
+        double input = -0.0;
+        double value = graph->forward(&input);
+        CHECK(value == 0.0 && signbit(value), "signed_zero: forward gives %g", value);
+        free_generated_graph(graph);
+    }
+    free_operation(root);
+
+    x = create_variable(1.0);
+    root = create_add_operation(create_mul_operation(x, create_constant(INFINITY)), create_constant(NAN));
+    graph = generate_and_load(root, "not_finite");
+    if (graph) {
+        double input = 1.0, grad;
+        CHECK(isnan(graph->gradient(&input, &grad)), "not_finite: value is a number");
+        CHECK(isinf(grad) && grad > 0, "not_finite: grad is %g", grad);
+        free_generated_graph(graph);
+    }
+    free_operation(root);
+}
+
+static void test_names() {
+    const char* invalid[] = { "", "2fast", "two words", "f(void); int x", "a-b" };
+    DifferentiableOperation* x = create_variable(1.0);
+    DifferentiableOperation* root = create_exp_operation(x);
+    char path[512];
+    scratch_path(path, sizeof(path), "names");
+    for (size_t k = 0; k < sizeof(invalid) / sizeof(invalid[0]); k++) {
+        CHECK(generate_c_code(root, invalid[k], path) == NULL, "generated code named \"%s\"", invalid[k]);
+    }
+    CHECK(access(path, F_OK) != 0, "a file was written for an invalid name");
+
+    GeneratedGraph* graph = generate_c_code(root, "_valid_2", path);
+    CHECK(graph != NULL, "_valid_2: no code generated");
+    if (graph) {
+        CHECK(!load_generated_code(graph, "x; y", path), "loaded code named \"x; y\"");
+        free_generated_graph(graph);
+    }
+    remove_generated(path);
+    free_operation(root);
+}
+
+int main() {
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_gradients();
+    test_special_constants();
+    test_names();
+    rmdir(directory);
+    return check_summary("test_codegen");
+}
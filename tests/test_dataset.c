@@ -0,0 +1,150 @@
+// Checks the dataset files: a round trip through write_dataset() and
+// open_dataset(); that writing rejects labels outside the classes and
+// opening rejects files not marked as checked, and headers whose extents
+// overflow; and that the CSV reader rejects lines too long for its buffer
+// instead of splitting them.
+#include "dataset.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char directory[] = "/tmp/autodiff_dataset_XXXXXX";
+
+static void scratch_path(char* path, size_t size, const char* name) {
+    snprintf(path, size, "%s/%s", directory, name);
+}
+
+static void test_round_trip() {
+    const double features[] = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 };
+    const int labels[] = { 2, 0, 1 };
+    char path[256];
+    scratch_path(path, sizeof(path), "round_trip.bin");
+    CHECK(write_dataset(path, features, labels, 3, 2, 3), "round trip: write failed");
+    Dataset* dataset = open_dataset(path);
+    CHECK(dataset != NULL, "round trip: open failed");
+    if (dataset) {
+        CHECK(dataset->num_samples == 3 && dataset->num_features == 2 && dataset->num_classes == 3,
+              "round trip: %d samples, %d features, %d classes", dataset->num_samples, dataset->num_features,
+              dataset->num_classes);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 2; j++) {
+                CHECK(dataset_feature(dataset, j)[i] == features[i * 2 + j], "round trip: feature %d of sample %d",
+                      j, i);
+            }
+            CHECK(dataset->labels[i] == labels[i], "round trip: label of sample %d", i);
+        }
+        close_dataset(dataset);
+    }
+    unlink(path);
+}
+
+// Rewrites the header of the dataset at path, which holds size bytes
+// saved in contents, and tries to open it
+static Dataset* open_with_header(const char* path, const char* contents, size_t size, const DatasetHeader* header) {
+    FILE* out = fopen(path, "wb");
+    fwrite(header, sizeof(*header), 1, out);
+    fwrite(contents + sizeof(*header), 1, size - sizeof(*header), out);
+    fclose(out);
+    return open_dataset(path);
+}
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* in = fopen(path, "rb");
+    fseek(in, 0, SEEK_END);
+    *size = ftell(in);
+    char* contents = malloc(*size);
+    fseek(in, 0, SEEK_SET);
+    CHECK(fread(contents, 1, *size, in) == *size, "%s: read failed", path);
+    fclose(in);
+    return contents;
+}
+
+static void test_invalid_labels() {
+    const double features[] = { 0.5, 1.5 };
+    const int labels[][2] = { { 0, 3 }, { -1, 0 } };
+    char path[256];
+    scratch_path(path, sizeof(path), "labels.bin");
+    for (int k = 0; k < 2; k++) {
+        CHECK(!write_dataset(path, features, labels[k], 2, 1, 3), "labels: wrote labels %d and %d of 3 classes",
+              labels[k][0], labels[k][1]);
+        CHECK(access(path, F_OK) != 0, "labels: a file was written for labels %d and %d", labels[k][0], labels[k][1]);
+    }
+
+    // A file whose labels were never checked is not trusted
+    const int valid[] = { 2, 0 };
+    CHECK(write_dataset(path, features, valid, 2, 1, 3), "labels: write failed");
+    size_t size;
+    char* contents = read_file(path, &size);
+    DatasetHeader header;
+    memcpy(&header, contents, sizeof(header));
+    CHECK(header.flags & DATASET_LABELS_CHECKED, "labels: written without DATASET_LABELS_CHECKED");
+    header.flags &= ~DATASET_LABELS_CHECKED;
+    Dataset* dataset = open_with_header(path, contents, size, &header);
+    CHECK(dataset == NULL, "labels: opened a dataset without DATASET_LABELS_CHECKED");
+    if (dataset) close_dataset(dataset);
+    free(contents);
+    unlink(path);
+}
+
+// Valid headers but for one field, chosen so that the naive end of the
+// features or labels wraps around to a small number
+static void test_overflowing_headers() {
+    const double features[] = { 0.5, 1.5, 2.5, 3.5 };
+    const int labels[] = { 0, 1 };
+    char path[256];
+    scratch_path(path, sizeof(path), "header.bin");
+    CHECK(write_dataset(path, features, labels, 2, 2, 2), "header: write failed");
+    size_t size;
+    char* contents = read_file(path, &size);
+
+    for (int k = 0; k < 3; k++) {
+        DatasetHeader header;
+        memcpy(&header, contents, sizeof(header));
+        if (k == 0) header.column_stride = (UINT64_MAX / sizeof(double)) / 2 + 1;
+        if (k == 1) header.features_offset = UINT64_MAX - 7;
+        if (k == 2) header.labels_offset = UINT64_MAX - 3;
+        Dataset* dataset = open_with_header(path, contents, size, &header);
+        CHECK(dataset == NULL, "header: opened corrupt header %d", k);
+        if (dataset) close_dataset(dataset);
+    }
+    free(contents);
+    unlink(path);
+}
+
+static int convert_lines(const char* first, int padding, const char* last) {
+    char csv[256], path[256];
+    scratch_path(csv, sizeof(csv), "lines.csv");
+    scratch_path(path, sizeof(path), "lines.bin");
+    FILE* out = fopen(csv, "w");
+    fprintf(out, "%s%*s%s", first, padding, "", last);
+    fclose(out);
+    int ok = convert_csv_dataset(csv, path);
+    unlink(csv);
+    unlink(path);
+    return ok;
+}
+
+// Spaces before a feature are skipped by strtod, so padding makes a valid
+// line of any length; "1.0," and "2.0,a" add 9 characters. The reader's
+// buffer holds 4095.
+static void test_long_csv_lines() {
+    CHECK(convert_lines("1.0,", 4086, "2.0,a\n3.0,4.0,b\n"), "csv: rejected a line of 4095 characters");
+    CHECK(convert_lines("1.0,", 4086, "2.0,a\r\n3.0,4.0,b\r\n"), "csv: rejected a CRLF line of 4095 characters");
+    CHECK(convert_lines("3.0,4.0,b\n1.0,", 4086, "2.0,a"), "csv: rejected a last line of 4095 characters");
+    CHECK(!convert_lines("1.0,", 4087, "2.0,a\n3.0,4.0,b\n"), "csv: split a line of 4096 characters");
+    CHECK(!convert_lines("1.0,", 6000, "2.0,a\n"), "csv: split a line of 6009 characters");
+}
+
+int main() {
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_round_trip();
+    test_invalid_labels();
+    test_overflowing_headers();
+    test_long_csv_lines();
+    rmdir(directory);
+    return check_summary("test_dataset");
+}
@@ -0,0 +1,146 @@
+// Checks the float tape against the double tape on a graph with every
+// scalar operation, lane by lane, in both precisions: values and grads
+// agree to a few float roundings, mixed mode accumulates in double and
+// keeps its master values, and the float sweeps are profiled.
+#include "float_tape.h"
+#include "operations.h"
+#include "profiler.h"
+#include "check.h"
+#include <float.h>
+
+#define NUM_INPUTS 5
+#define LANES 7
+// A few roundings of float, relative to values and grads of order one
+#define TOLERANCE (8 * FLT_EPSILON)
+
+// Dyadic, so loading them into float lanes is exact
+static const double point[NUM_INPUTS] = { 0.375, -0.75, 0.25, 1.125, -0.5 };
+
+typedef struct {
+    DifferentiableOperation* inputs[NUM_INPUTS];
+    DifferentiableOperation* loss;
+} TestGraph;
+
+static TestGraph build_graph() {
+    TestGraph g;
+    for (int j = 0; j < NUM_INPUTS; j++) g.inputs[j] = create_variable(point[j]);
+    DifferentiableOperation** in = g.inputs;
+    DifferentiableOperation* a = create_add_operation(create_mul_operation(in[0], in[1]), create_exp_operation(in[2]));
+    DifferentiableOperation* terms[] = { in[0], in[2], in[3], a };
+    DifferentiableOperation* b = create_sum_operation(terms, 4);
+    DifferentiableOperation* scores[] = { create_exp_operation(a), create_exp_operation(in[4]),
+                                          create_exp_operation(create_mul_operation(b, in[1])) };
+    DifferentiableOperation* p = create_softmax_operation(scores, 3);
+    DifferentiableOperation* logits[] = { a, create_mul_operation(b, p), create_mul_operation(in[3], in[4]) };
+    DifferentiableOperation* xent = create_softmax_cross_entropy_operation(logits, 3, create_constant(2.0));
+    g.loss = create_add_operation(xent, create_mul_operation(p, in[1]));
+    return g;
+}
+
+// Lane l evaluates the graph at point + l / 8
+static double lane_input(int j, int l) {
+    return point[j] + 0.125 * l;
+}
+
+// One forward and backward sweep of the double tape over the same lanes
+static Tape* reference_tape(TestGraph* g) {
+    Tape* tape = compile_batched_tape(&g->loss, 1, LANES);
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        int slot = tape_index_of(tape, g->inputs[j]);
+        for (int l = 0; l < LANES; l++) tape->values[slot * LANES + l] = lane_input(j, l);
+    }
+    tape_forward(tape);
+    int loss_slot = tape_index_of(tape, g->loss);
+    for (int l = 0; l < LANES; l++) tape->grads[loss_slot * LANES + l] = 1.0;
+    tape_backward(tape);
+    return tape;
+}
+
+static void sweep(FloatTape* tape, TestGraph* g) {
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        int slot = tape_index_of(tape->layout, g->inputs[j]);
+        for (int l = 0; l < LANES; l++) tape->values[slot * LANES + l] = (float)lane_input(j, l);
+    }
+    float_tape_forward(tape);
+    int loss_slot = tape_index_of(tape->layout, g->loss);
+    for (int l = 0; l < LANES; l++) tape->grads[loss_slot * LANES + l] = 1.0f;
+    float_tape_backward(tape);
+}
+
+// Every slot's value, and every input's grad, in every lane
+static void test_float32() {
+    TestGraph g = build_graph();
+    Tape* reference = reference_tape(&g);
+    FloatTape* tape = compile_float_tape(&g.loss, 1, LANES, PRECISION_FLOAT32);
+    CHECK(tape->num_nodes == reference->num_nodes, "float32: %d slots, double tape has %d", tape->num_nodes,
+          reference->num_nodes);
+    sweep(tape, &g);
+    for (int i = 0; i < reference->num_nodes; i++) {
+        for (int l = 0; l < LANES; l++) {
+            CHECK_CLOSE(tape->values[i * LANES + l], reference->values[i * LANES + l], TOLERANCE,
+                        "float32: value of slot %d, lane %d", i, l);
+        }
+    }
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        int slot = tape_index_of(reference, g.inputs[j]);
+        for (int l = 0; l < LANES; l++) {
+            CHECK_CLOSE(tape->grads[slot * LANES + l], reference->grads[slot * LANES + l], TOLERANCE,
+                        "float32: grad of input %d, lane %d", j, l);
+        }
+    }
+    free_float_tape(tape);
+    free_tape(reference);
+    free_operation(g.loss);
+}
+
+// Two sweeps: the double accumulators hold twice the grads summed over
+// the lanes, and storing the results leaves the master values alone
+static void test_mixed() {
+    TestGraph g = build_graph();
+    Tape* reference = reference_tape(&g);
+    FloatTape* tape = compile_float_tape(&g.loss, 1, LANES, PRECISION_MIXED);
+    *operation_value(g.inputs[0]) = 0.1;  // Not a float
+    sweep(tape, &g);
+    sweep(tape, &g);
+    float_tape_store_results(tape);
+    CHECK(*operation_value(g.inputs[0]) == 0.1, "mixed: master value overwritten with %.17g", *operation_value(g.inputs[0]));
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        int slot = tape_index_of(reference, g.inputs[j]);
+        double expected = 0.0;
+        for (int l = 0; l < LANES; l++) expected += 2 * reference->grads[slot * LANES + l];
+        CHECK_CLOSE(*variable_grad(g.inputs[j]), expected, TOLERANCE, "mixed: accumulated grad of input %d", j);
+        for (int l = 0; l < LANES; l++) {
+            CHECK(tape->grads[slot * LANES + l] == 0.0f, "mixed: float grad of input %d left in lane %d", j, l);
+        }
+    }
+    free_float_tape(tape);
+    free_tape(reference);
+    free_operation(g.loss);
+}
+
+static void test_profiling() {
+    TestGraph g = build_graph();
+    FloatTape* tape = compile_float_tape(&g.loss, 1, LANES, PRECISION_FLOAT32);
+    reset_profile();
+    enable_profiling(1);
+    sweep(tape, &g);
+    enable_profiling(0);
+    ProfileSummary summary;
+    profile_snapshot(&summary);
+    CHECK(summary.forward_passes == 1 && summary.backward_passes == 1, "profiled %lld forward and %lld backward sweeps",
+          summary.forward_passes, summary.backward_passes);
+    CHECK(summary.ops[OP_SOFTMAX_CROSS_ENTROPY].forward_calls == 1 &&
+              summary.ops[OP_SOFTMAX_CROSS_ENTROPY].backward_calls == 1,
+          "profiled %lld forward and %lld backward cross-entropy calls",
+          summary.ops[OP_SOFTMAX_CROSS_ENTROPY].forward_calls, summary.ops[OP_SOFTMAX_CROSS_ENTROPY].backward_calls);
+    CHECK(summary.ops[OP_EXP].forward_calls == 4, "profiled %lld exp calls", summary.ops[OP_EXP].forward_calls);
+    free_float_tape(tape);
+    free_operation(g.loss);
+}
+
+int main() {
+    test_float32();
+    test_mixed();
+    test_profiling();
+    return check_summary("test_float_tape");
+}
@@ -0,0 +1,248 @@
+// Checks every way of differentiating a graph against central differences
+// of the node evaluator: the tape (one lane and many), backward_pass(),
+// the wavefront scheduler, forward-mode tangents, Hessian-vector products
+// and Jacobians. The test graph uses every scalar operation. Also checks
+// that the scheduler profiles the same nodes as the tape.
+#include "graph_utils.h"
+#include "operations.h"
+#include "tape.h"
+#include "scheduler.h"
+#include "forward_mode.h"
+#include "hessian.h"
+#include "jacobian.h"
+#include "profiler.h"
+#include "check.h"
+
+#define NUM_INPUTS 5
+#define NUM_OUTPUTS 4
+#define LANES 3
+#define STEP 1e-6
+#define TOLERANCE 1e-6
+
+static const double point[NUM_INPUTS] = { 0.3, -0.7, 0.2, 1.1, -0.4 };
+
+typedef struct {
+    DifferentiableOperation* inputs[NUM_INPUTS];
+    DifferentiableOperation* outputs[NUM_OUTPUTS];  // The loss comes last
+    DifferentiableOperation* loss;
+} TestGraph;
+
+static TestGraph build_graph(const double* x) {
+    TestGraph g;
+    for (int j = 0; j < NUM_INPUTS; j++) g.inputs[j] = create_variable(x[j]);
+    DifferentiableOperation** in = g.inputs;
+    DifferentiableOperation* a = create_add_operation(create_mul_operation(in[0], in[1]), create_exp_operation(in[2]));
+    DifferentiableOperation* terms[] = { in[0], in[2], in[3], a };
+    DifferentiableOperation* b = create_sum_operation(terms, 4);
+    DifferentiableOperation* scores[] = { create_exp_operation(a), create_exp_operation(in[4]),
+                                          create_exp_operation(create_mul_operation(b, in[1])) };
+    DifferentiableOperation* p = create_softmax_operation(scores, 3);
+    DifferentiableOperation* logits[] = { a, create_mul_operation(b, p), create_mul_operation(in[3], in[4]) };
+    DifferentiableOperation* xent = create_softmax_cross_entropy_operation(logits, 3, create_constant(2.0));
+    g.loss = create_add_operation(xent, create_mul_operation(p, in[1]));
+    g.outputs[0] = a;
+    g.outputs[1] = b;
+    g.outputs[2] = p;
+    g.outputs[3] = g.loss;
+    return g;
+}
+
+// d output / d input by central differences, evaluated node by node
+static void finite_difference_jacobian(const double* x, double* jacobian) {
+    TestGraph g = build_graph(x);
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        double plus[NUM_OUTPUTS];
+        *operation_value(g.inputs[j]) = x[j] + STEP;
+        forward_all(g.outputs, NUM_OUTPUTS);
+        for (int k = 0; k < NUM_OUTPUTS; k++) plus[k] = *operation_value(g.outputs[k]);
+        *operation_value(g.inputs[j]) = x[j] - STEP;
+        forward_all(g.outputs, NUM_OUTPUTS);
+        for (int k = 0; k < NUM_OUTPUTS; k++) {
+            jacobian[k * NUM_INPUTS + j] = (plus[k] - *operation_value(g.outputs[k])) / (2 * STEP);
+        }
+        *operation_value(g.inputs[j]) = x[j];
+    }
+    free_operation(g.loss);
+}
+
+static void finite_difference_gradient(const double* x, double* gradient) {
+    double jacobian[NUM_OUTPUTS * NUM_INPUTS];
+    finite_difference_jacobian(x, jacobian);
+    for (int j = 0; j < NUM_INPUTS; j++) gradient[j] = jacobian[(NUM_OUTPUTS - 1) * NUM_INPUTS + j];
+}
+
+static void check_gradient(const char* method, const double* actual, const double* expected, double tolerance) {
+    for (int j = 0; j < NUM_INPUTS; j++) {
+        CHECK_CLOSE(actual[j], expected[j], tolerance, "%s, input %d", method, j);
+    }
+}
+
+// Lane l evaluates the graph at point + 0.1 l
+static void test_tape() {
+    double x[LANES][NUM_INPUTS], expected[LANES][NUM_INPUTS];
+    for (int l = 0; l < LANES; l++) {
+        for (int j = 0; j < NUM_INPUTS; j++) x[l][j] = point[j] + 0.1 * l;
+        finite_difference_gradient(x[l], expected[l]);
+    }
+
+    TestGraph g = build_graph(point);
+    Tape* tape = compile_batched_tape(&g.loss, 1, LANES);
+    int loss_slot = tape_index_of(tape, g.loss);
+    for (int pass = 0; pass < 2; pass++) {  // Grads must not leak into the next pass
+        tape_zero_grads(tape);
+        for (int j = 0; j < NUM_INPUTS; j++) {
+            int slot = tape_index_of(tape, g.inputs[j]);
+            for (int l = 0; l < LANES; l++) tape->values[slot * LANES + l] = x[l][j];
+        }
+        tape_forward(tape);
+        for (int l = 0; l < LANES; l++) tape->grads[loss_slot * LANES + l] = 1.0;
+        tape_backward(tape);
+    }
+    for (int l = 0; l < LANES; l++) {
+        double actual[NUM_INPUTS];
+        for (int j = 0; j < NUM_INPUTS; j++) actual[j] = tape->grads[tape_index_of(tape, g.inputs[j]) * LANES + l];
+        char method[32];
+        snprintf(method, sizeof(method), "tape, lane %d", l);
+        check_gradient(method, actual, expected[l], TOLERANCE);
+    }
+    free_tape(tape);
+    free_operation(g.loss);
+}
+
+static void test_backward_pass() {
+    double expected[NUM_INPUTS], actual[NUM_INPUTS];
+    finite_difference_gradient(point, expected);
+    TestGraph g = build_graph(point);
+    GraphContext* ctx = create_graph_context();
+    forward(g.loss);
+    collect_nodes(ctx, g.loss);
+    *context_grad(ctx, g.loss) = 1.0;
+    backward_pass(ctx);
+    for (int j = 0; j < NUM_INPUTS; j++) actual[j] = *variable_grad(g.inputs[j]);
+    check_gradient("backward_pass", actual, expected, TOLERANCE);
+    free_graph_context(ctx);
+    free_operation(g.loss);
+}
+
+// A grain of one slot sends every level wider than one slot to the pool
+static void test_scheduler() {
+    double expected[NUM_INPUTS], actual[NUM_INPUTS];
+    finite_difference_gradient(point, expected);
+    TestGraph g = build_graph(point);
+    Tape* tape = compile_tape(&g.loss, 1);
+    TapeScheduler* scheduler = create_tape_scheduler(tape, 4, 1);
+    for (int pass = 0; pass < 2; pass++) {
+        tape_zero_grads(tape);
+        scheduled_forward(scheduler);
+        tape->grads[tape_index_of(tape, g.loss)] = 1.0;
+        scheduled_backward(scheduler);
+    }
+    for (int j = 0; j < NUM_INPUTS; j++) actual[j] = tape->grads[tape_index_of(tape, g.inputs[j])];
+    check_gradient("scheduler", actual, expected, TOLERANCE);
+    free_tape_scheduler(scheduler);
+    free_tape(tape);
+    free_operation(g.loss);
+}
+
+// A profiled scheduled sweep counts the same nodes as a profiled tape sweep
+static void test_scheduler_profiling() {
+    TestGraph g = build_graph(point);
+    Tape* tape = compile_tape(&g.loss, 1);
+    TapeScheduler* scheduler = create_tape_scheduler(tape, 4, 1);
+    ProfileSummary expected, actual;
+    enable_profiling(1);
+    for (int scheduled = 0; scheduled < 2; scheduled++) {
+        reset_profile();
+        tape_zero_grads(tape);
+        scheduled ? scheduled_forward(scheduler) : tape_forward(tape);
+        tape->grads[tape_index_of(tape, g.loss)] = 1.0;
+        scheduled ? scheduled_backward(scheduler) : tape_backward(tape);
+        profile_snapshot(scheduled ? &actual : &expected);
+    }
+    enable_profiling(0);
+    CHECK(actual.forward_passes == 1 && actual.backward_passes == 1,
+          "scheduler profiling: %lld forward and %lld backward sweeps", actual.forward_passes, actual.backward_passes);
+    CHECK(actual.forward_nodes == expected.forward_nodes && actual.backward_nodes == expected.backward_nodes,
+          "scheduler profiling: %lld and %lld nodes, the tape runs %lld and %lld", actual.forward_nodes,
+          actual.backward_nodes, expected.forward_nodes, expected.backward_nodes);
+    for (int t = 0; t < NUM_OPERATION_TYPES; t++) {
+        CHECK(actual.ops[t].forward_calls == expected.ops[t].forward_calls &&
+                  actual.ops[t].backward_calls == expected.ops[t].backward_calls,
+              "scheduler profiling: %lld and %lld calls of type %d, the tape makes %lld and %lld",
+              actual.ops[t].forward_calls, actual.ops[t].backward_calls, t, expected.ops[t].forward_calls,
+              expected.ops[t].backward_calls);
+    }
+    free_tape_scheduler(scheduler);
+    free_tape(tape);
+    free_operation(g.loss);
+}
+
+// One tangent per input gives the whole gradient in one sweep
+static void test_forward_mode() {
+    double expected[NUM_INPUTS], actual[NUM_INPUTS];
+    finite_difference_gradient(point, expected);
+    TestGraph g = build_graph(point);
+    Tape* tape = compile_tape(&g.loss, 1);
+    tape_enable_tangents(tape, NUM_INPUTS);
+    for (int j = 0; j < NUM_INPUTS; j++) tape_seed_tangent(tape, tape_index_of(tape, g.inputs[j]), j, 1.0);
+    tape_forward_tangents(tape);
+    int loss_slot = tape_index_of(tape, g.loss);
+    for (int j = 0; j < NUM_INPUTS; j++) actual[j] = tape->tangents[loss_slot * NUM_INPUTS + j];
+    check_gradient("forward mode", actual, expected, TOLERANCE);
+    free_tape(tape);
+    free_operation(g.loss);
+}
+
+// H v against central differences of the exact gradient along v
+static void test_hessian_vector_product() {
+    const double direction[NUM_INPUTS] = { 0.5, -1.0, 0.25, 2.0, -0.75 };
+    double expected_gradient[NUM_INPUTS], gradient[NUM_INPUTS], hv[NUM_INPUTS], expected_hv[NUM_INPUTS];
+    finite_difference_gradient(point, expected_gradient);
+
+    TestGraph g = build_graph(point);
+    CHECK(hessian_vector_product(g.loss, g.inputs, NUM_INPUTS, direction, gradient, hv), "hessian_vector_product failed");
+    check_gradient("gradient of hessian_vector_product", gradient, expected_gradient, TOLERANCE);
+
+    Tape* tape = compile_tape(&g.loss, 1);
+    double along[2][NUM_INPUTS];
+    for (int side = 0; side < 2; side++) {
+        for (int j = 0; j < NUM_INPUTS; j++) {
+            *operation_value(g.inputs[j]) = point[j] + (side ? -STEP : STEP) * direction[j];
+        }
+        tape_load_variables(tape);
+        tape_zero_grads(tape);
+        tape_forward(tape);
+        tape->grads[tape_index_of(tape, g.loss)] = 1.0;
+        tape_backward(tape);
+        for (int j = 0; j < NUM_INPUTS; j++) along[side][j] = tape->grads[tape_index_of(tape, g.inputs[j])];
+    }
+    for (int j = 0; j < NUM_INPUTS; j++) expected_hv[j] = (along[0][j] - along[1][j]) / (2 * STEP);
+    check_gradient("hessian_vector_product", hv, expected_hv, 1e-5);
+    free_tape(tape);
+    free_operation(g.loss);
+}
+
+static void test_jacobian() {
+    double expected[NUM_OUTPUTS * NUM_INPUTS], actual[NUM_OUTPUTS * NUM_INPUTS];
+    finite_difference_jacobian(point, expected);
+    TestGraph g = build_graph(point);
+    CHECK(compute_jacobian(g.outputs, NUM_OUTPUTS, g.inputs, NUM_INPUTS, actual), "compute_jacobian failed");
+    for (int k = 0; k < NUM_OUTPUTS; k++) {
+        for (int j = 0; j < NUM_INPUTS; j++) {
+            CHECK_CLOSE(actual[k * NUM_INPUTS + j], expected[k * NUM_INPUTS + j], TOLERANCE,
+                        "jacobian, output %d, input %d", k, j);
+        }
+    }
+    free_operation(g.loss);
+}
+
+int main() {
+    test_tape();
+    test_backward_pass();
+    test_scheduler();
+    test_scheduler_profiling();
+    test_forward_mode();
+    test_hessian_vector_product();
+    test_jacobian();
+    return check_summary("test_gradients");
+}
@@ -0,0 +1,157 @@
+// Checks optimize_graph() on small graphs: the counters of the report for
+// each pass, and that the optimized graph computes the same values and
+// grads as the original. Also covers sums too wide for one node and cycles.
+#include "graph_optimizer.h"
+#include "operations.h"
+#include "tape.h"
+#include "traversal.h"
+#include "check.h"
+
+#define MAX_VARIABLES 8
+#define LONG_CHAIN (MAX_OPERATION_INPUTS + 4465)
+
+typedef struct {
+    double value;
+    double grads[MAX_VARIABLES];
+} Evaluation;
+
+// Value of root and its grads with respect to variables, from a tape
+static Evaluation evaluate(DifferentiableOperation* root, DifferentiableOperation** variables, int num_variables) {
+    Evaluation e;
+    Tape* tape = compile_tape(&root, 1);
+    tape_forward(tape);
+    tape->grads[tape_index_of(tape, root)] = 1.0;
+    tape_backward(tape);
+    e.value = tape->values[tape_index_of(tape, root)];
+    for (int k = 0; k < num_variables; k++) e.grads[k] = tape->grads[tape_index_of(tape, variables[k])];
+    free_tape(tape);
+    return e;
+}
+
+// Optimizes the graph of root and checks it against the original
+static GraphOptimizationReport optimize_and_compare(const char* name, DifferentiableOperation** root,
+                                                    DifferentiableOperation** variables, int num_variables) {
+    Evaluation before = evaluate(*root, variables, num_variables);
+    GraphOptimizationReport report;
+    CHECK(optimize_graph(root, 1, &report), "%s: optimize_graph failed", name);
+    Evaluation after = evaluate(*root, variables, num_variables);
+    CHECK_CLOSE(after.value, before.value, 1e-15, "%s: value", name);
+    for (int k = 0; k < num_variables; k++) {
+        CHECK_CLOSE(after.grads[k], before.grads[k], 1e-15, "%s: grad of variable %d", name, k);
+    }
+    return report;
+}
+
+// (2 * 3 + exp(2)) * x + x: the constant subtree folds into one constant
+static void test_constant_folding() {
+    DifferentiableOperation* x = create_variable(0.7);
+    DifferentiableOperation* two = create_constant(2.0);
+    DifferentiableOperation* scale = create_add_operation(create_mul_operation(two, create_constant(3.0)),
+                                                          create_exp_operation(two));
+    DifferentiableOperation* root = create_add_operation(create_mul_operation(scale, x), x);
+    GraphOptimizationReport r = optimize_and_compare("folding", &root, &x, 1);
+    CHECK(r.nodes_before == 8 && r.nodes_after == 4, "folding: %d -> %d nodes", r.nodes_before, r.nodes_after);
+    CHECK(r.folded == 3 && r.merged == 0 && r.fused == 0, "folding: %d folded, %d merged, %d fused", r.folded,
+          r.merged, r.fused);
+    // Five original nodes and the two constants folded on the way
+    CHECK(r.freed == 7, "folding: %d freed", r.freed);
+    free_operation(root);
+}
+
+// x * y + y * x + exp(x) * exp(x), with 2.0 written twice
+static void test_common_subexpressions() {
+    DifferentiableOperation* v[] = { create_variable(0.3), create_variable(-1.2) };
+    DifferentiableOperation* products = create_add_operation(create_mul_operation(v[0], v[1]),
+                                                             create_mul_operation(v[1], v[0]));
+    DifferentiableOperation* squared = create_mul_operation(create_exp_operation(v[0]), create_exp_operation(v[0]));
+    DifferentiableOperation* scaled = create_mul_operation(create_constant(2.0),
+                                                           create_mul_operation(create_constant(2.0), squared));
+    DifferentiableOperation* root = create_add_operation(products, scaled);
+    GraphOptimizationReport r = optimize_and_compare("cse", &root, v, 2);
+    // y * x, the second exp and the second 2.0 are merged; products joins the top sum
+    CHECK(r.merged == 3 && r.fused == 1 && r.folded == 0, "cse: %d merged, %d fused, %d folded", r.merged,
+          r.fused, r.folded);
+    CHECK(r.nodes_before == 13 && r.nodes_after == 9, "cse: %d -> %d nodes", r.nodes_before, r.nodes_after);
+    CHECK(r.freed == 5, "cse: %d freed", r.freed);
+    free_operation(root);
+}
+
+// A chain of adds becomes one sum; a shared add or a root stays its own node
+static void test_sum_fusion() {
+    DifferentiableOperation* v[MAX_VARIABLES];
+    for (int k = 0; k < MAX_VARIABLES; k++) v[k] = create_variable(0.1 * (k + 1));
+    DifferentiableOperation* chain = v[0];
+    for (int k = 1; k < MAX_VARIABLES; k++) chain = create_add_operation(chain, v[k]);
+    GraphOptimizationReport r = optimize_and_compare("chain", &chain, v, MAX_VARIABLES);
+    CHECK(r.fused == MAX_VARIABLES - 2 && r.nodes_after == MAX_VARIABLES + 1, "chain: %d fused, %d nodes after",
+          r.fused, r.nodes_after);
+    CHECK(chain->type == OP_SUM && chain->num_inputs == MAX_VARIABLES, "chain: root is type %d with %d inputs",
+          chain->type, chain->num_inputs);
+    CHECK(r.freed == MAX_VARIABLES - 1, "chain: %d freed", r.freed);
+    free_operation(chain);
+
+    for (int k = 0; k < 4; k++) v[k] = create_variable(0.5 - 0.2 * k);
+    DifferentiableOperation* shared = create_add_operation(v[0], v[1]);
+    DifferentiableOperation* root = create_mul_operation(create_add_operation(shared, v[2]),
+                                                         create_add_operation(shared, v[3]));
+    r = optimize_and_compare("shared", &root, v, 4);
+    CHECK(r.fused == 0 && r.nodes_after == r.nodes_before, "shared: %d fused, %d -> %d nodes", r.fused,
+          r.nodes_before, r.nodes_after);
+    free_operation(root);
+
+    for (int k = 0; k < 3; k++) v[k] = create_variable(1.0 + k);
+    DifferentiableOperation* roots[2];
+    roots[1] = create_add_operation(v[0], v[1]);
+    roots[0] = create_add_operation(roots[1], v[2]);
+    GraphOptimizationReport both;
+    CHECK(optimize_graph(roots, 2, &both), "roots: optimize_graph failed");
+    CHECK(both.fused == 0 && roots[0]->type == OP_ADD, "roots: %d fused, root type %d", both.fused, roots[0]->type);
+    free_operation(roots[0]);
+}
+
+// More terms than a node can hold: the sum is split, and the graph still
+// computes the same value and grads
+static void test_wide_sum() {
+    CHECK(alloc_operation(OP_SUM, MAX_OPERATION_INPUTS + 1) == NULL, "a node with too many inputs was created");
+
+    DifferentiableOperation* v[2] = { create_variable(0.25), create_variable(-0.5) };
+    DifferentiableOperation* chain = create_add_operation(v[0], v[1]);
+    for (int k = 2; k < LONG_CHAIN; k++) chain = create_add_operation(chain, create_constant(1.0 / k));
+    GraphOptimizationReport r = optimize_and_compare("wide sum", &chain, v, 2);
+    CHECK(r.fused == LONG_CHAIN - 2, "wide sum: %d fused", r.fused);
+
+    NodeList nodes;
+    init_node_list(&nodes);
+    traverse_graph(thread_traversal_stack(), &chain, 1, next_traversal_generation(), append_node, &nodes);
+    int widest = 0;
+    for (int i = 0; i < nodes.num_nodes; i++) {
+        if (nodes.nodes[i]->num_inputs > widest) widest = nodes.nodes[i]->num_inputs;
+    }
+    // Two partial sums under the top sum
+    CHECK(widest == MAX_OPERATION_INPUTS, "wide sum: widest node has %d inputs", widest);
+    CHECK(nodes.num_nodes == LONG_CHAIN + 3, "wide sum: %d nodes after", nodes.num_nodes);
+    free_node_list(&nodes);
+    free_operation(chain);
+}
+
+static void test_cycle() {
+    DifferentiableOperation* x = create_variable(1.0);
+    DifferentiableOperation* y = create_variable(2.0);
+    DifferentiableOperation* a = create_add_operation(x, y);
+    DifferentiableOperation* b = create_mul_operation(a, x);
+    a->operands[1] = b;
+    DifferentiableOperation* root = b;
+    CHECK(optimize_graph(&root, 1, NULL) == 0, "optimize_graph accepted a cycle");
+    CHECK(root == b, "optimize_graph changed the root of a cycle");
+    a->operands[1] = y;
+    free_operation(b);
+}
+
+int main() {
+    test_constant_folding();
+    test_common_subexpressions();
+    test_sum_fusion();
+    test_wide_sum();
+    test_cycle();
+    return check_summary("test_graph_optimizer");
+}
@@ -0,0 +1,207 @@
+// Checks the kernel table picked by kernels() and float_kernels(): the
+// elementwise kernels against plain C on every tail length, and the exp
+// kernels against a reference in a sweep over their input range. The
+// Makefile runs it once per AUTODIFF_SIMD level.
+#include "kernels.h"
+#include "check.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LENGTH 37  // Covers every tail of a 512-bit vector of floats
+#define SWEEP_SAMPLES (1 << 20)
+#define SWEEP_CHUNK 1024
+#define MAX_EXP_ULP 2  // The bound documented in kernels.h
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static double random_uniform(double lo, double hi) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t bits = rng_state * 0x2545F4914F6CDD1Dull;
+    return lo + (hi - lo) * (double)(bits >> 11) / (double)(1ull << 53);
+}
+
+// Distance in representable values between two finite doubles
+static uint64_t ulp_distance(double a, double b) {
+    int64_t x, y;
+    memcpy(&x, &a, sizeof(x));
+    memcpy(&y, &b, sizeof(y));
+    if (x < 0) x = INT64_MIN - x;
+    if (y < 0) y = INT64_MIN - y;
+    return x > y ? (uint64_t)x - (uint64_t)y : (uint64_t)y - (uint64_t)x;
+}
+
+static uint32_t ulp_distance_f32(float a, float b) {
+    int32_t x, y;
+    memcpy(&x, &a, sizeof(x));
+    memcpy(&y, &b, sizeof(y));
+    if (x < 0) x = INT32_MIN - x;
+    if (y < 0) y = INT32_MIN - y;
+    return x > y ? (uint32_t)x - (uint32_t)y : (uint32_t)y - (uint32_t)x;
+}
+
+// Fused and unfused results are both acceptable for the accumulating kernels
+static int is_either(double actual, double fused, double unfused) {
+    return actual == fused || actual == unfused;
+}
+
+static void test_elementwise() {
+    const KernelTable* k = kernels();
+    // One past an aligned start, so no kernel may assume alignment
+    double a[MAX_LENGTH + 1], b[MAX_LENGTH + 1], out[MAX_LENGTH + 1], acc[MAX_LENGTH + 1];
+    for (int n = 0; n <= MAX_LENGTH; n++) {
+        double* x = a + 1;
+        double* y = b + 1;
+        double* o = out + 1;
+        for (int i = 0; i < MAX_LENGTH; i++) {
+            x[i] = random_uniform(-4.0, 4.0);
+            y[i] = random_uniform(0.5, 4.0);
+            o[i] = -1.0;
+        }
+        o[n] = 12345.0;  // Must survive every kernel
+
+        k->add(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] + y[i], "%s add, n = %d, i = %d", k->name, n, i);
+        k->mul(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] * y[i], "%s mul, n = %d, i = %d", k->name, n, i);
+        k->div(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] / y[i], "%s div, n = %d, i = %d", k->name, n, i);
+
+        memcpy(acc, o, sizeof(acc) - sizeof(double));
+        k->fma_acc(o, x, y, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(is_either(o[i], fma(x[i], y[i], acc[i]), acc[i] + x[i] * y[i]), "%s fma_acc, n = %d, i = %d",
+                  k->name, n, i);
+        }
+        memcpy(acc, o, sizeof(acc) - sizeof(double));
+        k->fnma_acc(o, x, y, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(is_either(o[i], fma(-x[i], y[i], acc[i]), acc[i] - x[i] * y[i]), "%s fnma_acc, n = %d, i = %d",
+                  k->name, n, i);
+        }
+        k->exp(o, x, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(ulp_distance(o[i], exp(x[i])) <= MAX_EXP_ULP, "%s exp, n = %d, i = %d", k->name, n, i);
+        }
+        CHECK(o[n] == 12345.0, "%s wrote past n = %d", k->name, n);
+    }
+}
+
+static void test_elementwise_f32() {
+    const FloatKernelTable* k = float_kernels();
+    float a[MAX_LENGTH + 1], b[MAX_LENGTH + 1], out[MAX_LENGTH + 1], acc[MAX_LENGTH + 1];
+    for (int n = 0; n <= MAX_LENGTH; n++) {
+        float* x = a + 1;
+        float* y = b + 1;
+        float* o = out + 1;
+        for (int i = 0; i < MAX_LENGTH; i++) {
+            x[i] = (float)random_uniform(-4.0, 4.0);
+            y[i] = (float)random_uniform(0.5, 4.0);
+            o[i] = -1.0f;
+        }
+        o[n] = 12345.0f;
+
+        k->add(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] + y[i], "%s add_f32, n = %d, i = %d", k->name, n, i);
+        k->mul(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] * y[i], "%s mul_f32, n = %d, i = %d", k->name, n, i);
+        k->div(o, x, y, n);
+        for (int i = 0; i < n; i++) CHECK(o[i] == x[i] / y[i], "%s div_f32, n = %d, i = %d", k->name, n, i);
+
+        memcpy(acc, o, sizeof(acc) - sizeof(float));
+        k->fma_acc(o, x, y, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(o[i] == fmaf(x[i], y[i], acc[i]) || o[i] == (float)(acc[i] + x[i] * y[i]),
+                  "%s fma_acc_f32, n = %d, i = %d", k->name, n, i);
+        }
+        memcpy(acc, o, sizeof(acc) - sizeof(float));
+        k->fnma_acc(o, x, y, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(o[i] == fmaf(-x[i], y[i], acc[i]) || o[i] == (float)(acc[i] - x[i] * y[i]),
+                  "%s fnma_acc_f32, n = %d, i = %d", k->name, n, i);
+        }
+        CHECK(o[n] == 12345.0f, "%s wrote past n = %d", k->name, n);
+    }
+}
+
+// Uniform samples of [lo, hi); returns the largest error in ulp
+static uint64_t sweep_exp(double lo, double hi) {
+    const KernelTable* k = kernels();
+    double x[SWEEP_CHUNK], y[SWEEP_CHUNK];
+    uint64_t worst = 0;
+    for (int done = 0; done < SWEEP_SAMPLES; done += SWEEP_CHUNK) {
+        for (int i = 0; i < SWEEP_CHUNK; i++) x[i] = random_uniform(lo, hi);
+        k->exp(y, x, SWEEP_CHUNK);
+        for (int i = 0; i < SWEEP_CHUNK; i++) {
+            uint64_t error = ulp_distance(y[i], (double)expl(x[i]));
+            if (error > worst) worst = error;
+        }
+    }
+    return worst;
+}
+
+static uint32_t sweep_exp_f32(double lo, double hi) {
+    const FloatKernelTable* k = float_kernels();
+    float x[SWEEP_CHUNK], y[SWEEP_CHUNK];
+    uint32_t worst = 0;
+    for (int done = 0; done < SWEEP_SAMPLES; done += SWEEP_CHUNK) {
+        for (int i = 0; i < SWEEP_CHUNK; i++) x[i] = (float)random_uniform(lo, hi);
+        k->exp(y, x, SWEEP_CHUNK);
+        for (int i = 0; i < SWEEP_CHUNK; i++) {
+            uint32_t error = ulp_distance_f32(y[i], (float)exp((double)x[i]));
+            if (error > worst) worst = error;
+        }
+    }
+    return worst;
+}
+
+static void test_exp_accuracy() {
+    const char* name = kernels()->name;
+    // Normal results only: exp(x) >= DBL_MIN for x >= -708.39
+    uint64_t wide = sweep_exp(-708.0, 709.7);
+    uint64_t near_zero = sweep_exp(-1.0, 1.0);
+    CHECK(wide <= MAX_EXP_ULP, "%s exp is off by %llu ulp over [-708, 709.7]", name, (unsigned long long)wide);
+    CHECK(near_zero <= MAX_EXP_ULP, "%s exp is off by %llu ulp over [-1, 1]", name, (unsigned long long)near_zero);
+
+    // expf(x) >= FLT_MIN for x >= -87.33
+    uint32_t wide_f32 = sweep_exp_f32(-87.3, 88.7);
+    uint32_t near_zero_f32 = sweep_exp_f32(-1.0, 1.0);
+    CHECK(wide_f32 <= MAX_EXP_ULP, "%s expf is off by %u ulp over [-87.3, 88.7]", name, wide_f32);
+    CHECK(near_zero_f32 <= MAX_EXP_ULP, "%s expf is off by %u ulp over [-1, 1]", name, near_zero_f32);
+    printf("%s: exp within %llu ulp, expf within %u ulp\n", name,
+           (unsigned long long)(wide > near_zero ? wide : near_zero), wide_f32 > near_zero_f32 ? wide_f32 : near_zero_f32);
+}
+
+static void test_exp_special_values() {
+    const KernelTable* k = kernels();
+    double x[] = { 0.0, -0.0, 1000.0, INFINITY, -1000.0, -INFINITY, NAN, -740.0 };
+    double y[8];
+    k->exp(y, x, 8);
+    CHECK(y[0] == 1.0 && y[1] == 1.0, "%s exp(0) = %g, exp(-0) = %g", k->name, y[0], y[1]);
+    CHECK(isinf(y[2]) && y[2] > 0 && isinf(y[3]) && y[3] > 0, "%s exp overflow gives %g, %g", k->name, y[2], y[3]);
+    CHECK(y[4] == 0.0 && y[5] == 0.0, "%s exp underflow gives %g, %g", k->name, y[4], y[5]);
+    CHECK(isnan(y[6]), "%s exp(NaN) = %g", k->name, y[6]);
+    CHECK(y[7] >= 0.0 && y[7] < DBL_MIN, "%s exp(-740) = %g is not subnormal", k->name, y[7]);
+
+    const FloatKernelTable* f = float_kernels();
+    float xf[] = { 0.0f, 100.0f, INFINITY, -110.0f, -INFINITY, NAN };
+    float yf[6];
+    f->exp(yf, xf, 6);
+    CHECK(yf[0] == 1.0f, "%s expf(0) = %g", f->name, yf[0]);
+    CHECK(isinf(yf[1]) && isinf(yf[2]), "%s expf overflow gives %g, %g", f->name, yf[1], yf[2]);
+    CHECK(yf[3] == 0.0f && yf[4] == 0.0f, "%s expf underflow gives %g, %g", f->name, yf[3], yf[4]);
+    CHECK(isnan(yf[5]), "%s expf(NaN) = %g", f->name, yf[5]);
+}
+
+int main() {
+    CHECK(strcmp(kernels()->name, float_kernels()->name) == 0, "double kernels %s, float kernels %s",
+          kernels()->name, float_kernels()->name);
+    test_elementwise();
+    test_elementwise_f32();
+    test_exp_special_values();
+    test_exp_accuracy();
+    return check_summary("test_kernels");
+}
@@ -0,0 +1,136 @@
+// Checks the optimizers against hand-computed updates: a few steps each of
+// SGD (with grad scaling and weight decay), momentum (plain and Nesterov),
+// Adam (with and without L2 decay) against the textbook bias-corrected
+// form, and AdamW; then the rate of every learning rate schedule, with and
+// without warmup.
+#include "optimizer.h"
+#include "check.h"
+
+#define STEPS 4
+#define TOLERANCE 1e-14
+
+// Runs STEPS updates of one parameter starting at 1.0 with grads[t] and
+// compares the value after each step with expected[t]
+static void check_steps(const char* name, OptimizerConfig config, const double* grads, double grad_scale,
+                        const double* expected) {
+    DifferentiableOperation* p = create_variable(1.0);
+    Optimizer* optimizer = create_optimizer(&p, 1, config);
+    for (int t = 0; t < STEPS; t++) {
+        *variable_grad(p) = grads[t];
+        optimizer_step(optimizer, grad_scale);
+        CHECK_CLOSE(*operation_value(p), expected[t], TOLERANCE, "%s: value after step %d", name, t + 1);
+    }
+    CHECK(optimizer_steps(optimizer) == STEPS, "%s: %d steps", name, optimizer_steps(optimizer));
+    free_optimizer(optimizer);
+    free_operation(p);
+}
+
+static const double constant_grads[STEPS] = { 1.0, 1.0, 1.0, 1.0 };
+static const double varying_grads[STEPS] = { 1.0, -2.0, 0.5, 3.0 };
+
+static void test_sgd() {
+    OptimizerConfig config = default_optimizer_config(OPTIMIZER_SGD, 0.1);
+    // p -= 0.1 * 0.5 * g
+    const double plain[STEPS] = { 0.95, 1.05, 1.025, 0.875 };
+    check_steps("sgd", config, varying_grads, 0.5, plain);
+
+    // p -= 0.1 * (g + 0.5 * p), i.e. p = 0.95 p - 0.1
+    config.weight_decay = 0.5;
+    const double decayed[STEPS] = { 0.85, 0.7075, 0.572125, 0.44351875 };
+    check_steps("sgd with weight decay", config, constant_grads, 1.0, decayed);
+}
+
+static void test_momentum() {
+    // v = 1, 1.9, 2.71, 3.439
+    OptimizerConfig config = default_optimizer_config(OPTIMIZER_MOMENTUM, 0.1);
+    const double plain[STEPS] = { 0.9, 0.71, 0.439, 0.0951 };
+    check_steps("momentum", config, constant_grads, 1.0, plain);
+
+    // p -= 0.1 * (1 + 0.9 v)
+    config.nesterov = 1;
+    const double nesterov[STEPS] = { 0.81, 0.539, 0.1951, -0.21441 };
+    check_steps("nesterov", config, constant_grads, 1.0, nesterov);
+}
+
+// The textbook form, with the bias-corrected moments spelled out
+static void reference_adam(const OptimizerConfig* config, const double* grads, double* expected) {
+    double p = 1.0, m = 0.0, v = 0.0;
+    int decoupled = config->type == OPTIMIZER_ADAMW;
+    for (int t = 1; t <= STEPS; t++) {
+        double g = grads[t - 1] + (decoupled ? 0.0 : config->weight_decay * p);
+        m = config->beta1 * m + (1.0 - config->beta1) * g;
+        v = config->beta2 * v + (1.0 - config->beta2) * g * g;
+        double m_hat = m / (1.0 - pow(config->beta1, t));
+        double v_hat = v / (1.0 - pow(config->beta2, t));
+        double decay = decoupled ? config->learning_rate * config->weight_decay * p : 0.0;
+        p -= decay + config->learning_rate * m_hat / (sqrt(v_hat) + config->epsilon);
+        expected[t - 1] = p;
+    }
+}
+
+static void test_adam() {
+    double expected[STEPS];
+    OptimizerConfig config = default_optimizer_config(OPTIMIZER_ADAM, 0.1);
+    // A constant grad gives m_hat = v_hat = 1, so every step moves by lr / (1 + eps)
+    for (int t = 0; t < STEPS; t++) expected[t] = 1.0 - (t + 1) * 0.1 / (1.0 + 1e-8);
+    check_steps("adam, constant grad", config, constant_grads, 1.0, expected);
+
+    reference_adam(&config, varying_grads, expected);
+    CHECK_CLOSE(expected[1], 1.0 - 0.1 / (1.0 + 1e-8) + 0.1 * (0.11 / 0.19) / (sqrt(0.004999 / 0.001999) + 1e-8),
+                TOLERANCE, "adam: reference step 2");
+    check_steps("adam", config, varying_grads, 1.0, expected);
+
+    config.weight_decay = 0.1;
+    reference_adam(&config, varying_grads, expected);
+    check_steps("adam with L2 decay", config, varying_grads, 1.0, expected);
+}
+
+static void test_adamw() {
+    double expected[STEPS];
+    OptimizerConfig config = default_optimizer_config(OPTIMIZER_ADAMW, 0.1);
+    // First step: p -= 0.1 * 0.01 * 1 + 0.1 / (1 + eps)
+    reference_adam(&config, varying_grads, expected);
+    CHECK_CLOSE(expected[0], 1.0 - 0.001 - 0.1 / (1.0 + 1e-8), TOLERANCE, "adamw: reference step 1");
+    check_steps("adamw", config, varying_grads, 1.0, expected);
+}
+
+// Rates of the first n steps of schedule for a base rate of 1
+static void check_schedule(const char* name, LearningRateSchedule schedule, const double* expected, int n) {
+    DifferentiableOperation* p = create_variable(0.0);
+    Optimizer* optimizer = create_optimizer(&p, 1, default_optimizer_config(OPTIMIZER_SGD, 1.0));
+    set_learning_rate_schedule(optimizer, schedule);
+    for (int t = 0; t < n; t++) {
+        CHECK_CLOSE(optimizer_learning_rate(optimizer), expected[t], TOLERANCE, "%s: rate of step %d", name, t);
+        optimizer_step(optimizer, 1.0);
+    }
+    free_optimizer(optimizer);
+    free_operation(p);
+}
+
+static void test_schedules() {
+    const double constant[] = { 0.25, 0.5, 0.75, 1.0, 1.0, 1.0 };
+    check_schedule("constant, 4 warmup steps", (LearningRateSchedule){ SCHEDULE_CONSTANT, 4, 1, 1.0, 1, 0.0 },
+                   constant, 6);
+
+    const double step[] = { 1.0, 1.0, 1.0, 0.5, 0.5, 0.5, 0.25 };
+    check_schedule("step", (LearningRateSchedule){ SCHEDULE_STEP, 0, 3, 0.5, 1, 0.0 }, step, 7);
+    const double warm_step[] = { 0.5, 1.0, 1.0, 1.0, 1.0, 0.5 };
+    check_schedule("step, 2 warmup steps", (LearningRateSchedule){ SCHEDULE_STEP, 2, 3, 0.5, 1, 0.0 }, warm_step, 6);
+
+    // 0.1 + 0.45 * (1 + cos(pi t / 4)), then 0.1
+    const double c = 0.45 * sqrt(0.5);
+    const double cosine[] = { 1.0, 0.55 + c, 0.55, 0.55 - c, 0.1, 0.1 };
+    check_schedule("cosine", (LearningRateSchedule){ SCHEDULE_COSINE, 0, 1, 1.0, 4, 0.1 }, cosine, 6);
+    const double warm_cosine[] = { 1.0 / 3, 2.0 / 3, 1.0, 1.0, 0.55 + c, 0.55, 0.55 - c, 0.1 };
+    check_schedule("cosine, 3 warmup steps", (LearningRateSchedule){ SCHEDULE_COSINE, 3, 1, 1.0, 4, 0.1 },
+                   warm_cosine, 8);
+}
+
+int main() {
+    test_sgd();
+    test_momentum();
+    test_adam();
+    test_adamw();
+    test_schedules();
+    return check_summary("test_optimizer");
+}
@@ -0,0 +1,81 @@
+// Checks that parameters created before the registry grows keep working
+// with its new arrays: forward() and the tape read their values from
+// registry->values, backward_pass() and tape_store_results() leave their
+// grads in registry->grads, and parameter_index() still finds them.
+#include "parameters.h"
+#include "graph_utils.h"
+#include "operations.h"
+#include "tape.h"
+#include "check.h"
+
+#define NUM_PARAMS 5  // Two growth steps from a capacity of 2
+
+// loss = a * b + exp(c) + d * e, over parameters [a, b, c, d, e]
+static DifferentiableOperation* build_loss(DifferentiableOperation** p) {
+    DifferentiableOperation* terms[] = { create_mul_operation(p[0], p[1]), create_exp_operation(p[2]),
+                                         create_mul_operation(p[3], p[4]) };
+    return create_sum_operation(terms, 3);
+}
+
+static void expected_gradient(const double* x, double* grads) {
+    grads[0] = x[1];
+    grads[1] = x[0];
+    grads[2] = exp(x[2]);
+    grads[3] = x[4];
+    grads[4] = x[3];
+}
+
+int main() {
+    ParameterRegistry* registry = create_parameter_registry(2);
+    DifferentiableOperation* p[NUM_PARAMS];
+    for (int i = 0; i < NUM_PARAMS; i++) p[i] = create_parameter(registry, 0.5 + i);
+    CHECK(registry->capacity == 8, "the registry grew to %d parameters, not 8", registry->capacity);
+    for (int i = 0; i < NUM_PARAMS; i++) {
+        CHECK(parameter_index(registry, p[i]) == i, "parameter %d has index %d", i, parameter_index(registry, p[i]));
+        CHECK(operation_value(p[i]) == &registry->values[i] && variable_grad(p[i]) == &registry->grads[i],
+              "parameter %d does not point into the registry", i);
+    }
+    DifferentiableOperation* loss = build_loss(p);
+
+    // New values written straight into the registry reach the evaluator
+    const double x[NUM_PARAMS] = { -0.3, 0.8, 0.1, 1.2, -0.6 };
+    for (int i = 0; i < NUM_PARAMS; i++) registry->values[i] = x[i];
+    double expected_loss = x[0] * x[1] + exp(x[2]) + x[3] * x[4];
+    double expected[NUM_PARAMS];
+    expected_gradient(x, expected);
+
+    forward(loss);
+    CHECK_CLOSE(*operation_value(loss), expected_loss, 1e-15, "forward() loss");
+    GraphContext* ctx = create_graph_context();
+    collect_nodes(ctx, loss);
+    zero_parameter_grads(registry);
+    *context_grad(ctx, loss) = 1.0;
+    backward_pass(ctx);
+    for (int i = 0; i < NUM_PARAMS; i++) {
+        CHECK_CLOSE(registry->grads[i], expected[i], 1e-15, "backward_pass() grad of parameter %d", i);
+    }
+    free_graph_context(ctx);
+
+    Tape* tape = compile_tape(&loss, 1);
+    zero_parameter_grads(registry);
+    tape_load_variables(tape);
+    tape_forward(tape);
+    CHECK_CLOSE(tape->values[tape_index_of(tape, loss)], expected_loss, 1e-15, "tape loss");
+    tape->grads[tape_index_of(tape, loss)] = 1.0;
+    tape_backward(tape);
+    tape_store_results(tape);
+    for (int i = 0; i < NUM_PARAMS; i++) {
+        CHECK_CLOSE(registry->grads[i], expected[i], 1e-15, "tape grad of parameter %d", i);
+    }
+    free_tape(tape);
+
+    // And a registry update moves the nodes along
+    parameter_axpy(registry, -1.0);
+    for (int i = 0; i < NUM_PARAMS; i++) {
+        CHECK(*operation_value(p[i]) == x[i] - expected[i], "parameter %d after axpy", i);
+    }
+
+    free_operation(loss);
+    free_parameter_registry(registry);
+    return check_summary("test_parameters");
+}
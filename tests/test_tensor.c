@@ -0,0 +1,217 @@
+// Checks the tensor engine: the backward rule of every tensor operation and
+// every dense activation against central differences, parameter views on
+// a registry, the hand-off to the shared traversal and profiler, and that
+// the scalar engine refuses tensor nodes instead of misreading them.
+#include "tensor.h"
+#include "graph_utils.h"
+#include "operations.h"
+#include "tape.h"
+#include "profiler.h"
+#include "check.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STEP 1e-6
+#define TOLERANCE 1e-6
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static double random_uniform(double lo, double hi) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t bits = rng_state * 0x2545F4914F6CDD1Dull;
+    return lo + (hi - lo) * (double)(bits >> 11) / (double)(1ull << 53);
+}
+
+static TensorOperation* random_tensor(int ndim, int rows, int cols) {
+    int shape[MAX_TENSOR_DIMS] = { rows, cols };
+    TensorOperation* t = create_tensor_variable(ndim, shape, NULL);
+    for (int i = 0; i < t->size; i++) t->value[i] = random_uniform(-1.0, 1.0);
+    return t;
+}
+
+// The scalar loss sum_i seed[i] * root[i], whose gradient is root->grad = seed
+static double seeded_loss(TensorOperation* root, const double* seed) {
+    tensor_forward(root);
+    double loss = 0.0;
+    for (int i = 0; i < root->size; i++) loss += seed[i] * root->value[i];
+    return loss;
+}
+
+// Backpropagates a random seed from root and compares the grads of the
+// variables with central differences of the seeded loss
+static void check_gradients(const char* name, TensorOperation* root, TensorOperation** variables,
+                            int num_variables) {
+    double* seed = malloc(root->size * sizeof(double));
+    for (int i = 0; i < root->size; i++) seed[i] = random_uniform(-1.0, 1.0);
+    tensor_forward(root);
+    tensor_zero_grads(root);
+    for (int i = 0; i < root->size; i++) root->grad[i] = seed[i];
+    tensor_backward(root);
+
+    for (int k = 0; k < num_variables; k++) {
+        TensorOperation* v = variables[k];
+        for (int i = 0; i < v->size; i++) {
+            double original = v->value[i];
+            v->value[i] = original + STEP;
+            double plus = seeded_loss(root, seed);
+            v->value[i] = original - STEP;
+            double minus = seeded_loss(root, seed);
+            v->value[i] = original;
+            CHECK_CLOSE(v->grad[i], (plus - minus) / (2 * STEP), TOLERANCE, "%s, input %d, element %d", name, k, i);
+        }
+    }
+    free(seed);
+}
+
+static void test_elementwise() {
+    TensorOperation* a = random_tensor(2, 3, 4);
+    TensorOperation* b = random_tensor(2, 3, 4);
+    TensorOperation* bias = random_tensor(1, 4, 0);
+    TensorOperation* y = create_tensor_mul_operation(create_tensor_add_operation(a, bias),
+                                                     create_tensor_exp_operation(b));
+    TensorOperation* variables[] = { a, b, bias };
+    check_gradients("add, mul and exp", y, variables, 3);
+    free_tensor_operation(y);
+}
+
+static void test_matmul_softmax() {
+    TensorOperation* w = random_tensor(2, 3, 4);
+    TensorOperation* x = random_tensor(1, 4, 0);
+    TensorOperation* b = random_tensor(1, 3, 0);
+    TensorOperation* p = create_tensor_softmax_operation(
+        create_tensor_add_operation(create_tensor_matmul_operation(w, x), b));
+    TensorOperation* variables[] = { w, x, b };
+    check_gradients("matrix-vector softmax", p, variables, 3);
+    free_tensor_operation(p);
+
+    TensorOperation* xs = random_tensor(2, 5, 4);
+    TensorOperation* wt = random_tensor(2, 4, 3);
+    TensorOperation* batched = create_tensor_softmax_operation(create_tensor_matmul_operation(xs, wt));
+    TensorOperation* batched_variables[] = { xs, wt };
+    check_gradients("matrix-matrix softmax", batched, batched_variables, 2);
+    free_tensor_operation(batched);
+}
+
+// Two stacked layers, wide enough for several tiles of rows and outputs
+static void test_dense() {
+    const char* names[] = { "dense, no activation", "dense, relu", "dense, tanh", "dense, sigmoid" };
+    for (int activation = ACTIVATION_NONE; activation <= ACTIVATION_SIGMOID; activation++) {
+        TensorOperation* x = random_tensor(2, 37, 7);
+        TensorOperation* w1 = random_tensor(2, 40, 7);
+        TensorOperation* b1 = random_tensor(1, 40, 0);
+        TensorOperation* w2 = random_tensor(2, 3, 40);
+        TensorOperation* h = create_tensor_dense_operation(x, w1, b1, activation);
+        TensorOperation* y = create_tensor_dense_operation(h, w2, NULL, ACTIVATION_TANH);
+        CHECK(y->ndim == 2 && y->shape[0] == 37 && y->shape[1] == 3, "%s gives [%d, %d]", names[activation],
+              y->shape[0], y->shape[1]);
+        TensorOperation* variables[] = { x, w1, b1, w2 };
+        check_gradients(names[activation], y, variables, 4);
+        free_tensor_operation(y);
+    }
+
+    TensorOperation* x = random_tensor(1, 7, 0);
+    TensorOperation* w = random_tensor(2, 5, 7);
+    TensorOperation* y = create_tensor_dense_operation(x, w, NULL, ACTIVATION_NONE);
+    CHECK(y->ndim == 1 && y->shape[0] == 5, "dense of a vector gives ndim %d, shape %d", y->ndim, y->shape[0]);
+    TensorOperation* variables[] = { x, w };
+    check_gradients("dense of a vector", y, variables, 2);
+    free_tensor_operation(y);
+}
+
+// A view shares the registry's storage, including after the registry grows
+static void test_registry_view() {
+    ParameterRegistry* registry = create_parameter_registry(1);
+    for (int p = 0; p < 6; p++) create_parameter(registry, random_uniform(-1.0, 1.0));
+    int shape[] = { 2, 3 };
+    TensorOperation* w = create_tensor_view(registry, 0, 2, shape);
+    TensorOperation* x = random_tensor(1, 3, 0);
+    TensorOperation* y = create_tensor_dense_operation(x, w, NULL, ACTIVATION_NONE);
+    CHECK(create_tensor_view(registry, 4, 2, shape) == NULL, "a view past the registry was created");
+
+    for (int p = 0; p < 64; p++) create_parameter(registry, 0.0);  // Moves the arrays
+    registry->values[4] = 2.0;
+    zero_parameter_grads(registry);
+    tensor_forward(y);
+    double expected = registry->values[3] * x->value[0] + registry->values[4] * x->value[1] +
+                      registry->values[5] * x->value[2];
+    CHECK_CLOSE(y->value[1], expected, 1e-15, "the view does not read the registry's values");
+    y->grad[0] = 1.0;
+    y->grad[1] = 0.5;
+    tensor_backward(y);
+    for (int p = 0; p < 6; p++) {
+        CHECK_CLOSE(registry->grads[p], (p < 3 ? 1.0 : 0.5) * x->value[p % 3], 1e-15,
+                    "grad of parameter %d is not in the registry", p);
+    }
+    free_tensor_operation(y);
+    for (int p = 0; p < registry->num_params; p++) release_operation(registry->nodes[p]);
+    free_parameter_registry(registry);
+}
+
+static void test_shared_infrastructure() {
+    TensorOperation* x = random_tensor(1, 4, 0);
+    TensorOperation* y = create_tensor_exp_operation(create_tensor_exp_operation(x));
+    DifferentiableOperation* root = &y->node;
+    CHECK(compile_tape(&root, 1) == NULL, "a tape was compiled from tensor nodes");
+
+    reset_profile();
+    enable_profiling(1);
+    tensor_forward(y);
+    y->grad[0] = 1.0;
+    tensor_backward(y);
+    enable_profiling(0);
+    ProfileSummary summary;
+    profile_snapshot(&summary);
+    CHECK(summary.ops[OP_TENSOR].forward_calls == 2 && summary.ops[OP_TENSOR].backward_calls == 2,
+          "profiled %lld forward and %lld backward tensor calls", summary.ops[OP_TENSOR].forward_calls,
+          summary.ops[OP_TENSOR].backward_calls);
+    free_tensor_operation(y);
+}
+
+// Scalar operations do not take tensor inputs; on a tensor graph the dot
+// file names the tensors without reading a value, forward() leaves them
+// alone and free_operation() refuses to free them
+static void test_scalar_engine_refuses_tensors() {
+    TensorOperation* x = random_tensor(1, 1, 0);
+    CHECK(create_exp_operation(&x->node) == NULL, "scalar engine: exp of a tensor");
+    TensorOperation* y = create_tensor_exp_operation(x);
+    DifferentiableOperation* root = &y->node;
+    char path[] = "/tmp/autodiff_tensor_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0, "scalar engine: no scratch file");
+    if (fd >= 0) {
+        close(fd);
+        GraphContext* ctx = create_graph_context();
+        collect_nodes(ctx, root);
+        generate_dot_file(ctx, root, path);
+        free_graph_context(ctx);
+        FILE* in = fopen(path, "r");
+        char dot[1024] = { 0 };
+        CHECK(in && fread(dot, 1, sizeof(dot) - 1, in) > 0, "scalar engine: empty dot file");
+        if (in) fclose(in);
+        CHECK(strstr(dot, "label=\"tensor\"]") != NULL && strstr(dot, "value") == NULL,
+              "scalar engine: tensor labels in\n%s", dot);
+        unlink(path);
+    }
+
+    y->value[0] = -1.0;
+    forward(root);
+    CHECK(y->value[0] == -1.0, "scalar engine: forward() wrote %g to a tensor", y->value[0]);
+    free_operation(root);
+    tensor_forward(y);
+    CHECK_CLOSE(y->value[0], exp(x->value[0]), 1e-15, "scalar engine: tensors unusable after free_operation()");
+    free_tensor_operation(y);
+}
+
+int main() {
+    test_elementwise();
+    test_matmul_softmax();
+    test_dense();
+    test_registry_view();
+    test_shared_infrastructure();
+    test_scalar_engine_refuses_tensors();
+    return check_summary("test_tensor");
+}
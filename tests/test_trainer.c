@@ -0,0 +1,140 @@
+// Checks the parallel trainer on softmax regression: in PARALLEL_REDUCE
+// mode the summed grads match one tape over the whole batch, for batches
+// whose last chunk is partial and batches that leave some workers idle;
+// in PARALLEL_HOGWILD mode a few epochs bring the loss down.
+#include "trainer.h"
+#include "operations.h"
+#include "check.h"
+
+#define NUM_FEATURES 2
+#define NUM_CLASSES 3
+#define NUM_SAMPLES 37
+#define LANES 4
+#define WORKERS 4
+
+// Samples of class i % 3 around one center each, made deterministic by a
+// small offset depending on i
+static double features[NUM_SAMPLES][NUM_FEATURES];
+static int labels[NUM_SAMPLES];
+
+static void make_samples() {
+    const double centers[NUM_CLASSES][NUM_FEATURES] = { { 1.0, 0.0 }, { -1.0, 1.0 }, { 0.0, -1.5 } };
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        labels[i] = i % NUM_CLASSES;
+        for (int j = 0; j < NUM_FEATURES; j++) {
+            features[i][j] = centers[labels[i]][j] + 0.3 * sin(1.7 * i + j);
+        }
+    }
+}
+
+typedef struct {
+    ParameterRegistry* params;
+    DifferentiableOperation* inputs[NUM_FEATURES];
+    DifferentiableOperation* label;
+    DifferentiableOperation* loss;
+} Model;
+
+// logits_k = sum_j W[k][j] x_j + b[k]; parameters W row by row, then b
+static Model build_model() {
+    Model m;
+    m.params = create_parameter_registry(0);
+    for (int j = 0; j < NUM_FEATURES; j++) m.inputs[j] = create_variable(0.0);
+    m.label = create_variable(0.0);
+    DifferentiableOperation* weights[NUM_CLASSES][NUM_FEATURES];
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        for (int j = 0; j < NUM_FEATURES; j++) weights[k][j] = create_parameter(m.params, 0.1 * sin(3.0 * k + j));
+    }
+    DifferentiableOperation* logits[NUM_CLASSES];
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        DifferentiableOperation* terms[NUM_FEATURES + 1];
+        for (int j = 0; j < NUM_FEATURES; j++) terms[j] = create_mul_operation(weights[k][j], m.inputs[j]);
+        terms[NUM_FEATURES] = create_parameter(m.params, 0.05 * k);
+        logits[k] = create_sum_operation(terms, NUM_FEATURES + 1);
+    }
+    m.loss = create_softmax_cross_entropy_operation(logits, NUM_CLASSES, m.label);
+    return m;
+}
+
+// TapeStep: the inputs and label of samples [first, first + count), then
+// a sweep seeding the loss of those lanes
+static void train_step(Tape* tape, int worker, int first, int count, void* data) {
+    (void)worker;
+    Model* m = data;
+    int lanes = tape->lanes;
+    for (int l = 0; l < count; l++) {
+        for (int j = 0; j < NUM_FEATURES; j++) {
+            tape->values[tape_index_of(tape, m->inputs[j]) * lanes + l] = features[first + l][j];
+        }
+        tape->values[tape_index_of(tape, m->label) * lanes + l] = labels[first + l];
+    }
+    tape_forward(tape);
+    int loss_slot = tape_index_of(tape, m->loss);
+    for (int l = 0; l < count; l++) tape->grads[loss_slot * lanes + l] = 1.0;
+    tape_backward(tape);
+}
+
+// One tape with a lane per sample of [first, first + count): fills grads
+// with the parameter grads summed over the lanes and returns the summed loss
+static double single_tape(Model* m, int first, int count, double* grads) {
+    Tape* tape = compile_batched_tape(&m->loss, 1, count);
+    tape_load_variables(tape);
+    tape_zero_grads(tape);
+    train_step(tape, 0, first, count, m);
+    double loss = 0.0;
+    for (int l = 0; l < count; l++) loss += tape->values[tape_index_of(tape, m->loss) * count + l];
+    for (int p = 0; p < m->params->num_params; p++) {
+        int slot = tape_index_of(tape, m->params->nodes[p]);
+        grads[p] = 0.0;
+        for (int l = 0; l < count; l++) grads[p] += tape->grads[slot * count + l];
+    }
+    free_tape(tape);
+    return loss;
+}
+
+// The full batch ends in a chunk of one sample and splits unevenly over
+// the workers; the short batch only reaches two of them, after the idle
+// ones held grads from the full batch
+static void test_reduce() {
+    Model m = build_model();
+    ParallelTrainer* trainer = create_parallel_trainer(&m.loss, 1, LANES, WORKERS, m.params, PARALLEL_REDUCE);
+    CHECK(trainer != NULL, "reduce: no trainer");
+    const int batches[][2] = { { 0, NUM_SAMPLES }, { 30, 6 } };
+    double expected[NUM_CLASSES * (NUM_FEATURES + 1)];
+    for (int b = 0; trainer && b < 2; b++) {
+        int first = batches[b][0], count = batches[b][1];
+        single_tape(&m, first, count, expected);
+        parallel_train_batch(trainer, first, count, train_step, &m, 0.0);
+        for (int p = 0; p < m.params->num_params; p++) {
+            CHECK_CLOSE(m.params->grads[p], expected[p], 1e-12, "reduce: grad %d over [%d, %d)", p, first,
+                        first + count);
+        }
+    }
+    if (trainer) free_parallel_trainer(trainer);
+    free_operation(m.loss);
+    free_parameter_registry(m.params);
+}
+
+static void test_hogwild() {
+    Model m = build_model();
+    double grads[NUM_CLASSES * (NUM_FEATURES + 1)];
+    double before = single_tape(&m, 0, NUM_SAMPLES, grads) / NUM_SAMPLES;
+    ParallelTrainer* trainer = create_parallel_trainer(&m.loss, 1, LANES, WORKERS, m.params, PARALLEL_HOGWILD);
+    CHECK(trainer != NULL, "hogwild: no trainer");
+    if (trainer) {
+        for (int epoch = 0; epoch < 20; epoch++) {
+            parallel_train_batch(trainer, 0, NUM_SAMPLES, train_step, &m, 0.05);
+        }
+        free_parallel_trainer(trainer);
+    }
+    double after = single_tape(&m, 0, NUM_SAMPLES, grads) / NUM_SAMPLES;
+    CHECK(after < 0.5 * before, "hogwild: mean loss went from %g to %g", before, after);
+    free_operation(m.loss);
+    free_parameter_registry(m.params);
+}
+
+int main() {
+    make_samples();
+    test_reduce();
+    test_hogwild();
+    return check_summary("test_trainer");
+}
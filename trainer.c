@@ -0,0 +1,227 @@
+#include "trainer.h"
+#include <pthread.h>
+
+typedef struct {
+    ParallelTrainer* trainer;
+    int index;
+} TrainerWorker;
+
+struct ParallelTrainer {
+    ParallelMode mode;
+    int num_workers;
+    Tape** tapes;  // One replica per worker
+    ParameterRegistry* params;
+    int* param_slots;  // Tape slot of each parameter
+
+    pthread_t* threads;  // Workers 1 .. num_workers - 1
+    TrainerWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int job;  // Bumped for every batch
+    int pending;
+    int shutdown;
+
+    // The batch being run
+    int first;
+    int count;
+    TapeStep step;
+    void* data;
+    double learning_rate;
+};
+
+// Hogwild workers read and write the shared values without locks; relaxed
+// atomic accesses keep that well defined while allowing lost updates.
+static void load_params(ParallelTrainer* trainer, Tape* tape) {
+    int lanes = tape->lanes;
+    for (int p = 0; p < trainer->params->num_params; p++) {
+        double value;
+        __atomic_load(&trainer->params->values[p], &value, __ATOMIC_RELAXED);
+        double* v = tape->values + (size_t)trainer->param_slots[p] * lanes;
+        for (int l = 0; l < lanes; l++) {
+            v[l] = value;
+        }
+    }
+}
+
+static void apply_params(ParallelTrainer* trainer, Tape* tape) {
+    int lanes = tape->lanes;
+    for (int p = 0; p < trainer->params->num_params; p++) {
+        double* g = tape->grads + (size_t)trainer->param_slots[p] * lanes;
+        double sum = 0.0;
+        for (int l = 0; l < lanes; l++) {
+            sum += g[l];
+            g[l] = 0.0;
+        }
+        double value;
+        __atomic_load(&trainer->params->values[p], &value, __ATOMIC_RELAXED);
+        value -= trainer->learning_rate * sum;
+        __atomic_store(&trainer->params->values[p], &value, __ATOMIC_RELAXED);
+    }
+}
+
+// Worker w takes chunks w, w + num_workers, ... of the batch, so the split
+// and with it the order of the reduction does not depend on timing
+static void run_worker(ParallelTrainer* trainer, int w) {
+    Tape* tape = trainer->tapes[w];
+    int lanes = tape->lanes;
+    int end = trainer->first + trainer->count;
+
+    if (trainer->mode == PARALLEL_REDUCE) {
+        load_params(trainer, tape);
+    }
+    tape_zero_grads(tape);
+    for (int chunk = trainer->first + w * lanes; chunk < end; chunk += trainer->num_workers * lanes) {
+        int n = end - chunk < lanes ? end - chunk : lanes;
+        if (trainer->mode == PARALLEL_HOGWILD) {
+            load_params(trainer, tape);
+        }
+        trainer->step(tape, w, chunk, n, trainer->data);
+        if (trainer->mode == PARALLEL_HOGWILD) {
+            apply_params(trainer, tape);
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    TrainerWorker* worker = arg;
+    ParallelTrainer* trainer = worker->trainer;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&trainer->lock);
+    for (;;) {
+        while (trainer->job == seen && !trainer->shutdown) {
+            pthread_cond_wait(&trainer->start, &trainer->lock);
+        }
+        if (trainer->shutdown) break;
+        seen = trainer->job;
+        pthread_mutex_unlock(&trainer->lock);
+
+        run_worker(trainer, worker->index);
+
+        pthread_mutex_lock(&trainer->lock);
+        if (--trainer->pending == 0) {
+            pthread_cond_signal(&trainer->done);
+        }
+    }
+    pthread_mutex_unlock(&trainer->lock);
+    return NULL;
+}
+
+ParallelTrainer* create_parallel_trainer(DifferentiableOperation** roots, int num_roots, int lanes,
+                                         int num_workers, ParameterRegistry* params, ParallelMode mode) {
+    if (num_workers < 1 || lanes < 1) {
+        fprintf(stderr, "Error: A trainer needs at least one worker and one lane.\n");
+        return NULL;
+    }
+
+    ParallelTrainer* trainer = malloc(sizeof(ParallelTrainer));
+    trainer->mode = mode;
+    trainer->num_workers = num_workers;
+    trainer->tapes = calloc(num_workers, sizeof(Tape*));
+    for (int w = 0; w < num_workers; w++) {
+        trainer->tapes[w] = compile_batched_tape(roots, num_roots, lanes);
+        if (!trainer->tapes[w]) {
+            for (int k = 0; k < w; k++) free_tape(trainer->tapes[k]);
+            free(trainer->tapes);
+            free(trainer);
+            return NULL;
+        }
+    }
+
+    trainer->params = params;
+    trainer->param_slots = malloc((params->num_params > 0 ? params->num_params : 1) * sizeof(int));
+    for (int p = 0; p < params->num_params; p++) {
+        trainer->param_slots[p] = tape_index_of(trainer->tapes[0], params->nodes[p]);
+        if (trainer->param_slots[p] < 0) {
+            fprintf(stderr, "Error: Parameter %d is not a variable of the graph.\n", p);
+            for (int w = 0; w < num_workers; w++) free_tape(trainer->tapes[w]);
+            free(trainer->tapes);
+            free(trainer->param_slots);
+            free(trainer);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&trainer->lock, NULL);
+    pthread_cond_init(&trainer->start, NULL);
+    pthread_cond_init(&trainer->done, NULL);
+    trainer->job = 0;
+    trainer->pending = 0;
+    trainer->shutdown = 0;
+    trainer->threads = malloc(num_workers * sizeof(pthread_t));
+    trainer->workers = malloc(num_workers * sizeof(TrainerWorker));
+    for (int w = 1; w < num_workers; w++) {
+        trainer->workers[w] = (TrainerWorker){ trainer, w };
+        pthread_create(&trainer->threads[w], NULL, worker_main, &trainer->workers[w]);
+    }
+    return trainer;
+}
+
+int parallel_trainer_workers(const ParallelTrainer* trainer) {
+    return trainer->num_workers;
+}
+
+Tape* parallel_trainer_tape(ParallelTrainer* trainer, int worker) {
+    return trainer->tapes[worker];
+}
+
+void parallel_train_batch(ParallelTrainer* trainer, int first, int count, TapeStep step, void* data,
+                          double learning_rate) {
+    trainer->first = first;
+    trainer->count = count;
+    trainer->step = step;
+    trainer->data = data;
+    trainer->learning_rate = learning_rate;
+
+    pthread_mutex_lock(&trainer->lock);
+    trainer->pending = trainer->num_workers - 1;
+    trainer->job++;
+    pthread_cond_broadcast(&trainer->start);
+    pthread_mutex_unlock(&trainer->lock);
+
+    run_worker(trainer, 0);
+
+    pthread_mutex_lock(&trainer->lock);
+    while (trainer->pending > 0) {
+        pthread_cond_wait(&trainer->done, &trainer->lock);
+    }
+    pthread_mutex_unlock(&trainer->lock);
+
+    if (trainer->mode == PARALLEL_REDUCE) {
+        for (int p = 0; p < trainer->params->num_params; p++) {
+            double sum = 0.0;
+            for (int w = 0; w < trainer->num_workers; w++) {
+                const Tape* tape = trainer->tapes[w];
+                const double* g = tape->grads + (size_t)trainer->param_slots[p] * tape->lanes;
+                for (int l = 0; l < tape->lanes; l++) {
+                    sum += g[l];
+                }
+            }
+            trainer->params->grads[p] = sum;
+        }
+    }
+}
+
+void free_parallel_trainer(ParallelTrainer* trainer) {
+    if (trainer->num_workers > 1) {
+        pthread_mutex_lock(&trainer->lock);
+        trainer->shutdown = 1;
+        pthread_cond_broadcast(&trainer->start);
+        pthread_mutex_unlock(&trainer->lock);
+        for (int w = 1; w < trainer->num_workers; w++) {
+            pthread_join(trainer->threads[w], NULL);
+        }
+    }
+    pthread_mutex_destroy(&trainer->lock);
+    pthread_cond_destroy(&trainer->start);
+    pthread_cond_destroy(&trainer->done);
+    for (int w = 0; w < trainer->num_workers; w++) {
+        free_tape(trainer->tapes[w]);
+    }
+    free(trainer->tapes);
+    free(trainer->param_slots);
+    free(trainer->threads);
+    free(trainer->workers);
+    free(trainer);
+}
@@ -0,0 +1,42 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "tape.h"
+#include "parameters.h"
+
+// Data-parallel training over replicas of one compiled tape. Each worker
+// thread owns a tape with its own values and grads, so a minibatch can be
+// split across threads without sharing any adjoint storage.
+//
+// Parameters come from a ParameterRegistry: workers load their values
+// from registry->values, and the registry's grads receive the result.
+//
+// PARALLEL_REDUCE: after every worker has run its share of the batch, the
+// grads of the parameters are summed over workers and lanes into
+// registry->grads, ready for the update.
+// PARALLEL_HOGWILD: every worker applies SGD to registry->values after
+// each of its chunks, without locks. Updates from different
+// workers may overwrite each other, which sparse problems tolerate well.
+typedef enum { PARALLEL_REDUCE, PARALLEL_HOGWILD } ParallelMode;
+
+typedef struct ParallelTrainer ParallelTrainer;
+
+// Called on a worker for samples [first, first + count), count <= lanes.
+// The parameters are already loaded; the step fills the input lanes, runs
+// tape_forward, seeds the loss grads of the first count lanes and runs
+// tape_backward. worker indexes any per-thread state of the caller.
+typedef void (*TapeStep)(Tape* tape, int worker, int first, int count, void* data);
+
+ParallelTrainer* create_parallel_trainer(DifferentiableOperation** roots, int num_roots, int lanes,
+                                         int num_workers, ParameterRegistry* params, ParallelMode mode);
+int parallel_trainer_workers(const ParallelTrainer* trainer);
+Tape* parallel_trainer_tape(ParallelTrainer* trainer, int worker);
+
+// Runs step over samples [first, first + count), handing chunks of up to
+// lanes samples to the workers in turn. learning_rate is only used in
+// PARALLEL_HOGWILD mode. The calling thread acts as worker 0.
+void parallel_train_batch(ParallelTrainer* trainer, int first, int count, TapeStep step, void* data,
+                          double learning_rate);
+void free_parallel_trainer(ParallelTrainer* trainer);
+
+#endif
@@ -0,0 +1,129 @@
+#include "traversal.h"
+#include <stdatomic.h>
+
+#define INITIAL_TRAVERSAL_CAPACITY 64
+
+// Shared by all threads so that no two traversals get the same generation
+static atomic_uint traversal_generation = 0;
+static _Thread_local TraversalStack thread_stack = { NULL, 0 };
+
+void init_traversal_stack(TraversalStack* stack) {
+    stack->capacity = INITIAL_TRAVERSAL_CAPACITY;
+    stack->frames = malloc(stack->capacity * sizeof(TraversalFrame));
+}
+
+void free_traversal_stack(TraversalStack* stack) {
+    free(stack->frames);
+    stack->frames = NULL;
+    stack->capacity = 0;
+}
+
+TraversalStack* thread_traversal_stack() {
+    if (!thread_stack.frames) {
+        init_traversal_stack(&thread_stack);
+    }
+    return &thread_stack;
+}
+
+unsigned int next_traversal_generation() {
+    unsigned int generation = atomic_fetch_add(&traversal_generation, 1) + 1;
+    // Zero is the generation of freshly created nodes, never hand it out
+    if (generation == 0) {
+        generation = atomic_fetch_add(&traversal_generation, 1) + 1;
+    }
+    return generation;
+}
+
+void init_node_list(NodeList* list) {
+    list->capacity = INITIAL_TRAVERSAL_CAPACITY;
+    list->num_nodes = 0;
+    list->nodes = malloc(list->capacity * sizeof(DifferentiableOperation*));
+}
+
+void free_node_list(NodeList* list) {
+    free(list->nodes);
+    list->nodes = NULL;
+    list->num_nodes = 0;
+    list->capacity = 0;
+}
+
+void append_node(DifferentiableOperation* op, void* data) {
+    NodeList* list = data;
+    if (list->num_nodes == list->capacity) {
+        list->capacity *= 2;
+        list->nodes = realloc(list->nodes, list->capacity * sizeof(DifferentiableOperation*));
+    }
+    list->nodes[list->num_nodes++] = op;
+}
+
+static int is_marked(const DifferentiableOperation* op, unsigned int generation) {
+    return generation ? op->generation == generation : op->visit_state != UNVISITED;
+}
+
+static void mark(DifferentiableOperation* op, unsigned int generation) {
+    if (generation) {
+        op->generation = generation;
+        op->on_stack = 1;
+    } else {
+        op->visit_state = VISITING;
+    }
+}
+
+static int is_on_stack(const DifferentiableOperation* op, unsigned int generation) {
+    return generation ? op->on_stack : op->visit_state == VISITING;
+}
+
+// Drops the marks of an abandoned traversal's stack
+static void unwind(TraversalStack* stack, int size, unsigned int generation) {
+    for (int i = 0; i < size; i++) {
+        if (generation) {
+            stack->frames[i].op->on_stack = 0;
+        } else {
+            stack->frames[i].op->visit_state = UNVISITED;
+        }
+    }
+}
+
+int traverse_graph(TraversalStack* stack, DifferentiableOperation** roots, int num_roots,
+                   unsigned int generation, NodeVisitor visit, void* data) {
+    int size = 0;
+
+    for (int r = 0; r < num_roots; r++) {
+        if (is_marked(roots[r], generation)) continue;
+        mark(roots[r], generation);
+        stack->frames[size++] = (TraversalFrame){ roots[r], 0 };
+
+        while (size > 0) {
+            TraversalFrame* frame = &stack->frames[size - 1];
+            DifferentiableOperation* op = frame->op;
+
+            if (frame->next_input < op->num_inputs) {
+                DifferentiableOperation* input = operation_inputs(op)[frame->next_input++];
+                if (is_marked(input, generation)) {
+                    if (is_on_stack(input, generation)) {
+                        fprintf(stderr, "Error: Cycle detected in computation graph involving node at address %p.\n", (void*)input);
+                        unwind(stack, size, generation);
+                        return 0;
+                    }
+                    continue;
+                }
+                mark(input, generation);
+                if (size == stack->capacity) {
+                    stack->capacity *= 2;
+                    stack->frames = realloc(stack->frames, stack->capacity * sizeof(TraversalFrame));
+                }
+                stack->frames[size++] = (TraversalFrame){ input, 0 };
+                continue;
+            }
+
+            if (generation) {
+                op->on_stack = 0;
+            } else {
+                op->visit_state = VISITED;
+            }
+            size--;
+            visit(op, data);
+        }
+    }
+    return 1;
+}
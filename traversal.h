@@ -0,0 +1,46 @@
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include "differentiable_operation.h"
+
+typedef void (*NodeVisitor)(DifferentiableOperation* op, void* data);
+
+typedef struct {
+    DifferentiableOperation* op;
+    int next_input;
+} TraversalFrame;
+
+// Explicit DFS stack; grows on demand so graph depth is bounded by memory,
+// not by the C call stack.
+typedef struct {
+    TraversalFrame* frames;
+    int capacity;
+} TraversalStack;
+
+typedef struct {
+    DifferentiableOperation** nodes;
+    int num_nodes;
+    int capacity;
+} NodeList;
+
+void init_traversal_stack(TraversalStack* stack);
+void free_traversal_stack(TraversalStack* stack);
+TraversalStack* thread_traversal_stack();
+unsigned int next_traversal_generation();
+
+void init_node_list(NodeList* list);
+void free_node_list(NodeList* list);
+void append_node(DifferentiableOperation* op, void* list);  // NodeVisitor
+
+// Iterative post-order DFS over everything reachable from roots: visit()
+// runs exactly once per node, after it has run on all of the node's inputs.
+//
+// With generation == 0, nodes are marked through visit_state and are left
+// VISITED. Otherwise nodes already stamped with generation are skipped and
+// the rest are stamped, leaving visit_state untouched, so no reset walk is
+// needed. Either way, reaching a node that is still on the stack is a
+// cycle and makes the call return 0.
+int traverse_graph(TraversalStack* stack, DifferentiableOperation** roots, int num_roots,
+                   unsigned int generation, NodeVisitor visit, void* data);
+
+#endif